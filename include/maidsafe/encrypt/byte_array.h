@@ -0,0 +1,104 @@
+/*  Copyright 2011 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_ENCRYPT_BYTE_ARRAY_H_
+#define MAIDSAFE_ENCRYPT_BYTE_ARRAY_H_
+
+#include <cstdint>
+#include "cryptopp/config.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+// kUninitialised skips clearing the buffer and should only be used where the caller is about to
+// overwrite all of it.
+enum class ByteArrayFill { kZeroed, kUninitialised };
+
+// kHugePages page-aligns the block and, where the platform supports it, asks for transparent huge
+// page backing.  It is meant for the large buffers which live as long as their SelfEncryptor.
+enum class ByteArrayBacking { kDefault, kHugePages };
+
+// Owning, move-only buffer with its size held inline.  The block goes back to the ByteArray pool
+// when the buffer is destroyed or reset.
+class ByteArray {
+ public:
+  ByteArray() : data_(nullptr), size_(0), pool_index_(0) {}
+  ByteArray(ByteArray&& other);
+  ByteArray& operator=(ByteArray&& other);
+  ~ByteArray() { reset(); }
+  byte* get() const { return data_; }
+  uint32_t size() const { return size_; }
+  explicit operator bool() const { return data_ != nullptr; }
+  void reset();
+
+ private:
+  friend ByteArray GetNewByteArray(uint32_t size, ByteArrayFill fill, ByteArrayBacking backing);
+  ByteArray(byte* data, uint32_t size, uint32_t pool_index)
+      : data_(data), size_(size), pool_index_(pool_index) {}
+  ByteArray(const ByteArray&);
+  ByteArray& operator=(const ByteArray&);
+
+  byte* data_;
+  uint32_t size_, pool_index_;
+};
+
+// Non-owning view of a ByteArray or of any other run of bytes.  It must not outlive the memory it
+// refers to.
+class ByteSpan {
+ public:
+  ByteSpan() : data_(nullptr), size_(0) {}
+  ByteSpan(byte* data, uint32_t size) : data_(data), size_(size) {}
+  ByteSpan(const ByteArray& array) : data_(array.get()), size_(array.size()) {}  // NOLINT
+  byte* get() const { return data_; }
+  uint32_t size() const { return size_; }
+  explicit operator bool() const { return data_ != nullptr; }
+
+ private:
+  byte* data_;
+  uint32_t size_;
+};
+
+// Blocks are taken from a process-wide pool of size classes and returned to it when the ByteArray
+// is destroyed.  They are cache-line aligned, or page aligned once they reach a page.
+ByteArray GetNewByteArray(uint32_t size, ByteArrayFill fill = ByteArrayFill::kZeroed,
+                          ByteArrayBacking backing = ByteArrayBacking::kDefault);
+
+inline uint32_t Size(const ByteSpan& span) { return span.size(); }
+
+uint32_t MemCopy(const ByteSpan& destination, uint32_t destination_offset,
+                 const void* source, uint32_t copy_size);
+
+struct ByteArrayPoolStatistics {
+  ByteArrayPoolStatistics() : allocations(0), pool_hits(0), blocks_held(0), bytes_held(0) {}
+  double HitRate() const {
+    return allocations == 0 ? 0.0 : static_cast<double>(pool_hits) / allocations;
+  }
+  uint64_t allocations, pool_hits, blocks_held, bytes_held;
+};
+
+ByteArrayPoolStatistics GetByteArrayPoolStatistics();
+
+// Returns every block currently held by the pool to the system.
+void ReleaseByteArrayPool();
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_ENCRYPT_BYTE_ARRAY_H_
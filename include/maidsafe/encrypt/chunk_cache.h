@@ -0,0 +1,100 @@
+/*  Copyright 2011 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_ENCRYPT_CHUNK_CACHE_H_
+#define MAIDSAFE_ENCRYPT_CHUNK_CACHE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "maidsafe/encrypt/byte_array.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+struct ChunkCacheStatistics {
+  ChunkCacheStatistics() : hits(0), misses(0), coalesced(0), evictions(0), bytes_held(0) {}
+  double HitRate() const {
+    uint64_t lookups(hits + misses + coalesced);
+    return lookups == 0 ? 0.0 : static_cast<double>(hits + coalesced) / lookups;
+  }
+  // coalesced counts the lookups which missed but waited for another thread's decryption of the
+  // same chunk rather than starting their own.
+  uint64_t hits, misses, coalesced, evictions, bytes_held;
+};
+
+// Decrypted chunks shared by any number of SelfEncryptors, so that a chunk which several files or
+// readers have in common is fetched and decrypted once.  Entries are keyed by the chunk's name
+// (the hash of its stored content) together with what it was decrypted with, so that a DataMap
+// naming a stored chunk under other pre-hashes can't place its decryption where another file would
+// find it.  Up to capacity bytes of chunks are kept, the least recently used being dropped first.
+//
+// Give one instance to every SelfEncryptor in the process via SelfEncryptorOptions::chunk_cache.
+// It must outlive them all.
+class ChunkCache {
+ public:
+  // Decrypts the chunk into the buffer passed, which holds its full size, and returns kSuccess or
+  // an error code.
+  typedef std::function<int(byte*)> Decryptor;
+
+  explicit ChunkCache(uint64_t capacity);
+  // Sets *chunk to the chunk held under key, or else calls decrypt to produce size bytes for it.
+  // While one caller is decrypting, the others asking for the same key wait for it and then share
+  // its result, so each chunk is decrypted once however many threads want it at once.  If decrypt
+  // fails, every one of them is given its error and nothing is kept.
+  int Get(const std::string& key, uint32_t size, const Decryptor& decrypt,
+          std::shared_ptr<const ByteArray>* chunk);
+  bool Contains(const std::string& key) const;
+  void Clear();
+  uint64_t capacity() const { return kCapacity_; }
+  ChunkCacheStatistics statistics() const;
+
+ private:
+  struct Decryption;
+  typedef std::list<std::pair<std::string, std::shared_ptr<const ByteArray>>> ChunkList;
+
+  ChunkCache(const ChunkCache&);
+  ChunkCache& operator=(const ChunkCache&);
+
+  // Drops the least recently used chunks until the total is within kCapacity_.  Must be called
+  // with mutex_ held.
+  void Trim();
+
+  const uint64_t kCapacity_;
+  // Most recently used first.
+  ChunkList chunks_;
+  std::map<std::string, ChunkList::iterator> index_;
+  std::map<std::string, std::shared_ptr<Decryption>> decryptions_;
+  uint64_t bytes_held_, hits_, misses_, coalesced_, evictions_;
+  mutable std::mutex mutex_;
+  std::condition_variable decrypted_;
+};
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_ENCRYPT_CHUNK_CACHE_H_
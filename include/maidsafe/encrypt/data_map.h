@@ -20,11 +20,12 @@
 #define MAIDSAFE_ENCRYPT_DATA_MAP_H_
 
 #include <cstdint>
+#include <cstring>
+#include <iterator>
 #include <string>
 #include <vector>
 
 #include "maidsafe/common/crypto.h"
-#include "boost/shared_array.hpp"
 
 namespace maidsafe {
 
@@ -32,6 +33,20 @@ namespace encrypt {
 
 enum class EncryptionAlgorithm : uint32_t;
 
+// Compression applied to a chunk before encryption.  Values are persisted in serialised DataMaps.
+// Chunks of kSelfEncryptionVersion0 DataMaps are always kGzip.
+enum class CompressionType : uint32_t {
+  kGzip = 0,
+  kStore,
+  kLz4,
+  kZstd
+};
+
+// Chunk names (SHA512, or BLAKE2b-512 for kSelfEncryptionVersion2) and pre-hashes are this long.
+const uint32_t kChunkHashSize(crypto::SHA512::DIGESTSIZE);
+
+// The details of one chunk, as a standalone value.  DataMap doesn't hold these; see
+// ChunkDetailsList.
 struct ChunkDetails {
   enum PreHashState {
     kEmpty,
@@ -46,21 +61,234 @@ struct ChunkDetails {
   ChunkDetails()
       : hash(),
         pre_hash(),
-        old_n1_pre_hash(),
-        old_n2_pre_hash(),
         pre_hash_state(kEmpty),
         storage_state(kUnstored),
-        size(0) {}
-  std::string hash;                           // SHA512 of processed chunk
-  byte pre_hash[crypto::SHA512::DIGESTSIZE];  // SHA512 of unprocessed src data
-  // pre hashes of chunks n-1 and n-2, only valid if chunk n-1 or n-2 has
-  // modified content
-  boost::shared_array<byte> old_n1_pre_hash, old_n2_pre_hash;
+        size(0),
+        compression(CompressionType::kGzip) {}
+  // Hash of processed chunk (empty until the chunk is first stored) and of unprocessed data
+  std::string hash;
+  byte pre_hash[kChunkHashSize];
   // If the pre_hash hasn't been calculated, or if data has been written to the
   // chunk since the pre_hash was last calculated, pre_hash_ok should be false.
   PreHashState pre_hash_state;
   StorageState storage_state;
   uint32_t size;  // Size of unprocessed source data in bytes
+  CompressionType compression;
+};
+
+namespace detail {
+
+// Layout of the state byte ChunkDetailsList keeps for each chunk.  The pre-hash state has a byte
+// of its own, as the writing thread changes it while background batches set the other fields.
+const int kStorageStateShift(0), kCompressionShift(2);
+const uint8_t kHashSetFlag(0x10);
+const uint8_t kDefaultChunkState(ChunkDetails::kUnstored << kStorageStateShift);
+
+// Reads and writes the two bits at kShift of a chunk's state byte as if they were an Enum.
+template <typename Enum, int kShift>
+class PackedState {
+ public:
+  explicit PackedState(uint8_t* state) : state_(state) {}
+  PackedState& operator=(const PackedState& other) { return *this = static_cast<Enum>(other); }
+  PackedState& operator=(Enum value) {
+    *state_ = static_cast<uint8_t>((*state_ & ~(3 << kShift)) |
+                                   ((static_cast<uint8_t>(value) & 3) << kShift));
+    return *this;
+  }
+  operator Enum() const { return static_cast<Enum>((*state_ >> kShift) & 3); }  // NOLINT
+
+ private:
+  uint8_t* state_;
+};
+
+}  // namespace detail
+
+// View of a chunk's hash, which is either empty or kChunkHashSize bytes long.
+class ConstChunkHashRef {
+ public:
+  ConstChunkHashRef(const byte* hash, const uint8_t* state) : hash_(hash), state_(state) {}
+  bool empty() const { return (*state_ & detail::kHashSetFlag) == 0; }
+  size_t size() const { return empty() ? 0 : kChunkHashSize; }
+  const char* data() const { return reinterpret_cast<const char*>(hash_); }
+  char operator[](size_t index) const { return data()[index]; }
+  std::string string() const { return std::string(data(), size()); }
+  operator std::string() const { return string(); }  // NOLINT
+
+ private:
+  const byte* hash_;
+  const uint8_t* state_;
+};
+
+class ChunkHashRef : public ConstChunkHashRef {
+ public:
+  ChunkHashRef(byte* hash, uint8_t* state) : ConstChunkHashRef(hash, state), hash_(hash),
+                                             state_(state) {}
+  // Throws invalid_string_size unless hash is empty or kChunkHashSize bytes long.
+  ChunkHashRef& operator=(const std::string& hash);
+  ChunkHashRef& operator=(const ConstChunkHashRef& other);
+  ChunkHashRef& operator=(const ChunkHashRef& other);
+  char* data() { return reinterpret_cast<char*>(hash_); }
+  char& operator[](size_t index) { return data()[index]; }
+  // Only 0 and kChunkHashSize are valid; growing an empty hash zeroes it.
+  void resize(size_t size);
+
+ private:
+  byte* hash_;
+  uint8_t* state_;
+};
+
+bool operator==(const ConstChunkHashRef& lhs, const ConstChunkHashRef& rhs);
+bool operator==(const ConstChunkHashRef& lhs, const std::string& rhs);
+inline bool operator==(const std::string& lhs, const ConstChunkHashRef& rhs) { return rhs == lhs; }
+inline bool operator!=(const ConstChunkHashRef& lhs, const ConstChunkHashRef& rhs) {
+  return !(lhs == rhs);
+}
+inline bool operator!=(const ConstChunkHashRef& lhs, const std::string& rhs) {
+  return !(lhs == rhs);
+}
+inline bool operator!=(const std::string& lhs, const ConstChunkHashRef& rhs) {
+  return !(rhs == lhs);
+}
+
+class ChunkDetailsList;
+class ChunkDetailsRef;
+
+// Read-only view of one entry of a ChunkDetailsList, with the members of ChunkDetails.  It must not
+// outlive the list, nor be used once the list has grown.
+class ConstChunkDetailsRef {
+ public:
+  ConstChunkDetailsRef(const ChunkDetailsRef& other);  // NOLINT
+  operator ChunkDetails() const;  // NOLINT
+
+  ConstChunkHashRef hash;
+  const byte (&pre_hash)[kChunkHashSize];
+  ChunkDetails::PreHashState pre_hash_state;
+  ChunkDetails::StorageState storage_state;
+  uint32_t size;
+  CompressionType compression;
+
+ private:
+  friend class ChunkDetailsList;
+  ConstChunkDetailsRef(const ChunkDetailsList& list, size_t index);
+  ConstChunkDetailsRef& operator=(const ConstChunkDetailsRef&);
+};
+
+// Writable view of one entry of a ChunkDetailsList.  Assigning to it, or to its members, changes
+// the entry.  As for ConstChunkDetailsRef, it must not outlive the list or be used once it grows.
+class ChunkDetailsRef {
+ public:
+  ChunkDetailsRef& operator=(const ChunkDetails& other);
+  ChunkDetailsRef& operator=(const ConstChunkDetailsRef& other);
+  ChunkDetailsRef& operator=(const ChunkDetailsRef& other);
+  operator ChunkDetails() const;  // NOLINT
+
+  ChunkHashRef hash;
+  byte (&pre_hash)[kChunkHashSize];
+  detail::PackedState<ChunkDetails::PreHashState, 0> pre_hash_state;
+  detail::PackedState<ChunkDetails::StorageState, detail::kStorageStateShift> storage_state;
+  uint32_t& size;
+  detail::PackedState<CompressionType, detail::kCompressionShift> compression;
+
+ private:
+  friend class ChunkDetailsList;
+  ChunkDetailsRef(ChunkDetailsList* list, size_t index);
+};
+
+// Random access iterator over a ChunkDetailsList, dereferencing to a Reference by value.
+template <typename List, typename Reference>
+class ChunkDetailsIterator {
+ public:
+  typedef std::random_access_iterator_tag iterator_category;
+  typedef ChunkDetails value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef void pointer;
+  typedef Reference reference;
+
+  ChunkDetailsIterator() : list_(nullptr), index_(0) {}
+  ChunkDetailsIterator(List* list, size_t index) : list_(list), index_(index) {}
+  Reference operator*() const { return (*list_)[index_]; }
+  Reference operator[](difference_type offset) const { return (*list_)[index_ + offset]; }
+  ChunkDetailsIterator& operator++() {
+    ++index_;
+    return *this;
+  }
+  ChunkDetailsIterator operator++(int) { return ChunkDetailsIterator(list_, index_++); }
+  ChunkDetailsIterator& operator--() {
+    --index_;
+    return *this;
+  }
+  ChunkDetailsIterator operator--(int) { return ChunkDetailsIterator(list_, index_--); }
+  ChunkDetailsIterator& operator+=(difference_type offset) {
+    index_ += offset;
+    return *this;
+  }
+  ChunkDetailsIterator& operator-=(difference_type offset) {
+    index_ -= offset;
+    return *this;
+  }
+  ChunkDetailsIterator operator+(difference_type offset) const {
+    return ChunkDetailsIterator(list_, index_ + offset);
+  }
+  ChunkDetailsIterator operator-(difference_type offset) const {
+    return ChunkDetailsIterator(list_, index_ - offset);
+  }
+  difference_type operator-(const ChunkDetailsIterator& other) const {
+    return static_cast<difference_type>(index_) - static_cast<difference_type>(other.index_);
+  }
+  bool operator==(const ChunkDetailsIterator& other) const { return index_ == other.index_; }
+  bool operator!=(const ChunkDetailsIterator& other) const { return index_ != other.index_; }
+  bool operator<(const ChunkDetailsIterator& other) const { return index_ < other.index_; }
+  bool operator>(const ChunkDetailsIterator& other) const { return index_ > other.index_; }
+  bool operator<=(const ChunkDetailsIterator& other) const { return index_ <= other.index_; }
+  bool operator>=(const ChunkDetailsIterator& other) const { return index_ >= other.index_; }
+
+ private:
+  List* list_;
+  size_t index_;
+};
+
+// The chunks of a DataMap, held as one array per field rather than one struct per chunk, so that a
+// multi-terabyte file's millions of chunks take about 134 bytes each, with no allocation per chunk.
+// It has the std::vector<ChunkDetails> members DataMap users relied on, but (as for
+// std::vector<bool>) elements are views rather than ChunkDetails objects: bind them with auto,
+// const auto& or a ChunkDetailsRef, not with auto& or a ChunkDetails&.
+class ChunkDetailsList {
+ public:
+  typedef ChunkDetails value_type;
+  typedef ChunkDetailsRef reference;
+  typedef ConstChunkDetailsRef const_reference;
+  typedef ChunkDetailsIterator<ChunkDetailsList, ChunkDetailsRef> iterator;
+  typedef ChunkDetailsIterator<const ChunkDetailsList, ConstChunkDetailsRef> const_iterator;
+  typedef size_t size_type;
+
+  ChunkDetailsList() : hashes_(), pre_hashes_(), sizes_(), pre_hash_states_(), states_() {}
+  size_t size() const { return sizes_.size(); }
+  bool empty() const { return sizes_.empty(); }
+  // Entries can be added without moving existing ones (and so invalidating views of them) until
+  // size() reaches capacity().
+  size_t capacity() const;
+  void reserve(size_t count);
+  void resize(size_t count);
+  void clear();
+  void push_back(const ChunkDetails& chunk);
+  ChunkDetailsRef operator[](size_t index) { return ChunkDetailsRef(this, index); }
+  ConstChunkDetailsRef operator[](size_t index) const { return ConstChunkDetailsRef(*this, index); }
+  ChunkDetailsRef front() { return (*this)[0]; }
+  ConstChunkDetailsRef front() const { return (*this)[0]; }
+  ChunkDetailsRef back() { return (*this)[size() - 1]; }
+  ConstChunkDetailsRef back() const { return (*this)[size() - 1]; }
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, size()); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size()); }
+
+ private:
+  friend class ConstChunkDetailsRef;
+  friend class ChunkDetailsRef;
+
+  std::vector<byte> hashes_, pre_hashes_;  // kChunkHashSize bytes per chunk
+  std::vector<uint32_t> sizes_;
+  std::vector<uint8_t> pre_hash_states_, states_;
 };
 
 struct DataMap {
@@ -69,7 +297,7 @@ struct DataMap {
   bool empty() const;
 
   EncryptionAlgorithm self_encryption_version;
-  std::vector<ChunkDetails> chunks;
+  ChunkDetailsList chunks;
   std::string content;  // Whole data item, if small enough
 };
 
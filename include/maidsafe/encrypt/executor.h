@@ -0,0 +1,112 @@
+/*  Copyright 2011 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_ENCRYPT_EXECUTOR_H_
+#define MAIDSAFE_ENCRYPT_EXECUTOR_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace maidsafe {
+
+namespace encrypt {
+
+// Runs the per-chunk hashing, encryption and decryption work of SelfEncryptors.  One executor can
+// be shared by any number of SelfEncryptors, so that many open files share a bounded set of
+// threads.
+class Executor {
+ public:
+  typedef std::function<void(int64_t)> IndexedTask;
+
+  virtual ~Executor() {}
+  // Calls task(i) for every i in [begin, end), possibly concurrently, and returns once all calls
+  // have finished.  The calling thread does some of the work itself, and tasks may call ParallelFor
+  // again.  If any call throws, the first exception is rethrown here after the others finish.
+  virtual void ParallelFor(int64_t begin, int64_t end, const IndexedTask& task) = 0;
+  // Queues task to run asynchronously and returns.  Exceptions thrown by task are logged and
+  // dropped.
+  virtual void Post(std::function<void()> task) = 0;
+  // Runs one queued task on the calling thread, if there is one, and returns whether it did.
+  // Threads waiting for posted work call this, so that waiting on a worker can't starve the pool.
+  virtual bool RunPendingTask() = 0;
+  // The number of threads which can be running tasks at once, including the caller.
+  virtual int Concurrency() const = 0;
+};
+
+// Runs everything on the calling thread, including posted tasks, which run before Post returns.
+class InlineExecutor : public Executor {
+ public:
+  void ParallelFor(int64_t begin, int64_t end, const IndexedTask& task) override;
+  void Post(std::function<void()> task) override;
+  bool RunPendingTask() override { return false; }
+  int Concurrency() const override { return 1; }
+};
+
+// Fixed set of worker threads, each with its own task deque.  A worker takes its newest task
+// first and, once its own deque is empty, steals the oldest task from another worker.
+// ParallelFor queues up to one helper per worker; the helpers and the caller then claim indices
+// from a shared counter, so a busy pool just leaves more of the loop to the caller.
+class WorkStealingExecutor : public Executor {
+ public:
+  explicit WorkStealingExecutor(int thread_count);
+  ~WorkStealingExecutor();
+  void ParallelFor(int64_t begin, int64_t end, const IndexedTask& task) override;
+  void Post(std::function<void()> task) override;
+  bool RunPendingTask() override;
+  int Concurrency() const override { return static_cast<int>(threads_.size()) + 1; }
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  WorkStealingExecutor(const WorkStealingExecutor&);
+  WorkStealingExecutor& operator=(const WorkStealingExecutor&);
+
+  void Push(std::function<void()> task);
+  // Runs one queued task, preferring the deque of worker "self" (which may be -1 for a thread
+  // outside the pool).  Returns false if there was nothing to run.
+  bool TryRunOne(int self);
+  void Run(int self);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::mutex wake_mutex_;
+  std::condition_variable wake_;
+  std::atomic<int64_t> queued_;
+  std::atomic<uint32_t> next_worker_;
+  bool stopping_;
+  std::vector<std::thread> threads_;
+};
+
+// Process-wide WorkStealingExecutor with one worker fewer than the hardware concurrency (callers
+// take part in their own loops).  Created on first use and never destroyed.
+Executor& DefaultExecutor();
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_ENCRYPT_EXECUTOR_H_
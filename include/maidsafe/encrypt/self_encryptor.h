@@ -19,17 +19,26 @@
 #ifndef MAIDSAFE_ENCRYPT_SELF_ENCRYPTOR_H_
 #define MAIDSAFE_ENCRYPT_SELF_ENCRYPTOR_H_
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <functional>
+#include <future>
+#include <list>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "maidsafe/common/crypto.h"
 #include "maidsafe/common/types.h"
 #include "maidsafe/common/data_stores/data_buffer.h"
 
+#include "maidsafe/encrypt/byte_array.h"
 #include "maidsafe/encrypt/data_map.h"
 
 namespace maidsafe {
@@ -38,28 +47,171 @@ namespace encrypt {
 
 enum class EncryptionAlgorithm : uint32_t {
   kSelfEncryptionVersion0 = 0,
-  kDataMapEncryptionVersion0
+  kDataMapEncryptionVersion0,
+  // As version 0, but each chunk's compression is recorded in ChunkDetails::compression rather
+  // than always being gzip.
+  kSelfEncryptionVersion1,
+  // As version 1, but BLAKE2b-512 replaces SHA-512 for chunk pre-hashes (from which each chunk's
+  // key, IV and pad are taken) and for chunk names.
+  kSelfEncryptionVersion2
 };
 
 extern const EncryptionAlgorithm kSelfEncryptionVersion;
 extern const EncryptionAlgorithm kDataMapEncryptionVersion;
 
+class ChunkCache;
+class Executor;
 class Sequencer;
 
+// Compression used when encrypting chunks of a kSelfEncryptionVersion1 (or later) DataMap.  For
+// version 0 DataMaps this is ignored and gzip at level 1 is always used.  If skip_incompressible is
+// set, each chunk is first probed and, if it looks incompressible, stored as kStore instead.
+struct CompressionConfig {
+  CompressionConfig() : type(CompressionType::kGzip), level(1), skip_incompressible(true) {}
+  CompressionConfig(CompressionType type_in, int level_in, bool skip_incompressible_in = true)
+      : type(type_in), level(level_in), skip_incompressible(skip_incompressible_in) {}
+  CompressionType type;
+  int level;
+  bool skip_incompressible;
+};
+
+// Totals for the chunks encrypted by a SelfEncryptor.  bytes_skipped is the raw size of the chunks
+// which the probe decided not to pass through the compressor.
+struct CompressionStatistics {
+  CompressionStatistics() : chunks_probed(0), chunks_skipped(0), bytes_skipped(0) {}
+  uint64_t chunks_probed, chunks_skipped, bytes_skipped;
+};
+
+// Totals for a SelfEncryptor's read cache.  Each chunk which a Read covers only in part counts as
+// one hit or one miss.
+struct ReadCacheStatistics {
+  ReadCacheStatistics() : hits(0), misses(0), evictions(0), bytes_held(0) {}
+  double HitRate() const {
+    return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses);
+  }
+  uint64_t hits, misses, evictions, bytes_held;
+};
+
+// Given the names of several chunks, returns their contents in the same order.  A chunk which
+// can't be fetched may be left uninitialised.
+typedef std::function<std::future<std::vector<NonEmptyString>>(
+    const std::vector<std::string>& names)> BatchGetFromStore;
+
+// Settings for one SelfEncryptor.  Counts of chunks are in units of kDefaultChunkSize.  Any size
+// left as 0 is derived from parallelism, which itself defaults to the number of hardware threads.
+//
+// If memory_limit is set, the derived sizes are reduced until everything the SelfEncryptor can
+// hold at once fits within it: the write queues, the read cache, the read buffer, the readahead
+// and Flush windows, and the stored chunks fetched for each of these.  Construction throws if the
+// sizes which were set explicitly don't fit.  Out-of-order writes are held until the write queue
+// reaches them, and unless they can be spilled, Write fails rather than let them take the total
+// over the limit.
+struct SelfEncryptorOptions {
+  SelfEncryptorOptions();
+  // Chunks worked on in parallel.
+  uint32_t parallelism;
+  // Chunks written before the write queue is encrypted.  Defaults to parallelism.
+  uint32_t queue_chunks;
+  // Size of the read cache, which keeps the chunks that reads have covered only in part, shared by
+  // all readers and dropping the least recently used first.  Defaults to parallelism.
+  uint32_t read_cache_chunks;
+  // Most bytes of a file read at random which are decrypted at once and then read from memory.
+  // Defaults to 20 times the read cache.
+  uint32_t read_buffer_size;
+  // Most chunks decrypted ahead of sequential reads.  Defaults to 16.
+  uint32_t readahead_chunks;
+  // Bytes, or 0 for no limit.
+  uint64_t memory_limit;
+  // Compression for the chunks of version 1 (or later) DataMaps.  Defaults to gzip at level 1.
+  CompressionConfig compression;
+  // Runs the per-chunk work, or null for the process-wide DefaultExecutor().
+  Executor* executor;
+  // Write queues.  0 or 1 encrypts each full queue within Write; more than 1 encrypts them in the
+  // background while the next one fills.
+  uint32_t pipeline_buffers;
+  // Chunks re-encrypted at once by Flush.  Defaults to parallelism.
+  uint32_t flush_window;
+  // Fetches chunks needed together in one call, or empty to fetch each with get_from_store.  Any
+  // chunk it fails to supply is still fetched with get_from_store.
+  BatchGetFromStore batch_get_from_store;
+  // Bytes of out-of-order writes held in memory, or 0 for no limit.  Beyond this, those furthest
+  // into the file are moved to a memory-mapped temporary file, encrypted under a key which is
+  // never stored, until the write queue or Flush reaches them.  Counts against memory_limit.
+  uint64_t spill_threshold;
+  // Cache of decrypted chunks shared with other SelfEncryptors, or null for none.  Every chunk
+  // decrypted is then fetched and decrypted whole through it, and chunks found there aren't
+  // requested from the buffer or the store at all.  Being shared, it doesn't count against
+  // memory_limit.
+  ChunkCache* chunk_cache;
+};
+
 crypto::CipherText EncryptDataMap(const Identity& parent_id, const Identity& this_id,
                                   const DataMap& data_map);
 
 DataMap DecryptDataMap(const Identity& parent_id, const Identity& this_id,
                        const std::string& encrypted_data_map);
 
+// The DataMap's self_encryption_version determines the chunk format.  To create a new file using
+// kSelfEncryptionVersion1 or later, set the version in the empty DataMap before constructing.
+// Chunks are hashed, encrypted and decrypted on the options' executor, which must outlive the
+// SelfEncryptor; if it is null, the process-wide DefaultExecutor() is used.
+//
+// With pipeline_buffers of 2 or more, Write returns once its data is copied into the write queue,
+// and each full queue is encrypted and stored in the background on the executor while the next
+// one fills.  At most pipeline_buffers queues exist; Write blocks while the rest are all still
+// being encrypted.  Read, Truncate and Flush (and writes into the first two chunks) wait for the
+// background work to finish first, and a failure in it is reported by the next call.  data_map()
+// is only up to date after Flush.
+//
+// Once Read sees sequential access to a file which isn't being written, it decrypts the chunks
+// following each read on the executor, so that later reads find them already fetched.  The number
+// of chunks kept ahead doubles whenever a read has to wait for one, shrinks while they are all
+// ready before they are needed and is reset by a non-sequential read.
+//
+// Flush assembles, pre-hashes and then re-encrypts the chunks of the file flush_window chunks at a
+// time, each step in parallel on the executor, and so holds up to flush_window chunks of plaintext
+// at once.  If an old chunk can't be fetched or a new one stored, Flush returns false with the
+// windows before it already in the DataMap and the rest of the data still buffered, and can be
+// called again once the store recovers.
+//
+// Read may be called from several threads at once, provided that nothing else is called
+// meanwhile.  Each reader's position is tracked separately for readahead.  Chunks which a read
+// covers in full are decrypted straight into its buffer, while any it covers only in part are
+// decrypted whole into the read cache, so that later reads nearby are copied from memory.  The
+// cache holds chunks rather than ranges of the file, so a small read at random decrypts no more
+// than the chunks it touches.  Writes are copied into the cached chunks they overlap, and Truncate
+// empties the cache.
+//
+// If batch_get_from_store is set, chunks which aren't in the buffer and which are needed together
+// (by one Read, readahead, a Flush window or preparing to write) are requested with a single call
+// to it rather than one call to get_from_store each.  Chunks it fails to supply are then fetched
+// with get_from_store.
+//
+// WriteAsync, ReadAsync and FlushAsync return at once.  The calls are queued and run one at a time,
+// in order, on the executor, and then the returned future or the handler receives kSuccess, or
+// kEncryptionException if a Write or Flush failed, or kDecryptionException if a Read did.  Each
+// call's handler returns before the next call starts.  Handlers run on an executor thread; to
+// complete on an event loop, either post to it from the handler or pass an Executor which runs its
+// tasks there.  The data must stay valid until the call completes, and no synchronous call may be
+// made while asynchronous ones are outstanding.  The destructor waits for them to complete, so a
+// handler may only destroy the SelfEncryptor if no later calls are queued.
 class SelfEncryptor {
  public:
   SelfEncryptor(DataMap& data_map, data_stores::DataBuffer<std::string>& buffer,
                 std::function<NonEmptyString(const std::string&)> get_from_store,
-                int num_procs = 0);
+                const SelfEncryptorOptions& options = SelfEncryptorOptions());
   ~SelfEncryptor();
   bool Write(const char* data, uint32_t length, uint64_t position);
   bool Read(char* data, uint32_t length, uint64_t position);
+
+  typedef std::function<void(int)> CompletionHandler;
+  std::future<int> WriteAsync(const char* data, uint32_t length, uint64_t position);
+  void WriteAsync(const char* data, uint32_t length, uint64_t position, CompletionHandler handler);
+  std::future<int> ReadAsync(char* data, uint32_t length, uint64_t position);
+  void ReadAsync(char* data, uint32_t length, uint64_t position, CompletionHandler handler);
+  std::future<int> FlushAsync();
+  void FlushAsync(CompletionHandler handler);
+
   // Can truncate up or down
   bool Truncate(uint64_t position);
   // Forces all buffered data to be encrypted.  Missing portions of the file are filled with '\0's
@@ -70,8 +222,15 @@ class SelfEncryptor {
   }
   const DataMap& data_map() const { return data_map_; }
   const DataMap& original_data_map() const { return kOriginalDataMap_; }
+  CompressionStatistics compression_statistics() const;
+  ReadCacheStatistics read_cache_statistics() const;
+  // Bytes currently held in the buffers and caches counted against memory_limit and by out-of-order
+  // writes which haven't been spilled.  Mustn't be called during Write, Truncate or Flush.
+  uint64_t memory_usage() const;
 
  private:
+  struct PrefetchedChunk;
+
   SelfEncryptor(const SelfEncryptor&);
   SelfEncryptor(SelfEncryptor&&);
   SelfEncryptor& operator=(SelfEncryptor);
@@ -84,7 +243,7 @@ class SelfEncryptor {
   // chunk_store_.  The main_encrypt_queue_ is set to start at "position" if it
   // is beyond the end of the first 2 chunks.
   int PrepareToWrite(uint32_t length, uint64_t position);
-  // Copies any relevant data to read_cache_.
+  // Copies any relevant data to the chunks held in the read cache.
   void PutToReadCache(const char* data, uint32_t length, uint64_t position);
   // Copies any relevant data to read_buffer_.
   void PutToReadBuffer(const char* data, uint32_t length, uint64_t position);
@@ -111,64 +270,182 @@ class SelfEncryptor {
   // returns true and adjusts length to the required amount of data to be
   // copied.
   bool GetLengthForSequencer(uint64_t position, uint32_t* length);
-  // Retrieves the encrypted chunk from chunk_store_ and decrypts it to "data".
-  int DecryptChunk(uint32_t chunk_num, byte* data);
-  // Retrieves appropriate pre-hashes from data_map_ and constructs key, IV and
-  // encryption pad.  If writing, and chunk has old_n1_pre_hash and
-  // old_n2_pre_hash fields set, they are reset to NULL.
-  void GetPadIvKey(uint32_t this_chunk_num, std::shared_ptr<byte> key, std::shared_ptr<byte> iv,
-                   std::shared_ptr<byte> pad, bool writing);
+  // Adds out-of-order data to sequencer_, unless that could take memory use over the limit.
+  int AddToSequencer(const char* data, uint32_t length, uint64_t position);
+  // Retrieves the encrypted chunk from chunk_store_ and decrypts it to "data".  If content is set
+  // and initialised, it is decrypted instead.
+  int DecryptChunk(uint32_t chunk_num, byte* data, const NonEmptyString* content = nullptr);
+  // As DecryptChunk, but writes only bytes [offset, offset + count) of the chunk to data.
+  int DecryptChunk(uint32_t chunk_num, uint32_t offset, uint32_t count, byte* data,
+                   const NonEmptyString* content = nullptr);
+  // The part of DecryptChunk which fetches the content (unless it is given) and decodes the range
+  // with the chunk's secrets, bypassing the chunk cache.
+  int DecodeStoredChunk(uint32_t chunk_num, const ByteSpan& key, const ByteSpan& iv,
+                        const ByteSpan& pad, uint32_t offset, uint32_t count, byte* data,
+                        const NonEmptyString* content);
+  // The chunk's name, compression and size, and a hash of the secrets it's decrypted with.
+  std::string ChunkCacheKey(uint32_t chunk_num, const ByteSpan& key, const ByteSpan& iv,
+                            const ByteSpan& pad) const;
+  bool InChunkCache(uint32_t chunk_num);
+  // Sets (*contents)[i] to the stored content of chunk chunk_nums[i], taken from buffer_ or else
+  // from one call to batch_get_from_store_.  Entries are left uninitialised for empty chunks, for
+  // chunks already in the chunk cache, for chunks which couldn't be fetched and for all chunks if
+  // there is no batch_get_from_store_.
+  void FetchStoredChunks(const std::vector<uint32_t>& chunk_nums,
+                         std::vector<NonEmptyString>* contents);
+  // Retrieves appropriate pre-hashes from data_map_ (or, if not writing, any kept
+  // in old_pre_hashes_) and constructs key, IV and encryption pad.  If writing,
+  // the chunk's entry in old_pre_hashes_ is dropped.
+  void GetPadIvKey(uint32_t this_chunk_num, ByteSpan key, ByteSpan iv, ByteSpan pad,
+                   bool writing);
   // Encrypts all but the last chunk in the queue, then moves the last chunk to
-  // the front of the queue.
+  // the front of the queue.  In pipelined mode the chunks are pre-hashed here,
+  // but encrypted in the background by EncryptQueueInBackground.
   int ProcessMainQueue();
-  // Encrypts the chunk and stores in chunk_store_
+  // Encrypts chunks [first, end) of "queue", whose first chunk is data_map_
+  // chunk first_queue_chunk_index.
+  int EncryptQueuedChunks(byte* queue, uint32_t first_queue_chunk_index, int64_t first,
+                          int64_t end);
+  // Swaps main_encrypt_queue_ for a spare buffer (waiting for one if all are
+  // busy), carries the unprocessed tail over to it and posts the full buffer's
+  // chunks to executor_.
+  int EncryptQueueInBackground(uint32_t first_queue_chunk_index, int64_t first,
+                               uint32_t chunks_to_process);
+  // Returns, and clears, the first failure reported by a background batch.  If
+  // wait is true, first waits until no batches are in flight.
+  int CollectPipelineResult(bool wait);
+  // Waits on "condition" until ready() is true, running executor_'s queued tasks
+  // meanwhile, as the work waited for may be queued behind this thread.
+  void WaitFor(std::unique_lock<std::mutex>* lock, std::condition_variable* condition,
+               const std::function<bool()>& ready);
+  // Queues operation behind any earlier asynchronous calls, to run on executor_
+  // and then pass its result to handler.
+  void EnqueueAsync(std::function<int()> operation, CompletionHandler handler);
+  // Runs the oldest queued asynchronous call and its handler, then posts itself
+  // again if there are more.
+  void RunNextAsync();
+  // Encrypts the chunk and stores in chunk_store_.  The chunk must already be
+  // within data_map_.chunks.
   int EncryptChunk(uint32_t chunk_num, byte* data, uint32_t length);
   // If the calculated pre-hash is different to any existing pre-hash,
   // modified is set to true.  In this case, chunks n+1 and n+2 have their
-  // old_n1_pre_hash and old_n2_pre_hash fields completed if not already done.
+  // entries in old_pre_hashes_ completed if not already done (see
+  // KeepOldPreHashes).
   void CalculatePreHash(uint32_t chunk_num, const byte* data, uint32_t length,
                         bool* modified);
+  // As CalculatePreHash for "count" consecutive chunks of equal length, starting at
+  // first_chunk_num.  The chunks are hashed in batches by the multi-buffer hasher.
+  void CalculatePreHashes(uint32_t first_chunk_num, const byte* const* data, uint32_t length,
+                          uint32_t count, bool* modified);
+  // Before chunk_num's pre-hash changes, records the pre-hashes which chunks
+  // chunk_num + 1 and + 2 (other than chunks 0 and 1) were encrypted with, so
+  // that they can still be decrypted.
+  void KeepOldPreHashes(uint32_t chunk_num);
   void CalculateSizes(bool force);
-  // If prepared_for_reading_ is not already true, this initialises read_cache_.
-  void PrepareToRead();
   // Buffer will be much larger than Cache, trying to buffer the whole file
-  // or the first block with size of defined times of kDefaultByteArraySize_
+  // or its first kOptions_.read_buffer_size bytes
   // If can't read from buffer, read will try to read from cache or the chunks
   bool ReadFromBuffer(char* data, uint32_t length, uint64_t position);
+  // Whether the read covers whole chunks (or runs to the end of the file) of a file with no
+  // in-process data, in which case it is decrypted straight into the caller's buffer rather than
+  // through the read cache.
+  bool ChunkAligned(uint32_t length, uint64_t position) const;
+  // Transmogrifies straight into data, without filling the read cache, and records the read.
+  bool ReadDirect(char* data, uint32_t length, uint64_t position);
+  // Copies a read lying within one chunk from the read cache, first decrypting the whole chunk
+  // into it on a miss.
+  int ReadThroughCache(char* data, uint32_t length, uint64_t position);
+  // Drops the least recently used chunks until the read cache is within kReadCacheSize_.  Must be
+  // called with read_mutex_ held.
+  void TrimReadCache();
+  void ClearReadCache();
   // Handles reading from populated data_map_ and all the various write buffers.
   int Transmogrify(char* data, uint32_t length, uint64_t position);
   int ReadDataMapChunks(char* data, uint32_t length, uint64_t position);
+  // As the ranged DecryptChunk, but takes the chunk from the readahead buffer if it has been
+  // prefetched, waiting for it if it is still being decrypted.
+  int FetchChunk(uint32_t chunk_num, uint32_t offset, uint32_t count, byte* data,
+                 const NonEmptyString* content = nullptr);
+  // Records a read of length bytes at position against the reader it continues, or else a new
+  // one.  If that reader's reads have been sequential, posts the decryption of the chunks
+  // following the read, other than any already in the read cache, to executor_.
+  void RecordRead(uint64_t position, uint32_t length);
+  // Decrypts a chunk for readahead into prefetched and marks it ready.
+  void PrefetchChunk(uint32_t chunk_num, std::shared_ptr<PrefetchedChunk> prefetched,
+                     const NonEmptyString* content);
+  // Waits for any prefetches in flight and empties the readahead buffer.
+  void DiscardReadahead();
   void ReadInProcessData(char* data, uint32_t length, uint64_t position);
   bool TruncateUp(uint64_t position);
   bool AppendNulls(uint64_t position);
   bool TruncateDown(uint64_t position);
   void DeleteChunk(uint32_t chunk_num);
+  // Deletes the stored chunk with the given name, if any.
+  void DeleteChunk(const std::string& hash);
 
   DataMap& data_map_;
   DataMap kOriginalDataMap_;
   std::unique_ptr<Sequencer> sequencer_;
-  const uint32_t kDefaultByteArraySize_;
+  const SelfEncryptorOptions kOptions_;
+  const uint32_t kReadCacheSize_;
   uint64_t file_size_, last_chunk_position_;
   uint64_t truncated_file_size_;
   uint32_t normal_chunk_size_;
-  std::shared_ptr<byte> main_encrypt_queue_;
+  ByteArray main_encrypt_queue_;
   uint64_t queue_start_position_;
   const uint32_t kQueueCapacity_;
   uint32_t retrievable_from_queue_;
-  std::shared_ptr<byte> chunk0_raw_, chunk1_raw_;
+  ByteArray chunk0_raw_, chunk1_raw_;
+  // The n-1 and n-2 pre-hashes which chunk n's stored content was encrypted with, kept only from
+  // when either of them changes until chunk n is encrypted again.  Guarded by
+  // old_pre_hashes_mutex_.
+  std::map<uint32_t, std::array<byte, 2 * kChunkHashSize>> old_pre_hashes_;
+  std::mutex old_pre_hashes_mutex_;
   data_stores::DataBuffer<std::string>& buffer_;
   std::function<NonEmptyString(const std::string&)> get_from_store_;
+  const CompressionConfig kCompression_;
+  std::atomic<uint64_t> chunks_probed_, chunks_skipped_, bytes_skipped_;
+  Executor& executor_;
   uint64_t current_position_;
   bool prepared_for_writing_, flushed_;
-  std::unique_ptr<char[]> read_cache_;
-  uint64_t cache_start_position_;
-  bool prepared_for_reading_;
-  std::unique_ptr<char[]> read_buffer_;
-  bool buffer_activated_;
+  // Readers are told apart only by where their next sequential read would start.  Guarded by
+  // read_mutex_.
+  struct ReadStream {
+    ReadStream();
+    uint64_t next_position, last_used;
+    uint32_t sequential_reads;
+  };
+  std::vector<ReadStream> read_streams_;
+  uint64_t read_count_;
+  // The file's current content in kDefaultChunkSize blocks, keyed by chunk index and most recently
+  // used first, up to kReadCacheSize_ bytes in all.  Entries are shared, so one stays valid while
+  // it's copied from even if it is evicted meanwhile.  Guarded by read_mutex_.
+  typedef std::list<std::pair<uint32_t, std::shared_ptr<ByteArray>>> ReadCacheList;
+  ReadCacheList read_cache_;
+  std::map<uint32_t, ReadCacheList::iterator> read_cache_index_;
+  uint64_t read_cache_bytes_, read_cache_hits_, read_cache_misses_, read_cache_evictions_;
+  ByteArray read_buffer_;
+  std::atomic<bool> buffer_activated_;
   uint32_t buffer_length_;
   uint64_t last_read_position_;
-  const uint32_t kMaxBufferSize_;
   mutable std::mutex data_mutex_;
+  std::vector<ByteArray> spare_queues_;
+  uint32_t queues_in_flight_;
+  int pipeline_result_;
+  mutable std::mutex pipeline_mutex_;
+  std::condition_variable pipeline_condition_;
+  std::map<uint32_t, std::shared_ptr<PrefetchedChunk>> prefetched_chunks_;
+  uint32_t readahead_window_, prefetches_in_flight_;
+  mutable std::mutex read_mutex_;
+  std::condition_variable readahead_condition_;
+  mutable std::mutex buffer_mutex_;
+  std::deque<std::pair<std::function<int()>, CompletionHandler>> async_operations_;
+  bool async_running_;
+  // While a completion handler runs, its thread and where to record that it destroyed this.
+  std::thread::id async_handler_thread_;
+  bool* async_destroyed_;
+  std::mutex async_mutex_;
+  std::condition_variable async_condition_;
 };
 
 }  // namespace encrypt
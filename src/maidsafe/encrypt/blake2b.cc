@@ -0,0 +1,160 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/encrypt/blake2b.h"
+
+#include <cstring>
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace {
+
+const uint64_t kIv[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL};
+
+const uint8_t kSigma[12][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3}};
+
+inline uint64_t Load64(const byte* source) {
+  uint64_t value(0);
+  for (int i(7); i >= 0; --i)
+    value = (value << 8) | source[i];
+  return value;
+}
+
+inline uint64_t RotateRight(uint64_t value, int bits) {
+  return (value >> bits) | (value << (64 - bits));
+}
+
+inline void Mix(uint64_t* v, int a, int b, int c, int d, uint64_t x, uint64_t y) {
+  v[a] = v[a] + v[b] + x;
+  v[d] = RotateRight(v[d] ^ v[a], 32);
+  v[c] = v[c] + v[d];
+  v[b] = RotateRight(v[b] ^ v[c], 24);
+  v[a] = v[a] + v[b] + y;
+  v[d] = RotateRight(v[d] ^ v[a], 16);
+  v[c] = v[c] + v[d];
+  v[b] = RotateRight(v[b] ^ v[c], 63);
+}
+
+}  // unnamed namespace
+
+Blake2b512::Blake2b512() : h_(), t_(), buffer_(), buffered_(0) { Reset(); }
+
+void Blake2b512::Reset() {
+  memcpy(h_, kIv, sizeof(h_));
+  // Parameter block: digest length 64, no key, fanout 1, depth 1.
+  h_[0] ^= 0x01010000ULL ^ kDigestSize;
+  t_[0] = t_[1] = 0;
+  buffered_ = 0;
+}
+
+void Blake2b512::Compress(const byte* block, bool last) {
+  uint64_t m[16], v[16];
+  for (int i(0); i != 16; ++i)
+    m[i] = Load64(block + 8 * i);
+  for (int i(0); i != 8; ++i) {
+    v[i] = h_[i];
+    v[i + 8] = kIv[i];
+  }
+  v[12] ^= t_[0];
+  v[13] ^= t_[1];
+  if (last)
+    v[14] = ~v[14];
+
+  for (int round(0); round != 12; ++round) {
+    const uint8_t* s(kSigma[round]);
+    Mix(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+    Mix(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+    Mix(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+    Mix(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+    Mix(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+    Mix(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+    Mix(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+    Mix(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+  }
+
+  for (int i(0); i != 8; ++i)
+    h_[i] ^= v[i] ^ v[i + 8];
+}
+
+void Blake2b512::Update(const byte* data, size_t length) {
+  // The final block must be compressed with the "last" flag, so a full buffer is only compressed
+  // once more input is known to follow it.
+  while (length != 0) {
+    if (buffered_ == kBlockSize) {
+      t_[0] += kBlockSize;
+      if (t_[0] < kBlockSize)
+        ++t_[1];
+      Compress(buffer_, false);
+      buffered_ = 0;
+    }
+    if (buffered_ == 0) {
+      while (length > kBlockSize) {
+        t_[0] += kBlockSize;
+        if (t_[0] < kBlockSize)
+          ++t_[1];
+        Compress(data, false);
+        data += kBlockSize;
+        length -= kBlockSize;
+      }
+    }
+    size_t copy_size(kBlockSize - buffered_ < length ? kBlockSize - buffered_ : length);
+    memcpy(buffer_ + buffered_, data, copy_size);
+    buffered_ += copy_size;
+    data += copy_size;
+    length -= copy_size;
+  }
+}
+
+void Blake2b512::Final(byte* digest) {
+  t_[0] += buffered_;
+  if (t_[0] < buffered_)
+    ++t_[1];
+  memset(buffer_ + buffered_, 0, kBlockSize - buffered_);
+  Compress(buffer_, true);
+  for (int i(0); i != 8; ++i) {
+    for (int j(0); j != 8; ++j)
+      digest[8 * i + j] = static_cast<byte>(h_[i] >> (8 * j));
+  }
+  Reset();
+}
+
+void Blake2b512Hash(const byte* data, size_t length, byte* digest) {
+  Blake2b512 hash;
+  hash.Update(data, length);
+  hash.Final(digest);
+}
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
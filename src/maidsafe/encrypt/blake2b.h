@@ -0,0 +1,59 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_ENCRYPT_BLAKE2B_H_
+#define MAIDSAFE_ENCRYPT_BLAKE2B_H_
+
+#include <cstdint>
+
+#include "cryptopp/config.h"
+
+#include "maidsafe/encrypt/crypto_backend.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+// Unkeyed BLAKE2b with a 64-byte digest as specified in RFC 7693.  Used in place of SHA-512 for
+// chunk pre-hashes and names by kSelfEncryptionVersion2 DataMaps.
+class Blake2b512 : public HashFunction {
+ public:
+  enum { kDigestSize = 64, kBlockSize = 128 };
+
+  Blake2b512();
+  void Update(const byte* data, size_t length) override;
+  void Final(byte* digest) override;
+  size_t DigestSize() const override { return kDigestSize; }
+
+ private:
+  void Reset();
+  void Compress(const byte* block, bool last);
+
+  uint64_t h_[8], t_[2];
+  byte buffer_[kBlockSize];
+  size_t buffered_;
+};
+
+// One-shot BLAKE2b-512 of data into digest.
+void Blake2b512Hash(const byte* data, size_t length, byte* digest);
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_ENCRYPT_BLAKE2B_H_
@@ -17,23 +17,181 @@
     use of the MaidSafe Software.                                                                 */
 
 #include "maidsafe/encrypt/byte_array.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
 #include "maidsafe/common/log.h"
 
 namespace maidsafe {
 
 namespace encrypt {
 
-ByteArray GetNewByteArray(uint32_t size) {
-  ByteArray byte_array(new byte[size], ByteArrayDeleter(size));
-  memset(byte_array.get(), 0, size);
-  return std::move(byte_array);
+namespace {
+
+const size_t kCacheLineSize(64);
+const size_t kPageSize(4096);
+const size_t kHugePageSize(2 * 1024 * 1024);
+// Blocks up to a page come in powers of two from a cache line upwards.  Larger ones come in four
+// classes per doubling, so rounding up never wastes more than a quarter of the block.  Anything
+// beyond 64 MiB is allocated and freed directly.
+const uint32_t kSmallClassCount(7);
+const uint32_t kClassesPerDoubling(4);
+const uint32_t kPageShift(12);
+const uint32_t kLargestPooledShift(26);
+const uint32_t kClassCount(kSmallClassCount +
+                           (kLargestPooledShift - kPageShift) * kClassesPerDoubling);
+// Huge-page blocks have their own free lists at kClassCount + class index.
+const uint32_t kUnpooled(2 * kClassCount);
+// Freed blocks beyond this are returned to the system rather than held.
+const uint64_t kMaxBytesHeld(128 * 1024 * 1024);
+
+uint32_t SizeClassIndex(uint32_t size) {
+  uint32_t shift(6);
+  while ((static_cast<uint64_t>(1) << shift) < size)
+    ++shift;
+  if (shift <= kPageShift)
+    return shift - 6;
+  if (shift > kLargestPooledShift)
+    return kUnpooled;
+  // "size" is in (2^(shift - 1), 2^shift].
+  const uint64_t kBase(static_cast<uint64_t>(1) << (shift - 1));
+  const uint64_t kStep(kBase / kClassesPerDoubling);
+  const uint32_t kSubClass(static_cast<uint32_t>((size - kBase + kStep - 1) / kStep));
+  return kSmallClassCount + (shift - kPageShift - 1) * kClassesPerDoubling + kSubClass - 1;
+}
+
+size_t ClassSize(uint32_t class_index) {
+  if (class_index < kSmallClassCount)
+    return kCacheLineSize << class_index;
+  const uint32_t kLargeIndex(class_index - kSmallClassCount);
+  const size_t kBase(kPageSize << (kLargeIndex / kClassesPerDoubling));
+  return kBase + (kBase / kClassesPerDoubling) * (kLargeIndex % kClassesPerDoubling + 1);
+}
+
+byte* AllocateBlock(size_t size, bool huge_pages) {
+  size_t alignment(size < kPageSize ? kCacheLineSize : kPageSize);
+  if (huge_pages)
+    alignment = size < kHugePageSize ? kPageSize : kHugePageSize;
+  void* block(nullptr);
+#ifdef _MSC_VER
+  block = _aligned_malloc(size, alignment);
+#else
+  if (posix_memalign(&block, alignment, size) != 0)
+    block = nullptr;
+#endif
+  if (!block)
+    throw std::bad_alloc();
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  // Purely advisory; the block is still usable if the kernel declines.
+  if (huge_pages && size >= kHugePageSize)
+    madvise(block, size, MADV_HUGEPAGE);
+#endif
+  return static_cast<byte*>(block);
+}
+
+void FreeBlock(byte* block) {
+#ifdef _MSC_VER
+  _aligned_free(block);
+#else
+  free(block);
+#endif
+}
+
+struct ByteArrayPool {
+  ByteArrayPool() : mutex(), free_blocks(kUnpooled), statistics() {}
+  std::mutex mutex;
+  std::vector<std::vector<byte*>> free_blocks;
+  ByteArrayPoolStatistics statistics;
+};
+
+// Deliberately leaked so that ByteArrays outliving static destruction can still be released.
+ByteArrayPool& GetPool() {
+  static ByteArrayPool* const kPool(new ByteArrayPool);
+  return *kPool;
+}
+
+byte* TakeBlock(uint32_t pool_index) {
+  ByteArrayPool& pool(GetPool());
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  ++pool.statistics.allocations;
+  if (pool_index == kUnpooled || pool.free_blocks[pool_index].empty())
+    return nullptr;
+  byte* block(pool.free_blocks[pool_index].back());
+  pool.free_blocks[pool_index].pop_back();
+  ++pool.statistics.pool_hits;
+  --pool.statistics.blocks_held;
+  pool.statistics.bytes_held -= ClassSize(pool_index % kClassCount);
+  return block;
+}
+
+void ReturnBlock(byte* block, uint32_t pool_index) {
+  if (pool_index != kUnpooled) {
+    ByteArrayPool& pool(GetPool());
+    const size_t kBlockSize(ClassSize(pool_index % kClassCount));
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (pool.statistics.bytes_held + kBlockSize <= kMaxBytesHeld) {
+      pool.free_blocks[pool_index].push_back(block);
+      ++pool.statistics.blocks_held;
+      pool.statistics.bytes_held += kBlockSize;
+      return;
+    }
+  }
+  FreeBlock(block);
 }
 
-uint32_t Size(const std::shared_ptr<byte>& ptr) {
-  return ptr ? std::get_deleter<ByteArrayDeleter>(ptr)->kSize_ : 0;
+}  // unnamed namespace
+
+ByteArray::ByteArray(ByteArray&& other)
+    : data_(other.data_), size_(other.size_), pool_index_(other.pool_index_) {
+  other.data_ = nullptr;
+  other.size_ = 0;
 }
 
-uint32_t MemCopy(const ByteArray& destination, uint32_t destination_offset,
+ByteArray& ByteArray::operator=(ByteArray&& other) {
+  if (this != &other) {
+    reset();
+    data_ = other.data_;
+    size_ = other.size_;
+    pool_index_ = other.pool_index_;
+    other.data_ = nullptr;
+    other.size_ = 0;
+  }
+  return *this;
+}
+
+void ByteArray::reset() {
+  if (data_)
+    ReturnBlock(data_, pool_index_);
+  data_ = nullptr;
+  size_ = 0;
+}
+
+ByteArray GetNewByteArray(uint32_t size, ByteArrayFill fill, ByteArrayBacking backing) {
+  const bool kHugePages(backing == ByteArrayBacking::kHugePages);
+  const uint32_t kClassIndex(SizeClassIndex(size));
+  uint32_t pool_index(kUnpooled);
+  size_t block_size(size);
+  if (kClassIndex != kUnpooled) {
+    pool_index = kClassIndex + (kHugePages ? kClassCount : 0);
+    block_size = ClassSize(kClassIndex);
+  }
+  byte* block(TakeBlock(pool_index));
+  if (!block)
+    block = AllocateBlock(block_size, kHugePages);
+  if (fill == ByteArrayFill::kZeroed)
+    memset(block, 0, size);
+  return ByteArray(block, size, pool_index);
+}
+
+uint32_t MemCopy(const ByteSpan& destination, uint32_t destination_offset,
                  const void* source, uint32_t copy_size) {
   if (Size(destination) < destination_offset) {
     LOG(kWarning) << "Size (" << Size(destination) << ") < offset (" << destination_offset << ").";
@@ -48,6 +206,27 @@ uint32_t MemCopy(const ByteArray& destination, uint32_t destination_offset,
   return copy_size;
 }
 
+ByteArrayPoolStatistics GetByteArrayPoolStatistics() {
+  ByteArrayPool& pool(GetPool());
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  return pool.statistics;
+}
+
+void ReleaseByteArrayPool() {
+  std::vector<std::vector<byte*>> released(kUnpooled);
+  {
+    ByteArrayPool& pool(GetPool());
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    released.swap(pool.free_blocks);
+    pool.statistics.blocks_held = 0;
+    pool.statistics.bytes_held = 0;
+  }
+  for (const auto& blocks : released) {
+    for (byte* block : blocks)
+      FreeBlock(block);
+  }
+}
+
 }  // namespace encrypt
 
 }  // namespace maidsafe
@@ -0,0 +1,142 @@
+/*  Copyright 2011 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/encrypt/chunk_cache.h"
+
+#include <exception>
+
+#include "maidsafe/common/log.h"
+
+#include "maidsafe/encrypt/config.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+// A decryption in progress, waited for by any other callers wanting the same chunk.  Guarded by
+// mutex_.
+struct ChunkCache::Decryption {
+  Decryption() : chunk(), result(kSuccess), ready(false) {}
+  std::shared_ptr<const ByteArray> chunk;
+  int result;
+  bool ready;
+};
+
+ChunkCache::ChunkCache(uint64_t capacity)
+    : kCapacity_(capacity),
+      chunks_(),
+      index_(),
+      decryptions_(),
+      bytes_held_(0),
+      hits_(0),
+      misses_(0),
+      coalesced_(0),
+      evictions_(0),
+      mutex_(),
+      decrypted_() {}
+
+int ChunkCache::Get(const std::string& key, uint32_t size, const Decryptor& decrypt,
+                    std::shared_ptr<const ByteArray>* chunk) {
+  std::shared_ptr<Decryption> decryption;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto itr(index_.find(key));
+    if (itr != index_.end()) {
+      chunks_.splice(chunks_.begin(), chunks_, (*itr).second);
+      *chunk = (*(*itr).second).second;
+      ++hits_;
+      return kSuccess;
+    }
+    auto pending(decryptions_.find(key));
+    if (pending != decryptions_.end()) {
+      decryption = (*pending).second;
+      ++coalesced_;
+      decrypted_.wait(lock, [&] { return decryption->ready; });
+      *chunk = decryption->chunk;
+      return decryption->result;
+    }
+    decryption = std::make_shared<Decryption>();
+    decryptions_.insert(std::make_pair(key, decryption));
+    ++misses_;
+  }
+
+  // Decrypted without holding mutex_, so that different chunks are decrypted in parallel.  Nothing
+  // may escape before the waiters are woken.
+  std::shared_ptr<ByteArray> plaintext;
+  int result(kDecryptionException);
+  try {
+    plaintext = std::make_shared<ByteArray>(GetNewByteArray(size, ByteArrayFill::kUninitialised));
+    result = decrypt(plaintext->get());
+  }
+  catch (const std::exception& e) {
+    LOG(kError) << "Failed to decrypt chunk for the cache: " << e.what();
+  }
+  if (result != kSuccess)
+    plaintext.reset();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  decryption->chunk = plaintext;
+  decryption->result = result;
+  decryption->ready = true;
+  decryptions_.erase(key);
+  if (plaintext && size <= kCapacity_) {
+    chunks_.push_front(std::make_pair(key, std::shared_ptr<const ByteArray>(plaintext)));
+    index_.insert(std::make_pair(key, chunks_.begin()));
+    bytes_held_ += size;
+    Trim();
+  }
+  decrypted_.notify_all();
+  *chunk = plaintext;
+  return result;
+}
+
+bool ChunkCache::Contains(const std::string& key) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return index_.count(key) != 0;
+}
+
+void ChunkCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  chunks_.clear();
+  index_.clear();
+  bytes_held_ = 0;
+}
+
+ChunkCacheStatistics ChunkCache::statistics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ChunkCacheStatistics statistics;
+  statistics.hits = hits_;
+  statistics.misses = misses_;
+  statistics.coalesced = coalesced_;
+  statistics.evictions = evictions_;
+  statistics.bytes_held = bytes_held_;
+  return statistics;
+}
+
+void ChunkCache::Trim() {
+  while (bytes_held_ > kCapacity_ && !chunks_.empty()) {
+    bytes_held_ -= Size(*chunks_.back().second);
+    index_.erase(chunks_.back().first);
+    chunks_.pop_back();
+    ++evictions_;
+  }
+}
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
@@ -0,0 +1,170 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/encrypt/chunk_codec.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "maidsafe/common/log.h"
+
+#include "maidsafe/encrypt/compression.h"
+#include "maidsafe/encrypt/config.h"
+#include "maidsafe/encrypt/crypto_backend.h"
+#include "maidsafe/encrypt/xor_pad.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace {
+
+// Objects reused by every chunk encoded or decoded on a thread, so that each chunk only costs a
+// rekey and a pad expansion rather than new cipher objects and buffers.
+struct CodecContext {
+  CodecContext()
+      : encryptor(GetCryptoBackend().NewAes256CfbEncryptor()),
+        decryptor(GetCryptoBackend().NewAes256CfbDecryptor()),
+        xor_pad(),
+        scratch() {}
+  std::unique_ptr<StreamCipher> encryptor, decryptor;
+  XorPad xor_pad;
+  std::vector<byte> scratch;
+};
+
+CodecContext& GetCodecContext() {
+  thread_local CodecContext context;
+  return context;
+}
+
+}  // unnamed namespace
+
+uint32_t MaxEncodedChunkSize(CompressionType compression, uint32_t length) {
+  return static_cast<uint32_t>(MaxCompressedSize(compression, length));
+}
+
+int EncodeChunk(const byte* data, uint32_t length, CompressionType compression,
+                int compression_level, const byte* key, const byte* iv, const byte* pad,
+                byte* output, uint32_t* encoded_size, HashFunction* post_hash,
+                const EncodedBlockSink& sink) {
+  size_t compressed_size(0);
+  int result(Compress(compression, compression_level, data, length, output, &compressed_size));
+  if (result != kSuccess)
+    return result;
+  *encoded_size = static_cast<uint32_t>(compressed_size);
+  try {
+    CodecContext& context(GetCodecContext());
+    StreamCipher& encryptor(*context.encryptor);
+    encryptor.SetKeyWithIv(key, iv);
+    XorPad& xor_pad(context.xor_pad);
+    xor_pad.Reset(pad, kPadSize);
+    for (size_t offset(0); offset < compressed_size; offset += kEncodeBlockSize) {
+      byte* block(output + offset);
+      const size_t kBlockSize(std::min(kEncodeBlockSize, compressed_size - offset));
+      encryptor.ProcessData(block, block, kBlockSize);
+      xor_pad.Apply(block, kBlockSize);
+      if (post_hash)
+        post_hash->Update(block, kBlockSize);
+      if (sink)
+        sink(block, kBlockSize);
+    }
+  }
+  catch (const std::exception& e) {
+    LOG(kError) << e.what();
+    return kEncryptionException;
+  }
+  return kSuccess;
+}
+
+int DecodeChunk(const byte* content, size_t content_size, CompressionType compression,
+                const byte* key, const byte* iv, const byte* pad, byte* data, uint32_t length) {
+  return DecodeChunkRange(content, content_size, compression, key, iv, pad, length, 0, data,
+                          length);
+}
+
+int DecodeChunkRange(const byte* content, size_t content_size, CompressionType compression,
+                     const byte* key, const byte* iv, const byte* pad, uint32_t length,
+                     uint32_t offset, byte* data, uint32_t count) {
+  assert(static_cast<uint64_t>(offset) + count <= length);
+  CodecContext& context(GetCodecContext());
+  if (compression == CompressionType::kStore) {
+    if (content_size != length) {
+      LOG(kError) << "Stored chunk has " << content_size << " bytes, expected " << length;
+      return kDecryptionException;
+    }
+    if (count == 0)
+      return kSuccess;
+    // In CFB mode each block's IV is the ciphertext of the block before, so decryption can start
+    // at whichever block holds offset.  The ciphertext is the content with the pad removed.
+    const uint32_t kBlockSize(crypto::AES256_IVSize);
+    uint32_t block_start(offset - offset % kBlockSize);
+    byte block[crypto::AES256_IVSize];
+    const byte* block_iv(iv);
+    context.xor_pad.Reset(pad, kPadSize);
+    if (block_start != 0) {
+      context.xor_pad.Seek(block_start - kBlockSize);
+      context.xor_pad.Apply(content + block_start - kBlockSize, block, kBlockSize);
+      block_iv = block;
+    }
+    try {
+      context.decryptor->SetKeyWithIv(key, block_iv);
+      if (block_start != offset) {
+        uint32_t block_size(std::min(kBlockSize, length - block_start));
+        context.xor_pad.Apply(content + block_start, block, block_size);
+        context.decryptor->ProcessData(block, block, block_size);
+        uint32_t copy_size(std::min(count, block_start + block_size - offset));
+        memcpy(data, block + (offset - block_start), copy_size);
+        data += copy_size;
+        count -= copy_size;
+        offset = block_start + block_size;
+      }
+      if (count != 0) {
+        context.xor_pad.Apply(content + offset, data, count);
+        context.decryptor->ProcessData(data, data, count);
+      }
+    }
+    catch (const std::exception& e) {
+      LOG(kError) << e.what();
+      return kDecryptionException;
+    }
+    return kSuccess;
+  }
+
+  std::vector<byte>& compressed(context.scratch);
+  if (compressed.size() < content_size)
+    compressed.resize(content_size);
+  context.xor_pad.Reset(pad, kPadSize);
+  context.xor_pad.Apply(content, compressed.data(), content_size);
+  try {
+    context.decryptor->SetKeyWithIv(key, iv);
+    context.decryptor->ProcessData(compressed.data(), compressed.data(), content_size);
+  }
+  catch (const std::exception& e) {
+    LOG(kError) << e.what();
+    return kDecryptionException;
+  }
+  return DecompressRange(compression, compressed.data(), content_size, length, offset, data,
+                         count);
+}
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
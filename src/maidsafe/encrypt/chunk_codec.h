@@ -0,0 +1,79 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_ENCRYPT_CHUNK_CODEC_H_
+#define MAIDSAFE_ENCRYPT_CHUNK_CODEC_H_
+
+#include <cstdint>
+#include <functional>
+
+#include "cryptopp/config.h"
+
+#include "maidsafe/common/crypto.h"
+
+#include "maidsafe/encrypt/crypto_backend.h"
+#include "maidsafe/encrypt/data_map.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+// Size of the XOR pad applied to each encrypted chunk.
+const size_t kPadSize((3 * crypto::SHA512::DIGESTSIZE) - crypto::AES256_KeySize -
+                      crypto::AES256_IVSize);
+
+// EncodeChunk encrypts, pads and hashes its output in blocks of this many bytes, so that each block
+// is still in L1 cache when it is hashed.
+const size_t kEncodeBlockSize(16 * 1024);
+
+// Receives the encoded chunk in order, one block at a time.  Every block except the last is
+// kEncodeBlockSize bytes.  The data is only valid for the duration of the call.
+typedef std::function<void(const byte* block, size_t size)> EncodedBlockSink;
+
+// Upper bound on the encoded size of a chunk holding "length" bytes of data.
+uint32_t MaxEncodedChunkSize(CompressionType compression, uint32_t length);
+
+// Self-encrypts a single chunk in one pass over contiguous buffers: compression, then AES-256-CFB,
+// then XOR with the kPadSize-byte pad.  kSelfEncryptionVersion0 always uses kGzip at level 1.  The
+// result is written to output, which must have room for MaxEncodedChunkSize(compression, length)
+// bytes, and its size is set in encoded_size.  If post_hash is non-null, the encoded chunk is fed
+// to it block by block as it is produced, so the caller only needs to call Final to get the chunk's
+// name.  If sink is set, each block is also passed to it once complete.  Returns kSuccess or a
+// ReturnCode on failure.
+int EncodeChunk(const byte* data, uint32_t length, CompressionType compression,
+                int compression_level, const byte* key, const byte* iv, const byte* pad,
+                byte* output, uint32_t* encoded_size, HashFunction* post_hash = nullptr,
+                const EncodedBlockSink& sink = EncodedBlockSink());
+
+// Reverses EncodeChunk, writing the original "length" bytes directly to data.  Fails with
+// kDecryptionException if content doesn't decode to exactly "length" bytes.
+int DecodeChunk(const byte* content, size_t content_size, CompressionType compression,
+                const byte* key, const byte* iv, const byte* pad, byte* data, uint32_t length);
+
+// As DecodeChunk, but writes only bytes [offset, offset + count) of the "length" original bytes to
+// data.  Stored chunks are decrypted straight into data from the cipher block holding offset, and
+// compressed ones decompressed into it as far as DecompressRange allows.
+int DecodeChunkRange(const byte* content, size_t content_size, CompressionType compression,
+                     const byte* key, const byte* iv, const byte* pad, uint32_t length,
+                     uint32_t offset, byte* data, uint32_t count);
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_ENCRYPT_CHUNK_CODEC_H_
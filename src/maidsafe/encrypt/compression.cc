@@ -0,0 +1,363 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/encrypt/compression.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#ifdef __MSVC__
+#pragma warning(push, 1)
+#endif
+#include "cryptopp/gzip.h"
+#ifdef __MSVC__
+#pragma warning(pop)
+#endif
+
+#ifdef MAIDSAFE_ENCRYPT_LZ4
+#include "lz4.h"
+#include "lz4hc.h"
+#endif
+#ifdef MAIDSAFE_ENCRYPT_ZSTD
+#include "zstd.h"
+#endif
+
+#include "maidsafe/common/log.h"
+
+#include "maidsafe/encrypt/config.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace {
+
+const size_t kProbeWindowCount(16);
+const size_t kProbeWindowSize(2048);
+// Random data sampled over 32KB measures around 7.99 bits per byte; deflate struggles to save more
+// than a percent or two above 7.8.
+const double kIncompressibleEntropy(7.8);
+
+// Like CryptoPP::ArraySink, but can be pointed at a new buffer between messages.  Output before
+// "skip" bytes, or beyond the buffer's capacity after them, is counted but discarded.
+class BufferSink : public CryptoPP::Bufferless<CryptoPP::Sink> {
+ public:
+  BufferSink() : buffer_(nullptr), capacity_(0), skip_(0), total_(0) {}
+  void Reset(byte* buffer, size_t capacity, uint64_t skip = 0) {
+    buffer_ = buffer;
+    capacity_ = capacity;
+    skip_ = skip;
+    total_ = 0;
+  }
+  size_t Put2(const byte* input, size_t length, int /*message_end*/, bool /*blocking*/) override {
+    uint64_t first(std::max(total_, skip_)), end(std::min(total_ + length, skip_ + capacity_));
+    if (first < end) {
+      memcpy(buffer_ + (first - skip_), input + (first - total_),
+             static_cast<size_t>(end - first));
+    }
+    total_ += length;
+    return 0;
+  }
+  uint64_t total() const { return total_; }
+
+ private:
+  byte* buffer_;
+  size_t capacity_;
+  uint64_t skip_, total_;
+};
+
+// Deflate state is large (several hundred KB of window and hash tables), so each thread keeps one
+// compressor and one decompressor and reinitialises them per chunk instead of constructing new
+// ones.  Reinitialising restores exactly the state of a newly constructed object, so the output is
+// unchanged.  The sinks are owned by the filters they're attached to.
+struct GzipContext {
+  GzipContext()
+      : compressor_sink(new BufferSink),
+        compressor(compressor_sink),
+        decompressor_sink(new BufferSink),
+        decompressor(decompressor_sink) {}
+  BufferSink* compressor_sink;
+  CryptoPP::Gzip compressor;
+  BufferSink* decompressor_sink;
+  CryptoPP::Gunzip decompressor;
+};
+
+// After an exception a filter may be left mid-message, so the context is discarded and rebuilt
+// by the next call on this thread.
+std::unique_ptr<GzipContext>& ThreadGzipContext() {
+  thread_local std::unique_ptr<GzipContext> context;
+  if (!context)
+    context.reset(new GzipContext);
+  return context;
+}
+
+int GzipCompress(int level, const byte* input, size_t length, byte* output, size_t capacity,
+                 size_t* compressed_size) {
+  std::unique_ptr<GzipContext>& context(ThreadGzipContext());
+  try {
+    context->compressor.IsolatedInitialize(
+        CryptoPP::MakeParameters(CryptoPP::Name::DeflateLevel(), level));
+    context->compressor_sink->Reset(output, capacity);
+    context->compressor.Put(input, length);
+    context->compressor.MessageEnd();
+    if (context->compressor_sink->total() > capacity) {
+      LOG(kError) << "Compressed " << length << " bytes to " << context->compressor_sink->total()
+                  << " which exceeds the buffer size of " << capacity;
+      return kEncryptionException;
+    }
+    *compressed_size = static_cast<size_t>(context->compressor_sink->total());
+  }
+  catch (const std::exception& e) {
+    LOG(kError) << e.what();
+    context.reset();
+    return kEncryptionException;
+  }
+  return kSuccess;
+}
+
+// Writes bytes [offset, offset + count) of the "length" decompressed bytes to output.
+int GzipDecompress(const byte* input, size_t input_size, size_t length, size_t offset,
+                   byte* output, size_t count) {
+  std::unique_ptr<GzipContext>& context(ThreadGzipContext());
+  try {
+    context->decompressor.IsolatedInitialize(CryptoPP::g_nullNameValuePairs);
+    context->decompressor_sink->Reset(output, count, offset);
+    context->decompressor.Put(input, input_size);
+    context->decompressor.MessageEnd();
+    if (context->decompressor_sink->total() != length) {
+      LOG(kError) << "Decompressed " << context->decompressor_sink->total() << " bytes, expected "
+                  << length;
+      return kDecryptionException;
+    }
+  }
+  catch (const std::exception& e) {
+    LOG(kError) << e.what();
+    context.reset();
+    return kDecryptionException;
+  }
+  return kSuccess;
+}
+
+// Scratch space for decompressing whole chunks when only part of one is wanted.
+std::vector<byte>& ThreadRangeBuffer() {
+  thread_local std::vector<byte> buffer;
+  return buffer;
+}
+
+}  // unnamed namespace
+
+bool CompressionSupported(CompressionType type) {
+  switch (type) {
+    case CompressionType::kGzip:
+    case CompressionType::kStore:
+      return true;
+#ifdef MAIDSAFE_ENCRYPT_LZ4
+    case CompressionType::kLz4:
+      return true;
+#endif
+#ifdef MAIDSAFE_ENCRYPT_ZSTD
+    case CompressionType::kZstd:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+size_t MaxCompressedSize(CompressionType type, size_t length) {
+  switch (type) {
+#ifdef MAIDSAFE_ENCRYPT_LZ4
+    case CompressionType::kLz4:
+      return static_cast<size_t>(LZ4_compressBound(static_cast<int>(length)));
+#endif
+#ifdef MAIDSAFE_ENCRYPT_ZSTD
+    case CompressionType::kZstd:
+      return ZSTD_compressBound(length);
+#endif
+    case CompressionType::kStore:
+      return length;
+    default:
+      // Deflate falls back to stored blocks (5 bytes of overhead per 64KB) for incompressible
+      // data; the gzip header and trailer add 18 bytes.  Allow generous headroom beyond that.
+      return length + (length >> 8) + 64;
+  }
+}
+
+int Compress(CompressionType type, int level, const byte* input, size_t length, byte* output,
+             size_t* compressed_size) {
+  const size_t kCapacity(MaxCompressedSize(type, length));
+  switch (type) {
+    case CompressionType::kGzip:
+      return GzipCompress(level, input, length, output, kCapacity, compressed_size);
+    case CompressionType::kStore:
+      memcpy(output, input, length);
+      *compressed_size = length;
+      return kSuccess;
+#ifdef MAIDSAFE_ENCRYPT_LZ4
+    case CompressionType::kLz4: {
+      int result(0);
+      if (level >= LZ4HC_CLEVEL_MIN) {
+        result = LZ4_compress_HC(reinterpret_cast<const char*>(input),
+                                 reinterpret_cast<char*>(output), static_cast<int>(length),
+                                 static_cast<int>(kCapacity), level);
+      } else {
+        result = LZ4_compress_default(reinterpret_cast<const char*>(input),
+                                      reinterpret_cast<char*>(output), static_cast<int>(length),
+                                      static_cast<int>(kCapacity));
+      }
+      if (result <= 0 && length != 0) {
+        LOG(kError) << "LZ4 failed to compress " << length << " bytes.";
+        return kEncryptionException;
+      }
+      *compressed_size = static_cast<size_t>(result);
+      return kSuccess;
+    }
+#endif
+#ifdef MAIDSAFE_ENCRYPT_ZSTD
+    case CompressionType::kZstd: {
+      size_t result(ZSTD_compress(output, kCapacity, input, length, level));
+      if (ZSTD_isError(result)) {
+        LOG(kError) << "zstd failed to compress " << length << " bytes: "
+                    << ZSTD_getErrorName(result);
+        return kEncryptionException;
+      }
+      *compressed_size = result;
+      return kSuccess;
+    }
+#endif
+    default:
+      LOG(kError) << "Compression type " << static_cast<uint32_t>(type) << " not supported.";
+      return kUnsupportedCompression;
+  }
+}
+
+bool LooksIncompressible(const byte* data, size_t length) {
+  if (length == 0)
+    return false;
+  uint32_t histogram[256] = {};
+  size_t sampled(0);
+  if (length <= kProbeWindowCount * kProbeWindowSize) {
+    for (size_t i(0); i != length; ++i)
+      ++histogram[data[i]];
+    sampled = length;
+  } else {
+    const size_t kStride((length - kProbeWindowSize) / (kProbeWindowCount - 1));
+    for (size_t window(0); window != kProbeWindowCount; ++window) {
+      const byte* start(data + window * kStride);
+      for (size_t i(0); i != kProbeWindowSize; ++i)
+        ++histogram[start[i]];
+    }
+    sampled = kProbeWindowCount * kProbeWindowSize;
+  }
+  // Too small a sample can't reach the threshold even if random, so it is always compressed.
+  double entropy(0.0);
+  const double kSampled(static_cast<double>(sampled));
+  for (uint32_t count : histogram) {
+    if (count != 0) {
+      double probability(count / kSampled);
+      entropy -= probability * std::log2(probability);
+    }
+  }
+  return entropy >= kIncompressibleEntropy;
+}
+
+int Decompress(CompressionType type, const byte* input, size_t input_size, byte* output,
+               size_t length) {
+  switch (type) {
+    case CompressionType::kGzip:
+      return GzipDecompress(input, input_size, length, 0, output, length);
+    case CompressionType::kStore:
+      if (input_size != length) {
+        LOG(kError) << "Stored chunk has " << input_size << " bytes, expected " << length;
+        return kDecryptionException;
+      }
+      memcpy(output, input, length);
+      return kSuccess;
+#ifdef MAIDSAFE_ENCRYPT_LZ4
+    case CompressionType::kLz4: {
+      int result(LZ4_decompress_safe(reinterpret_cast<const char*>(input),
+                                     reinterpret_cast<char*>(output),
+                                     static_cast<int>(input_size), static_cast<int>(length)));
+      if (result < 0 || static_cast<size_t>(result) != length) {
+        LOG(kError) << "LZ4 failed to decompress to " << length << " bytes.";
+        return kDecryptionException;
+      }
+      return kSuccess;
+    }
+#endif
+#ifdef MAIDSAFE_ENCRYPT_ZSTD
+    case CompressionType::kZstd: {
+      size_t result(ZSTD_decompress(output, length, input, input_size));
+      if (ZSTD_isError(result) || result != length) {
+        LOG(kError) << "zstd failed to decompress to " << length << " bytes.";
+        return kDecryptionException;
+      }
+      return kSuccess;
+    }
+#endif
+    default:
+      LOG(kError) << "Compression type " << static_cast<uint32_t>(type) << " not supported.";
+      return kUnsupportedCompression;
+  }
+}
+
+int DecompressRange(CompressionType type, const byte* input, size_t input_size, size_t length,
+                    size_t offset, byte* output, size_t count) {
+  assert(offset + count <= length);
+  if (offset == 0 && count == length)
+    return Decompress(type, input, input_size, output, length);
+  if (type == CompressionType::kGzip)
+    return GzipDecompress(input, input_size, length, offset, output, count);
+  if (type == CompressionType::kStore) {
+    if (input_size != length) {
+      LOG(kError) << "Stored chunk has " << input_size << " bytes, expected " << length;
+      return kDecryptionException;
+    }
+    memcpy(output, input + offset, count);
+    return kSuccess;
+  }
+#ifdef MAIDSAFE_ENCRYPT_LZ4
+  if (type == CompressionType::kLz4 && offset == 0) {
+    // Decoding stops once the wanted prefix is complete.
+    int result(LZ4_decompress_safe_partial(
+        reinterpret_cast<const char*>(input), reinterpret_cast<char*>(output),
+        static_cast<int>(input_size), static_cast<int>(count), static_cast<int>(count)));
+    if (result < 0 || static_cast<size_t>(result) != count) {
+      LOG(kError) << "LZ4 failed to decompress the first " << count << " of " << length
+                  << " bytes.";
+      return kDecryptionException;
+    }
+    return kSuccess;
+  }
+#endif
+  std::vector<byte>& buffer(ThreadRangeBuffer());
+  if (buffer.size() < length)
+    buffer.resize(length);
+  int result(Decompress(type, input, input_size, buffer.data(), length));
+  if (result == kSuccess)
+    memcpy(output, buffer.data() + offset, count);
+  return result;
+}
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
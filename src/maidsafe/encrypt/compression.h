@@ -0,0 +1,67 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_ENCRYPT_COMPRESSION_H_
+#define MAIDSAFE_ENCRYPT_COMPRESSION_H_
+
+#include <cstdint>
+
+#include "cryptopp/config.h"
+
+#include "maidsafe/encrypt/data_map.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+// Whether this build can compress and decompress using "type".  kGzip and kStore are always
+// available; kLz4 and kZstd depend on the libraries being found at configure time.
+bool CompressionSupported(CompressionType type);
+
+// Upper bound on the compressed size of "length" bytes.
+size_t MaxCompressedSize(CompressionType type, size_t length);
+
+// Compresses input into output, which must have room for MaxCompressedSize(type, length) bytes.
+// "level" is interpreted per codec: deflate level for kGzip, the zstd level for kZstd and, for
+// kLz4, values of 3 or more select LZ4HC at that level.  Returns kSuccess,
+// kUnsupportedCompression or kEncryptionException.
+int Compress(CompressionType type, int level, const byte* input, size_t length, byte* output,
+             size_t* compressed_size);
+
+// Cheap estimate of whether compressing "length" bytes of data is worthwhile.  Up to 32KB sampled
+// evenly across the input is used to estimate the order-0 entropy; true is returned if it is so
+// close to 8 bits per byte that no codec could be expected to gain anything, e.g. for data which
+// is already compressed or encrypted.
+bool LooksIncompressible(const byte* data, size_t length);
+
+// Decompresses input into output, which must be exactly "length" bytes.  Returns kSuccess,
+// kUnsupportedCompression or kDecryptionException.
+int Decompress(CompressionType type, const byte* input, size_t input_size, byte* output,
+               size_t length);
+
+// As Decompress, but writes only bytes [offset, offset + count) of the "length" decompressed bytes
+// to output.  kGzip and kStore write them straight into output, as does kLz4 when offset is 0;
+// otherwise the whole input is decompressed into a per-thread buffer and the range copied out.
+int DecompressRange(CompressionType type, const byte* input, size_t input_size, size_t length,
+                    size_t offset, byte* output, size_t count);
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_ENCRYPT_COMPRESSION_H_
@@ -37,7 +37,9 @@ enum ReturnCode {
   kDecryptionException = -200005,
   kInvalidPosition = -200006,
   kSequencerException = -200007,
-  kSequencerAddError = -200008
+  kSequencerAddError = -200008,
+  kUnsupportedCompression = -200009,
+  kMemoryLimitExceeded = -200010
 };
 
 }  // namespace encrypt
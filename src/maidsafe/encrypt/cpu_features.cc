@@ -0,0 +1,71 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/encrypt/cpu_features.h"
+
+#if defined(MAIDSAFE_ENCRYPT_X86_SIMD) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace {
+
+CpuFeatures DetectCpuFeatures() {
+  CpuFeatures features;
+#if defined(MAIDSAFE_ENCRYPT_X86_SIMD)
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  int max_leaf(info[0]);
+  __cpuid(info, 1);
+  features.sse2 = (info[3] & (1 << 26)) != 0;
+  bool os_saves_ymm(false), os_saves_zmm(false);
+  if ((info[2] & (1 << 27)) != 0) {  // OSXSAVE
+    unsigned __int64 xcr0(_xgetbv(0));
+    os_saves_ymm = (xcr0 & 0x6) == 0x6;
+    os_saves_zmm = (xcr0 & 0xe6) == 0xe6;
+  }
+  if (max_leaf >= 7) {
+    __cpuidex(info, 7, 0);
+    features.avx2 = os_saves_ymm && (info[1] & (1 << 5)) != 0;
+    features.avx512f = os_saves_zmm && (info[1] & (1 << 16)) != 0;
+  }
+#else
+  // These builtins also check that the OS preserves the extended register state.
+  __builtin_cpu_init();
+  features.sse2 = __builtin_cpu_supports("sse2") != 0;
+  features.avx2 = __builtin_cpu_supports("avx2") != 0;
+  features.avx512f = __builtin_cpu_supports("avx512f") != 0;
+#endif
+#endif
+  return features;
+}
+
+}  // unnamed namespace
+
+const CpuFeatures& GetCpuFeatures() {
+  static const CpuFeatures kCpuFeatures(DetectCpuFeatures());
+  return kCpuFeatures;
+}
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
@@ -1,4 +1,4 @@
-/*  Copyright 2011 MaidSafe.net limited
+/*  Copyright 2014 MaidSafe.net limited
 
     This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
     version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
@@ -16,37 +16,25 @@
     See the Licences for the specific language governing permissions and limitations relating to
     use of the MaidSafe Software.                                                                 */
 
-#ifndef MAIDSAFE_ENCRYPT_BYTE_ARRAY_H_
-#define MAIDSAFE_ENCRYPT_BYTE_ARRAY_H_
-
-#include <cstdint>
-#include <memory>
-#include "cryptopp/config.h"
+#ifndef MAIDSAFE_ENCRYPT_CPU_FEATURES_H_
+#define MAIDSAFE_ENCRYPT_CPU_FEATURES_H_
 
 namespace maidsafe {
 
 namespace encrypt {
 
-typedef std::shared_ptr<byte> ByteArray;
-
-ByteArray GetNewByteArray(uint32_t size);
-
-uint32_t Size(const ByteArray& ptr);
-
-uint32_t MemCopy(const ByteArray& destination, uint32_t destination_offset,
-                 const void* source, uint32_t copy_size);
-
-struct ByteArrayDeleter {
-  explicit ByteArrayDeleter(uint32_t size) : kSize_(size) {}
-  void operator()(byte*& ptr) {
-    delete[] ptr;
-    ptr = nullptr;
-  }
-  const uint32_t kSize_;
+// Instruction set extensions usable on this machine.  All are false on non-x86 builds or where
+// MAIDSAFE_ENCRYPT_X86_SIMD isn't defined (i.e. the ISA-specific kernels weren't compiled).
+struct CpuFeatures {
+  CpuFeatures() : sse2(false), avx2(false), avx512f(false) {}
+  bool sse2, avx2, avx512f;
 };
 
+// Detected once, on first use.
+const CpuFeatures& GetCpuFeatures();
+
 }  // namespace encrypt
 
 }  // namespace maidsafe
 
-#endif  // MAIDSAFE_ENCRYPT_BYTE_ARRAY_H_
+#endif  // MAIDSAFE_ENCRYPT_CPU_FEATURES_H_
@@ -0,0 +1,107 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/encrypt/crypto_backend.h"
+
+#ifdef __MSVC__
+#pragma warning(push, 1)
+#endif
+#include "cryptopp/aes.h"
+#include "cryptopp/modes.h"
+#include "cryptopp/sha.h"
+#ifdef __MSVC__
+#pragma warning(pop)
+#endif
+
+#include "maidsafe/common/crypto.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace {
+
+class CryptoPPSha512 : public HashFunction {
+ public:
+  CryptoPPSha512() : hash_() {}
+  void Update(const byte* data, size_t length) override { hash_.Update(data, length); }
+  void Final(byte* digest) override { hash_.Final(digest); }
+  size_t DigestSize() const override { return CryptoPP::SHA512::DIGESTSIZE; }
+
+ private:
+  CryptoPP::SHA512 hash_;
+};
+
+template <typename Mode>
+class CryptoPPAes256Cfb : public StreamCipher {
+ public:
+  CryptoPPAes256Cfb() : mode_() {}
+  void SetKeyWithIv(const byte* key, const byte* iv) override {
+    mode_.SetKeyWithIV(key, crypto::AES256_KeySize, iv);
+  }
+  void ProcessData(byte* output, const byte* input, size_t length) override {
+    mode_.ProcessData(output, input, length);
+  }
+
+ private:
+  Mode mode_;
+};
+
+class CryptoPPBackend : public CryptoBackend {
+ public:
+  const char* name() const override { return "CryptoPP"; }
+  std::unique_ptr<HashFunction> NewSha512() const override {
+    return std::unique_ptr<HashFunction>(new CryptoPPSha512);
+  }
+  std::unique_ptr<StreamCipher> NewAes256CfbEncryptor() const override {
+    return std::unique_ptr<StreamCipher>(
+        new CryptoPPAes256Cfb<CryptoPP::CFB_Mode<CryptoPP::AES>::Encryption>);
+  }
+  std::unique_ptr<StreamCipher> NewAes256CfbDecryptor() const override {
+    return std::unique_ptr<StreamCipher>(
+        new CryptoPPAes256Cfb<CryptoPP::CFB_Mode<CryptoPP::AES>::Decryption>);
+  }
+  void Sha512(const byte* data, size_t length, byte* digest) const override {
+    CryptoPP::SHA512().CalculateDigest(digest, data, length);
+  }
+};
+
+}  // unnamed namespace
+
+void CryptoBackend::Sha512(const byte* data, size_t length, byte* digest) const {
+  std::unique_ptr<HashFunction> hash(NewSha512());
+  hash->Update(data, length);
+  hash->Final(digest);
+}
+
+const CryptoBackend& GetCryptoBackend() {
+#ifdef MAIDSAFE_ENCRYPT_OPENSSL_BACKEND
+  return GetOpenSslBackend();
+#else
+  return GetCryptoPPBackend();
+#endif
+}
+
+const CryptoBackend& GetCryptoPPBackend() {
+  static const CryptoPPBackend kBackend;
+  return kBackend;
+}
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
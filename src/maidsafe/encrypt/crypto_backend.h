@@ -0,0 +1,74 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_ENCRYPT_CRYPTO_BACKEND_H_
+#define MAIDSAFE_ENCRYPT_CRYPTO_BACKEND_H_
+
+#include <cstdint>
+#include <memory>
+
+#include "cryptopp/config.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+// Incremental hash.  Final writes the digest and leaves the object ready to hash a new message.
+class HashFunction {
+ public:
+  virtual ~HashFunction() {}
+  virtual void Update(const byte* data, size_t length) = 0;
+  virtual void Final(byte* digest) = 0;
+  virtual size_t DigestSize() const = 0;
+};
+
+// AES-256 in CFB mode with 128-bit feedback, i.e. CryptoPP::CFB_Mode<CryptoPP::AES>.  Successive
+// calls to ProcessData continue the same stream.  output may equal input.
+class StreamCipher {
+ public:
+  virtual ~StreamCipher() {}
+  virtual void SetKeyWithIv(const byte* key, const byte* iv) = 0;
+  virtual void ProcessData(byte* output, const byte* input, size_t length) = 0;
+};
+
+// Provider of the symmetric primitives used for self-encryption.  All backends must produce
+// bit-identical output, so the choice affects only speed.  Failures throw.
+class CryptoBackend {
+ public:
+  virtual ~CryptoBackend() {}
+  virtual const char* name() const = 0;
+  virtual std::unique_ptr<HashFunction> NewSha512() const = 0;
+  virtual std::unique_ptr<StreamCipher> NewAes256CfbEncryptor() const = 0;
+  virtual std::unique_ptr<StreamCipher> NewAes256CfbDecryptor() const = 0;
+  // One-shot SHA-512 of data into digest.
+  virtual void Sha512(const byte* data, size_t length, byte* digest) const;
+};
+
+// The backend chosen by the MAIDSAFE_ENCRYPT_CRYPTO_BACKEND CMake option.
+const CryptoBackend& GetCryptoBackend();
+
+const CryptoBackend& GetCryptoPPBackend();
+#ifdef MAIDSAFE_ENCRYPT_OPENSSL_BACKEND
+const CryptoBackend& GetOpenSslBackend();
+#endif
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_ENCRYPT_CRYPTO_BACKEND_H_
@@ -0,0 +1,130 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/encrypt/crypto_backend.h"
+
+#ifdef MAIDSAFE_ENCRYPT_OPENSSL_BACKEND
+
+#include <algorithm>
+#include <limits>
+
+#include "openssl/evp.h"
+
+#include "maidsafe/common/error.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace {
+
+class OpenSslSha512 : public HashFunction {
+ public:
+  OpenSslSha512() : context_(EVP_MD_CTX_new()) {
+    if (!context_ || EVP_DigestInit_ex(context_, EVP_sha512(), nullptr) != 1) {
+      EVP_MD_CTX_free(context_);
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::hashing_error));
+    }
+  }
+  ~OpenSslSha512() { EVP_MD_CTX_free(context_); }
+  void Update(const byte* data, size_t length) override {
+    if (EVP_DigestUpdate(context_, data, length) != 1)
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::hashing_error));
+  }
+  void Final(byte* digest) override {
+    if (EVP_DigestFinal_ex(context_, digest, nullptr) != 1 ||
+        EVP_DigestInit_ex(context_, EVP_sha512(), nullptr) != 1) {
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::hashing_error));
+    }
+  }
+  size_t DigestSize() const override { return 64; }
+
+ private:
+  OpenSslSha512(const OpenSslSha512&);
+  OpenSslSha512& operator=(const OpenSslSha512&);
+
+  EVP_MD_CTX* context_;
+};
+
+class OpenSslAes256Cfb : public StreamCipher {
+ public:
+  explicit OpenSslAes256Cfb(bool encrypting)
+      : context_(EVP_CIPHER_CTX_new()), kEncrypting_(encrypting ? 1 : 0), cipher_set_(false) {
+    if (!context_)
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::symmetric_encryption_error));
+  }
+  ~OpenSslAes256Cfb() { EVP_CIPHER_CTX_free(context_); }
+  void SetKeyWithIv(const byte* key, const byte* iv) override {
+    // Once the cipher is set, rekeying a reused context only needs the new key and IV.
+    const EVP_CIPHER* cipher(cipher_set_ ? nullptr : EVP_aes_256_cfb128());
+    if (EVP_CipherInit_ex(context_, cipher, nullptr, key, iv, kEncrypting_) != 1)
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::symmetric_encryption_error));
+    cipher_set_ = true;
+  }
+  void ProcessData(byte* output, const byte* input, size_t length) override {
+    while (length != 0) {
+      int chunk(static_cast<int>(
+          std::min(length, static_cast<size_t>(std::numeric_limits<int>::max() - 16))));
+      int written(0);
+      if (EVP_CipherUpdate(context_, output, &written, input, chunk) != 1 || written != chunk)
+        BOOST_THROW_EXCEPTION(MakeError(CommonErrors::symmetric_encryption_error));
+      output += chunk;
+      input += chunk;
+      length -= chunk;
+    }
+  }
+
+ private:
+  OpenSslAes256Cfb(const OpenSslAes256Cfb&);
+  OpenSslAes256Cfb& operator=(const OpenSslAes256Cfb&);
+
+  EVP_CIPHER_CTX* context_;
+  const int kEncrypting_;
+  bool cipher_set_;
+};
+
+class OpenSslBackend : public CryptoBackend {
+ public:
+  const char* name() const override { return "OpenSSL"; }
+  std::unique_ptr<HashFunction> NewSha512() const override {
+    return std::unique_ptr<HashFunction>(new OpenSslSha512);
+  }
+  std::unique_ptr<StreamCipher> NewAes256CfbEncryptor() const override {
+    return std::unique_ptr<StreamCipher>(new OpenSslAes256Cfb(true));
+  }
+  std::unique_ptr<StreamCipher> NewAes256CfbDecryptor() const override {
+    return std::unique_ptr<StreamCipher>(new OpenSslAes256Cfb(false));
+  }
+  void Sha512(const byte* data, size_t length, byte* digest) const override {
+    if (EVP_Digest(data, length, digest, nullptr, EVP_sha512(), nullptr) != 1)
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::hashing_error));
+  }
+};
+
+}  // unnamed namespace
+
+const CryptoBackend& GetOpenSslBackend() {
+  static const OpenSslBackend kBackend;
+  return kBackend;
+}
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_ENCRYPT_OPENSSL_BACKEND
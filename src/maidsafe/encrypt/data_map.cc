@@ -16,6 +16,10 @@
     See the Licences for the specific language governing permissions and limitations relating to
     use of the MaidSafe Software.                                                                 */
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
 #include "maidsafe/common/crypto.h"
 #include "maidsafe/common/log.h"
 
@@ -29,11 +33,157 @@ namespace maidsafe {
 
 namespace encrypt {
 
+bool operator==(const ConstChunkHashRef& lhs, const ConstChunkHashRef& rhs) {
+  return lhs.size() == rhs.size() && memcmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+}
+
+bool operator==(const ConstChunkHashRef& lhs, const std::string& rhs) {
+  return lhs.size() == rhs.size() && memcmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+}
+
+ChunkHashRef& ChunkHashRef::operator=(const std::string& hash) {
+  if (hash.empty()) {
+    resize(0);
+    return *this;
+  }
+  if (hash.size() != kChunkHashSize)
+    BOOST_THROW_EXCEPTION(MakeError(CommonErrors::invalid_string_size));
+  memcpy(hash_, hash.data(), kChunkHashSize);
+  *state_ |= detail::kHashSetFlag;
+  return *this;
+}
+
+ChunkHashRef& ChunkHashRef::operator=(const ConstChunkHashRef& other) {
+  if (other.empty()) {
+    resize(0);
+  } else {
+    memmove(hash_, other.data(), kChunkHashSize);
+    *state_ |= detail::kHashSetFlag;
+  }
+  return *this;
+}
+
+ChunkHashRef& ChunkHashRef::operator=(const ChunkHashRef& other) {
+  return *this = static_cast<const ConstChunkHashRef&>(other);
+}
+
+void ChunkHashRef::resize(size_t size) {
+  assert(size == 0 || size == kChunkHashSize);
+  if (size == 0) {
+    *state_ &= static_cast<uint8_t>(~detail::kHashSetFlag);
+  } else if (empty()) {
+    memset(hash_, 0, kChunkHashSize);
+    *state_ |= detail::kHashSetFlag;
+  }
+}
+
+ConstChunkDetailsRef::ConstChunkDetailsRef(const ChunkDetailsList& list, size_t index)
+    : hash(&list.hashes_[index * kChunkHashSize], &list.states_[index]),
+      pre_hash(*reinterpret_cast<const byte(*)[kChunkHashSize]>(
+          &list.pre_hashes_[index * kChunkHashSize])),
+      pre_hash_state(static_cast<ChunkDetails::PreHashState>(list.pre_hash_states_[index])),
+      storage_state(static_cast<ChunkDetails::StorageState>(
+          (list.states_[index] >> detail::kStorageStateShift) & 3)),
+      size(list.sizes_[index]),
+      compression(static_cast<CompressionType>(
+          (list.states_[index] >> detail::kCompressionShift) & 3)) {}
+
+ConstChunkDetailsRef::ConstChunkDetailsRef(const ChunkDetailsRef& other)
+    : hash(other.hash),
+      pre_hash(other.pre_hash),
+      pre_hash_state(other.pre_hash_state),
+      storage_state(other.storage_state),
+      size(other.size),
+      compression(other.compression) {}
+
+ConstChunkDetailsRef::operator ChunkDetails() const {
+  ChunkDetails chunk;
+  chunk.hash = hash.string();
+  memcpy(chunk.pre_hash, pre_hash, kChunkHashSize);
+  chunk.pre_hash_state = pre_hash_state;
+  chunk.storage_state = storage_state;
+  chunk.size = size;
+  chunk.compression = compression;
+  return chunk;
+}
+
+ChunkDetailsRef::ChunkDetailsRef(ChunkDetailsList* list, size_t index)
+    : hash(&list->hashes_[index * kChunkHashSize], &list->states_[index]),
+      pre_hash(*reinterpret_cast<byte(*)[kChunkHashSize]>(
+          &list->pre_hashes_[index * kChunkHashSize])),
+      pre_hash_state(&list->pre_hash_states_[index]),
+      storage_state(&list->states_[index]),
+      size(list->sizes_[index]),
+      compression(&list->states_[index]) {}
+
+ChunkDetailsRef& ChunkDetailsRef::operator=(const ChunkDetails& other) {
+  hash = other.hash;
+  memcpy(pre_hash, other.pre_hash, kChunkHashSize);
+  pre_hash_state = other.pre_hash_state;
+  storage_state = other.storage_state;
+  size = other.size;
+  compression = other.compression;
+  return *this;
+}
+
+ChunkDetailsRef& ChunkDetailsRef::operator=(const ConstChunkDetailsRef& other) {
+  hash = other.hash;
+  memmove(pre_hash, other.pre_hash, kChunkHashSize);
+  pre_hash_state = other.pre_hash_state;
+  storage_state = other.storage_state;
+  size = other.size;
+  compression = other.compression;
+  return *this;
+}
+
+ChunkDetailsRef& ChunkDetailsRef::operator=(const ChunkDetailsRef& other) {
+  return *this = ConstChunkDetailsRef(other);
+}
+
+ChunkDetailsRef::operator ChunkDetails() const {
+  return ConstChunkDetailsRef(*this);
+}
+
+size_t ChunkDetailsList::capacity() const {
+  return std::min(std::min(hashes_.capacity(), pre_hashes_.capacity()) / kChunkHashSize,
+                  std::min(sizes_.capacity(),
+                           std::min(pre_hash_states_.capacity(), states_.capacity())));
+}
+
+void ChunkDetailsList::reserve(size_t count) {
+  hashes_.reserve(count * kChunkHashSize);
+  pre_hashes_.reserve(count * kChunkHashSize);
+  sizes_.reserve(count);
+  pre_hash_states_.reserve(count);
+  states_.reserve(count);
+}
+
+void ChunkDetailsList::resize(size_t count) {
+  hashes_.resize(count * kChunkHashSize);
+  pre_hashes_.resize(count * kChunkHashSize);
+  sizes_.resize(count);
+  pre_hash_states_.resize(count, ChunkDetails::kEmpty);
+  states_.resize(count, detail::kDefaultChunkState);
+}
+
+void ChunkDetailsList::clear() {
+  hashes_.clear();
+  pre_hashes_.clear();
+  sizes_.clear();
+  pre_hash_states_.clear();
+  states_.clear();
+}
+
+void ChunkDetailsList::push_back(const ChunkDetails& chunk) {
+  resize(size() + 1);
+  back() = chunk;
+}
+
 DataMap::DataMap() : self_encryption_version(kSelfEncryptionVersion), chunks(), content() {}
 
 uint64_t DataMap::size() const {
   return chunks.empty() ? content.size() :
-      static_cast<uint64_t>(chunks[0].size) * (chunks.size() - 1) + chunks.rbegin()->size;
+      static_cast<uint64_t>(chunks[0].size) * (chunks.size() - 1) + chunks.back().size;
 }
 
 bool DataMap::empty() const { return chunks.empty() && content.empty(); }
@@ -63,14 +213,16 @@ void SerialiseDataMap(const DataMap& data_map, std::string& serialised_data_map)
   if (!data_map.content.empty()) {
     proto_data_map.set_content(data_map.content);
   } else {
-    for (auto& chunk_detail : data_map.chunks) {
+    for (const auto& chunk_detail : data_map.chunks) {
       protobuf::ChunkDetails* chunk_details = proto_data_map.add_chunk_details();
-      chunk_details->set_hash(chunk_detail.hash);
+      chunk_details->set_hash(chunk_detail.hash.string());
       chunk_details->set_pre_hash(std::string(reinterpret_cast<char const*>(chunk_detail.pre_hash),
-                                              crypto::SHA512::DIGESTSIZE));
+                                              kChunkHashSize));
       chunk_details->set_size(chunk_detail.size);
       chunk_details->set_pre_hash_state(chunk_detail.pre_hash_state);
       chunk_details->set_storage_state(chunk_detail.storage_state);
+      if (chunk_detail.compression != CompressionType::kGzip)
+        chunk_details->set_compression_type(static_cast<uint32_t>(chunk_detail.compression));
     }
   }
   if (!proto_data_map.SerializeToString(&serialised_data_map))
@@ -79,21 +231,30 @@ void SerialiseDataMap(const DataMap& data_map, std::string& serialised_data_map)
 
 void ExtractChunkDetails(const protobuf::DataMap& proto_data_map, DataMap& data_map) {
   ChunkDetails temp;
+  data_map.chunks.reserve(data_map.chunks.size() + proto_data_map.chunk_details_size());
   for (int n(0); n < proto_data_map.chunk_details_size(); ++n) {
     temp.hash = proto_data_map.chunk_details(n).hash();
     std::string pre_hash(proto_data_map.chunk_details(n).pre_hash());
-    if (pre_hash.size() == size_t(crypto::SHA512::DIGESTSIZE)) {
-      for (int ch(0); ch < crypto::SHA512::DIGESTSIZE; ++ch)
-        temp.pre_hash[ch] = pre_hash.at(ch);
+    if (pre_hash.size() == size_t(kChunkHashSize) &&
+        (temp.hash.empty() || temp.hash.size() == size_t(kChunkHashSize))) {
+      memcpy(temp.pre_hash, pre_hash.data(), kChunkHashSize);
     } else {
       data_map.chunks.clear();
       BOOST_THROW_EXCEPTION(MakeError(CommonErrors::invalid_string_size));
     }
-    temp.size = proto_data_map.chunk_details(n).size();
-    temp.pre_hash_state =
-        static_cast<ChunkDetails::PreHashState>(proto_data_map.chunk_details(n).pre_hash_state());
-    temp.storage_state =
-        static_cast<ChunkDetails::StorageState>(proto_data_map.chunk_details(n).storage_state());
+    // The states are packed into two bits each, so anything out of range would corrupt the others.
+    const protobuf::ChunkDetails& details(proto_data_map.chunk_details(n));
+    if (details.pre_hash_state() > static_cast<uint32_t>(ChunkDetails::kOk) ||
+        details.storage_state() > static_cast<uint32_t>(ChunkDetails::kUnstored) ||
+        details.compression_type() > static_cast<uint32_t>(CompressionType::kZstd)) {
+      LOG(kError) << "Chunk " << n << " has states out of range.";
+      data_map.chunks.clear();
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::parsing_error));
+    }
+    temp.size = details.size();
+    temp.pre_hash_state = static_cast<ChunkDetails::PreHashState>(details.pre_hash_state());
+    temp.storage_state = static_cast<ChunkDetails::StorageState>(details.storage_state());
+    temp.compression = static_cast<CompressionType>(details.compression_type());
     data_map.chunks.push_back(temp);
   }
 }
@@ -0,0 +1,212 @@
+/*  Copyright 2011 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/encrypt/executor.h"
+
+#include <algorithm>
+#include <exception>
+#include <utility>
+
+#include "maidsafe/common/log.h"
+#include "maidsafe/common/utils.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace {
+
+// The pool and worker index of the current thread, so that a worker queues nested loops on its own
+// deque.
+thread_local const WorkStealingExecutor* g_current_executor(nullptr);
+thread_local int g_current_worker(-1);
+
+struct Loop {
+  Loop(int64_t begin, int64_t end_in, const Executor::IndexedTask* task_in)
+      : next(begin), end(end_in), remaining(end_in - begin), task(task_in), mutex(), finished(),
+        error() {}
+  std::atomic<int64_t> next;
+  const int64_t end;
+  std::atomic<int64_t> remaining;
+  const Executor::IndexedTask* const task;
+  std::mutex mutex;
+  std::condition_variable finished;
+  std::exception_ptr error;
+};
+
+// Claims and runs indices until there are none left.  The task is only dereferenced for a claimed
+// index, so a helper which starts after its ParallelFor has returned never touches it.
+void RunLoop(Loop* loop) {
+  for (;;) {
+    const int64_t kIndex(loop->next++);
+    if (kIndex >= loop->end)
+      return;
+    try {
+      (*loop->task)(kIndex);
+    }
+    catch (...) {
+      std::lock_guard<std::mutex> lock(loop->mutex);
+      if (!loop->error)
+        loop->error = std::current_exception();
+    }
+    if (--loop->remaining == 0) {
+      std::lock_guard<std::mutex> lock(loop->mutex);
+      loop->finished.notify_all();
+    }
+  }
+}
+
+void RunPosted(const std::function<void()>& task) {
+  try {
+    task();
+  }
+  catch (const std::exception& e) {
+    LOG(kError) << "Posted task threw: " << e.what();
+  }
+  catch (...) {
+    LOG(kError) << "Posted task threw.";
+  }
+}
+
+}  // unnamed namespace
+
+void InlineExecutor::ParallelFor(int64_t begin, int64_t end, const IndexedTask& task) {
+  if (end <= begin)
+    return;
+  Loop loop(begin, end, &task);
+  RunLoop(&loop);
+  if (loop.error)
+    std::rethrow_exception(loop.error);
+}
+
+void InlineExecutor::Post(std::function<void()> task) { RunPosted(task); }
+
+WorkStealingExecutor::WorkStealingExecutor(int thread_count)
+    : workers_(),
+      wake_mutex_(),
+      wake_(),
+      queued_(0),
+      next_worker_(0),
+      stopping_(false),
+      threads_() {
+  for (int i(0); i < thread_count; ++i)
+    workers_.emplace_back(new Worker);
+  for (int i(0); i < thread_count; ++i)
+    threads_.emplace_back([this, i] { Run(i); });
+}
+
+WorkStealingExecutor::~WorkStealingExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto& thread : threads_)
+    thread.join();
+}
+
+void WorkStealingExecutor::ParallelFor(int64_t begin, int64_t end, const IndexedTask& task) {
+  if (end <= begin)
+    return;
+  std::shared_ptr<Loop> loop(std::make_shared<Loop>(begin, end, &task));
+  const int64_t kHelpers(std::min(end - begin - 1, static_cast<int64_t>(workers_.size())));
+  for (int64_t i(0); i < kHelpers; ++i)
+    Push([loop] { RunLoop(loop.get()); });
+
+  RunLoop(loop.get());
+  std::unique_lock<std::mutex> lock(loop->mutex);
+  loop->finished.wait(lock, [&loop] { return loop->remaining == 0; });
+  if (loop->error)
+    std::rethrow_exception(loop->error);
+}
+
+void WorkStealingExecutor::Post(std::function<void()> task) {
+  if (workers_.empty())
+    RunPosted(task);
+  else
+    Push([task] { RunPosted(task); });
+}
+
+bool WorkStealingExecutor::RunPendingTask() {
+  if (workers_.empty())
+    return false;
+  return TryRunOne(g_current_executor == this ? g_current_worker : -1);
+}
+
+void WorkStealingExecutor::Push(std::function<void()> task) {
+  const size_t kWorker(g_current_executor == this ? static_cast<size_t>(g_current_worker)
+                                                  : next_worker_++ % workers_.size());
+  {
+    std::lock_guard<std::mutex> lock(workers_[kWorker]->mutex);
+    workers_[kWorker]->tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    ++queued_;
+  }
+  wake_.notify_one();
+}
+
+bool WorkStealingExecutor::TryRunOne(int self) {
+  std::function<void()> task;
+  if (self >= 0) {
+    Worker& own(*workers_[self]);
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+    }
+  }
+  const int kWorkerCount(static_cast<int>(workers_.size()));
+  for (int i(self >= 0 ? 1 : 0); !task && i < kWorkerCount; ++i) {
+    Worker& victim(*workers_[(self + i + kWorkerCount) % kWorkerCount]);
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+    }
+  }
+  if (!task)
+    return false;
+  --queued_;
+  task();
+  return true;
+}
+
+void WorkStealingExecutor::Run(int self) {
+  g_current_executor = this;
+  g_current_worker = self;
+  for (;;) {
+    if (TryRunOne(self))
+      continue;
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    wake_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+    if (stopping_ && queued_ <= 0)
+      return;
+  }
+}
+
+Executor& DefaultExecutor() {
+  static WorkStealingExecutor* const kExecutor(
+      new WorkStealingExecutor(std::max(0, maidsafe::Concurrency() - 1)));
+  return *kExecutor;
+}
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
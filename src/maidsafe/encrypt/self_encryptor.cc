@@ -18,24 +18,19 @@
 
 #include "maidsafe/encrypt/self_encryptor.h"
 
-#ifdef MAIDSAFE_OMP_ENABLED
-#include <omp.h>
-#endif
-
 #include <algorithm>
+#include <chrono>
 #include <limits>
-#include <set>
+#include <memory>
+#include <numeric>
 #include <tuple>
 #include <utility>
+#include <vector>
 
 #ifdef __MSVC__
 #pragma warning(push, 1)
 #endif
-#include "cryptopp/aes.h"
 #include "cryptopp/gzip.h"
-#include "cryptopp/modes.h"
-#include "cryptopp/mqueue.h"
-#include "cryptopp/sha.h"
 #ifdef __MSVC__
 #pragma warning(pop)
 #endif
@@ -45,9 +40,17 @@
 #include "maidsafe/common/profiler.h"
 #include "maidsafe/common/utils.h"
 
+#include "maidsafe/encrypt/blake2b.h"
+#include "maidsafe/encrypt/chunk_cache.h"
+#include "maidsafe/encrypt/chunk_codec.h"
+#include "maidsafe/encrypt/compression.h"
 #include "maidsafe/encrypt/config.h"
+#include "maidsafe/encrypt/crypto_backend.h"
 #include "maidsafe/encrypt/data_map.pb.h"
+#include "maidsafe/encrypt/executor.h"
 #include "maidsafe/encrypt/sequencer.h"
+#include "maidsafe/encrypt/sha512_multi_buffer.h"
+#include "maidsafe/encrypt/xor_pad.h"
 
 namespace maidsafe {
 
@@ -59,44 +62,120 @@ const EncryptionAlgorithm kDataMapEncryptionVersion =
 
 namespace {
 
-const size_t kPadSize((3 * crypto::SHA512::DIGESTSIZE) - crypto::AES256_KeySize -
-                      crypto::AES256_IVSize);
+// The hash used for chunk pre-hashes (and hence keys, IVs and pads) and for chunk names:
+// BLAKE2b-512 for kSelfEncryptionVersion2, otherwise SHA-512.  Both produce
+// crypto::SHA512::DIGESTSIZE bytes.
+std::unique_ptr<HashFunction> NewChunkHash(EncryptionAlgorithm version) {
+  if (version == EncryptionAlgorithm::kSelfEncryptionVersion2)
+    return std::unique_ptr<HashFunction>(new Blake2b512);
+  return GetCryptoBackend().NewSha512();
+}
 
-class XORFilter : public CryptoPP::Bufferless<CryptoPP::Filter> {
- public:
-  XORFilter(CryptoPP::BufferedTransformation* attachment, byte* pad,
-            size_t pad_size = kPadSize)
-      : pad_(pad), count_(0), kPadSize_(pad_size) {
-    CryptoPP::Filter::Detach(attachment);
-  }
-  size_t Put2(const byte* in_string, size_t length, int message_end, bool blocking) override {
-    if (length == 0) {
-      return AttachedTransformation()->Put2(in_string, length, message_end, blocking);
-    }
-    std::unique_ptr<byte[]> buffer(new byte[length]);
+// Pad, key and IV buffers reused by every chunk encrypted or decrypted on a thread.
+struct ChunkSecrets {
+  ChunkSecrets()
+      : pad(GetNewByteArray(kPadSize)),
+        key(GetNewByteArray(crypto::AES256_KeySize)),
+        iv(GetNewByteArray(crypto::AES256_IVSize)) {}
+  ByteArray pad, key, iv;
+};
 
-    size_t i(0);
-#ifdef MAIDSAFE_OMP_ENABLED
-// #  pragma omp parallel for shared(buffer, in_string) private(i)
-#endif
-    for (; i != length; ++i) {
-      buffer[i] = in_string[i] ^ pad_[count_ % kPadSize_];
-      ++count_;
-    }
+ChunkSecrets& GetChunkSecrets() {
+  thread_local ChunkSecrets secrets;
+  return secrets;
+}
 
-    return AttachedTransformation()->Put2(buffer.get(), length, message_end, blocking);
+// Hashes "count" chunks of equal length as NewChunkHash would.  SHA-512 chunks are hashed together
+// in SIMD lanes.
+void HashChunks(EncryptionAlgorithm version, const byte* const* data, size_t length, size_t count,
+                byte* const* digests) {
+  if (version == EncryptionAlgorithm::kSelfEncryptionVersion2) {
+    for (size_t i(0); i != count; ++i)
+      Blake2b512Hash(data[i], length, digests[i]);
+  } else {
+    Sha512MultiBuffer(data, length, count, digests);
   }
-  bool IsolatedFlush(bool, bool) override { return false; }
-
- private:
-  XORFilter& operator=(const XORFilter&);
-  XORFilter(const XORFilter&);
+}
 
-  byte* pad_;
-  size_t count_;
-  const size_t kPadSize_;
+// Buffered data which Flush copies over part of a chunk's old content.
+struct FlushOverlay {
+  FlushOverlay(uint32_t offset_in, const byte* data_in, uint32_t size_in)
+      : offset(offset_in), data(data_in), size(size_in) {}
+  uint32_t offset;
+  const byte* data;
+  uint32_t size;
 };
 
+// Bounds of the number of chunks decrypted ahead of sequential reads, and the number of
+// consecutive sequential reads after which readahead starts.
+const uint32_t kMinReadaheadChunks(2);
+const uint32_t kMaxReadaheadChunks(16);
+const uint32_t kSequentialReadsBeforeReadahead(2);
+// The number of readers whose positions Read keeps track of at once.
+const size_t kMaxReadStreams(8);
+
+// The most memory a SelfEncryptor using "options" can hold at once, other than out-of-order writes.
+uint64_t BufferedBytes(const SelfEncryptorOptions& options) {
+  // Chunks 0 and 1, and two queued chunks which may be parked in the sequencer.
+  uint64_t chunks(4);
+  // The write queues, and the chunks fetched to fill the first one.
+  chunks += (options.queue_chunks + 1) * std::max(1U, options.pipeline_buffers);
+  chunks += options.queue_chunks + 2;
+  // The read cache, and for each reader a chunk being decrypted into it and the stored chunks
+  // fetched for one read.
+  chunks += options.read_cache_chunks + kMaxReadStreams * (options.read_cache_chunks + 2);
+  // Readahead and Flush windows, each both fetched and decrypted.
+  chunks += 2 * (options.readahead_chunks + options.flush_window);
+  return chunks * kDefaultChunkSize + options.read_buffer_size + options.spill_threshold;
+}
+
+// Fills in the sizes left as 0.  With a memory limit, the derived sizes are then halved, the least
+// useful first, until BufferedBytes fits within it.
+SelfEncryptorOptions ResolveOptions(const SelfEncryptorOptions& options) {
+  SelfEncryptorOptions resolved(options);
+  if (resolved.parallelism == 0)
+    resolved.parallelism = static_cast<uint32_t>(Concurrency());
+  if (resolved.queue_chunks == 0)
+    resolved.queue_chunks = resolved.parallelism;
+  if (resolved.read_cache_chunks == 0)
+    resolved.read_cache_chunks = resolved.parallelism;
+  if (resolved.read_buffer_size == 0) {
+    uint64_t read_buffer_size(static_cast<uint64_t>(20) * resolved.read_cache_chunks *
+                              kDefaultChunkSize);
+    resolved.read_buffer_size = static_cast<uint32_t>(std::min<uint64_t>(
+        read_buffer_size, std::numeric_limits<uint32_t>::max()));
+  }
+  if (resolved.readahead_chunks == 0)
+    resolved.readahead_chunks = kMaxReadaheadChunks;
+  if (resolved.flush_window == 0)
+    resolved.flush_window = resolved.parallelism;
+  if (options.memory_limit == 0)
+    return resolved;
+
+  while (BufferedBytes(resolved) > options.memory_limit) {
+    if (options.read_buffer_size == 0 && resolved.read_buffer_size != 0) {
+      resolved.read_buffer_size /= 2;
+      if (resolved.read_buffer_size < kDefaultChunkSize)
+        resolved.read_buffer_size = 0;
+    } else if (options.readahead_chunks == 0 && resolved.readahead_chunks != 0) {
+      resolved.readahead_chunks /= 2;
+      if (resolved.readahead_chunks < kMinReadaheadChunks)
+        resolved.readahead_chunks = 0;
+    } else if (options.read_cache_chunks == 0 && resolved.read_cache_chunks > 1) {
+      resolved.read_cache_chunks /= 2;
+    } else if (options.flush_window == 0 && resolved.flush_window > 1) {
+      resolved.flush_window /= 2;
+    } else if (options.queue_chunks == 0 && resolved.queue_chunks > 1) {
+      resolved.queue_chunks /= 2;
+    } else {
+      LOG(kError) << "SelfEncryptor needs up to " << BufferedBytes(resolved)
+                  << " bytes, over its limit of " << options.memory_limit;
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::invalid_parameter));
+    }
+  }
+  return resolved;
+}
+
 /*
 void DebugPrint(bool encrypting,
                 uint32_t chunk_num,
@@ -131,25 +210,24 @@ DataMap DecryptUsingVersion0(const Identity& parent_id, const Identity& this_id,
   }
 
   size_t inputs_size(parent_id.string().size() + this_id.string().size());
-  ByteArray enc_hash(GetNewByteArray(crypto::SHA512::DIGESTSIZE)),
-      xor_hash(GetNewByteArray(crypto::SHA512::DIGESTSIZE));
-  CryptoPP::SHA512().CalculateDigest(
-      enc_hash.get(), reinterpret_cast<const byte*>((parent_id.string() + this_id.string()).data()),
-      inputs_size);
-  CryptoPP::SHA512().CalculateDigest(
-      xor_hash.get(), reinterpret_cast<const byte*>((this_id.string() + parent_id.string()).data()),
-      inputs_size);
-
-  CryptoPP::CFB_Mode<CryptoPP::AES>::Decryption decryptor(enc_hash.get(), crypto::AES256_KeySize,
-                                                          enc_hash.get() + crypto::AES256_KeySize);
+  ByteArray enc_hash(GetNewByteArray(crypto::SHA512::DIGESTSIZE, ByteArrayFill::kUninitialised)),
+      xor_hash(GetNewByteArray(crypto::SHA512::DIGESTSIZE, ByteArrayFill::kUninitialised));
+  const CryptoBackend& backend(GetCryptoBackend());
+  backend.Sha512(reinterpret_cast<const byte*>((parent_id.string() + this_id.string()).data()),
+                 inputs_size, enc_hash.get());
+  backend.Sha512(reinterpret_cast<const byte*>((this_id.string() + parent_id.string()).data()),
+                 inputs_size, xor_hash.get());
+
+  std::string compressed(protobuf_encrypted_data_map.contents());
+  byte* compressed_data(reinterpret_cast<byte*>(&compressed[0]));
+  XorPad(xor_hash.get(), crypto::SHA512::DIGESTSIZE).Apply(compressed_data, compressed.size());
+  std::unique_ptr<StreamCipher> decryptor(backend.NewAes256CfbDecryptor());
+  decryptor->SetKeyWithIv(enc_hash.get(), enc_hash.get() + crypto::AES256_KeySize);
+  decryptor->ProcessData(compressed_data, compressed_data, compressed.size());
 
   std::string serialised_data_map;
   CryptoPP::StringSource filter(
-      protobuf_encrypted_data_map.contents(), true,
-      new XORFilter(
-          new CryptoPP::StreamTransformationFilter(
-              decryptor, new CryptoPP::Gunzip(new CryptoPP::StringSink(serialised_data_map))),
-          xor_hash.get(), crypto::SHA512::DIGESTSIZE));
+      compressed, true, new CryptoPP::Gunzip(new CryptoPP::StringSink(serialised_data_map)));
 
   DataMap data_map;
   ParseDataMap(serialised_data_map, data_map);
@@ -158,6 +236,32 @@ DataMap DecryptUsingVersion0(const Identity& parent_id, const Identity& this_id,
 
 }  // unnamed namespace
 
+SelfEncryptorOptions::SelfEncryptorOptions()
+    : parallelism(0),
+      queue_chunks(0),
+      read_cache_chunks(0),
+      read_buffer_size(0),
+      readahead_chunks(0),
+      memory_limit(0),
+      compression(),
+      executor(nullptr),
+      pipeline_buffers(0),
+      flush_window(0),
+      batch_get_from_store(),
+      spill_threshold(0),
+      chunk_cache(nullptr) {}
+
+// A chunk decrypted ahead of being read.  Guarded by read_mutex_.
+struct SelfEncryptor::PrefetchedChunk {
+  PrefetchedChunk() : data(), result(kSuccess), ready(false) {}
+  ByteArray data;
+  int result;
+  bool ready;
+};
+
+SelfEncryptor::ReadStream::ReadStream()
+    : next_position(0), last_used(0), sequential_reads(0) {}
+
 crypto::CipherText EncryptDataMap(const Identity& parent_id, const Identity& this_id,
                                   const DataMap& data_map) {
   assert(parent_id.string().size() == static_cast<size_t>(crypto::SHA512::DIGESTSIZE));
@@ -166,33 +270,32 @@ crypto::CipherText EncryptDataMap(const Identity& parent_id, const Identity& thi
   std::string serialised_data_map;
   SerialiseDataMap(data_map, serialised_data_map);
 
-  ByteArray array_data_map(GetNewByteArray(static_cast<uint32_t>(serialised_data_map.size())));
+  ByteArray array_data_map(GetNewByteArray(static_cast<uint32_t>(serialised_data_map.size()),
+                                           ByteArrayFill::kUninitialised));
   uint32_t copied(MemCopy(array_data_map, 0, serialised_data_map.c_str(), Size(array_data_map)));
   assert(Size(array_data_map) == copied);
 
   size_t inputs_size(parent_id.string().size() + this_id.string().size());
-  ByteArray enc_hash(GetNewByteArray(crypto::SHA512::DIGESTSIZE)),
-      xor_hash(GetNewByteArray(crypto::SHA512::DIGESTSIZE));
-  CryptoPP::SHA512().CalculateDigest(
-      enc_hash.get(), reinterpret_cast<const byte*>((parent_id.string() + this_id.string()).data()),
-      inputs_size);
-  CryptoPP::SHA512().CalculateDigest(
-      xor_hash.get(), reinterpret_cast<const byte*>((this_id.string() + parent_id.string()).data()),
-      inputs_size);
-
-  CryptoPP::CFB_Mode<CryptoPP::AES>::Encryption encryptor(enc_hash.get(), crypto::AES256_KeySize,
-                                                          enc_hash.get() + crypto::AES256_KeySize);
+  ByteArray enc_hash(GetNewByteArray(crypto::SHA512::DIGESTSIZE, ByteArrayFill::kUninitialised)),
+      xor_hash(GetNewByteArray(crypto::SHA512::DIGESTSIZE, ByteArrayFill::kUninitialised));
+  const CryptoBackend& backend(GetCryptoBackend());
+  backend.Sha512(reinterpret_cast<const byte*>((parent_id.string() + this_id.string()).data()),
+                 inputs_size, enc_hash.get());
+  backend.Sha512(reinterpret_cast<const byte*>((this_id.string() + parent_id.string()).data()),
+                 inputs_size, xor_hash.get());
 
   protobuf::EncryptedDataMap protobuf_encrypted_data_map;
   protobuf_encrypted_data_map.set_data_map_encryption_version(
     static_cast<uint32_t>(kDataMapEncryptionVersion));
-  CryptoPP::Gzip aes_filter(
-      new CryptoPP::StreamTransformationFilter(
-          encryptor,
-          new XORFilter(new CryptoPP::StringSink(*protobuf_encrypted_data_map.mutable_contents()),
-                        xor_hash.get(), crypto::SHA512::DIGESTSIZE)),
-      1);
-  aes_filter.Put2(array_data_map.get(), copied, -1, true);
+  std::string& contents(*protobuf_encrypted_data_map.mutable_contents());
+  CryptoPP::Gzip compressor(new CryptoPP::StringSink(contents), 1);
+  compressor.Put2(array_data_map.get(), copied, -1, true);
+
+  byte* contents_data(reinterpret_cast<byte*>(&contents[0]));
+  std::unique_ptr<StreamCipher> encryptor(backend.NewAes256CfbEncryptor());
+  encryptor->SetKeyWithIv(enc_hash.get(), enc_hash.get() + crypto::AES256_KeySize);
+  encryptor->ProcessData(contents_data, contents_data, contents.size());
+  XorPad(xor_hash.get(), crypto::SHA512::DIGESTSIZE).Apply(contents_data, contents.size());
 
   assert(!protobuf_encrypted_data_map.contents().empty());
 
@@ -224,38 +327,77 @@ DataMap DecryptDataMap(const Identity& parent_id, const Identity& this_id,
 
 SelfEncryptor::SelfEncryptor(DataMap& data_map, data_stores::DataBuffer<std::string>& buffer,
                              std::function<NonEmptyString(const std::string&)> get_from_store,
-                             int num_procs)
+                             const SelfEncryptorOptions& options)
     : data_map_(data_map),
       kOriginalDataMap_(data_map),
-      sequencer_(new Sequencer),
-      kDefaultByteArraySize_(num_procs == 0 ? kDefaultChunkSize * Concurrency()
-                                            : kDefaultChunkSize * num_procs),
+      sequencer_(new Sequencer(options.spill_threshold)),
+      kOptions_(ResolveOptions(options)),
+      kReadCacheSize_(kOptions_.read_cache_chunks * kDefaultChunkSize),
       file_size_(0),
       last_chunk_position_(0),
       truncated_file_size_(0),
       normal_chunk_size_(0),
       main_encrypt_queue_(),
       queue_start_position_(2 * kDefaultChunkSize),
-      kQueueCapacity_(kDefaultByteArraySize_ + kDefaultChunkSize),
+      kQueueCapacity_((kOptions_.queue_chunks + 1) * kDefaultChunkSize),
       retrievable_from_queue_(0),
       chunk0_raw_(),
       chunk1_raw_(),
+      old_pre_hashes_(),
+      old_pre_hashes_mutex_(),
       buffer_(buffer),
       get_from_store_(get_from_store),
+      kCompression_(
+          data_map.self_encryption_version == EncryptionAlgorithm::kSelfEncryptionVersion0
+              ? CompressionConfig(CompressionType::kGzip, 1, false)
+              : kOptions_.compression),
+      chunks_probed_(0),
+      chunks_skipped_(0),
+      bytes_skipped_(0),
+      executor_(kOptions_.executor ? *kOptions_.executor : DefaultExecutor()),
       current_position_(0),
       prepared_for_writing_(false),
       flushed_(true),
+      read_streams_(),
+      read_count_(0),
       read_cache_(),
-      cache_start_position_(0),
-      prepared_for_reading_(),
+      read_cache_index_(),
+      read_cache_bytes_(0),
+      read_cache_hits_(0),
+      read_cache_misses_(0),
+      read_cache_evictions_(0),
       read_buffer_(),
       buffer_activated_(false),
       buffer_length_(0),
       last_read_position_(0),
-      kMaxBufferSize_(20 * kDefaultByteArraySize_),
-      data_mutex_() {
-  if (data_map.self_encryption_version != EncryptionAlgorithm::kSelfEncryptionVersion0)
+      data_mutex_(),
+      spare_queues_(),
+      queues_in_flight_(0),
+      pipeline_result_(kSuccess),
+      pipeline_mutex_(),
+      pipeline_condition_(),
+      prefetched_chunks_(),
+      readahead_window_(kMinReadaheadChunks),
+      prefetches_in_flight_(0),
+      read_mutex_(),
+      readahead_condition_(),
+      buffer_mutex_(),
+      async_operations_(),
+      async_running_(false),
+      async_handler_thread_(),
+      async_destroyed_(nullptr),
+      async_mutex_(),
+      async_condition_() {
+  if (data_map.self_encryption_version != EncryptionAlgorithm::kSelfEncryptionVersion0 &&
+      data_map.self_encryption_version != EncryptionAlgorithm::kSelfEncryptionVersion1 &&
+      data_map.self_encryption_version != EncryptionAlgorithm::kSelfEncryptionVersion2) {
     BOOST_THROW_EXCEPTION(MakeError(EncryptErrors::invalid_encryption_version));
+  }
+  if (!CompressionSupported(kCompression_.type)) {
+    LOG(kError) << "Compression type " << static_cast<uint32_t>(kCompression_.type)
+                << " isn't supported by this build.";
+    BOOST_THROW_EXCEPTION(MakeError(CommonErrors::invalid_parameter));
+  }
   if (!get_from_store) {
     LOG(kError) << "Need to have a non-null get_from_store functor.";
     BOOST_THROW_EXCEPTION(MakeError(CommonErrors::invalid_parameter));
@@ -269,23 +411,81 @@ SelfEncryptor::SelfEncryptor(DataMap& data_map, data_stores::DataBuffer<std::str
     for (auto it(data_map.chunks.begin()); it != penultimate; ++it)
       file_size_ += (*it).size;
     last_chunk_position_ = file_size_;
-    file_size_ += (*data_map.chunks.rbegin()).size;
-    normal_chunk_size_ = (*data_map.chunks.begin()).size;
+    file_size_ += data_map.chunks.back().size;
+    normal_chunk_size_ = data_map.chunks.front().size;
   }
 }
 
 SelfEncryptor::~SelfEncryptor() {
   SCOPED_PROFILE
+  {
+    std::unique_lock<std::mutex> lock(async_mutex_);
+    if (async_running_ && async_handler_thread_ == std::this_thread::get_id()) {
+      // Destroyed by the completion handler of the last queued call, so there is nothing left to
+      // wait for.  RunNextAsync is told not to touch this again once the handler returns.
+      *async_destroyed_ = true;
+    } else {
+      WaitFor(&lock, &async_condition_, [this] { return !async_running_; });
+    }
+  }
+  DiscardReadahead();
   if (truncated_file_size_ > file_size_)
     AppendNulls(truncated_file_size_);
   Flush();
 }
 
+CompressionStatistics SelfEncryptor::compression_statistics() const {
+  CompressionStatistics statistics;
+  statistics.chunks_probed = chunks_probed_;
+  statistics.chunks_skipped = chunks_skipped_;
+  statistics.bytes_skipped = bytes_skipped_;
+  return statistics;
+}
+
+ReadCacheStatistics SelfEncryptor::read_cache_statistics() const {
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  ReadCacheStatistics statistics;
+  statistics.hits = read_cache_hits_;
+  statistics.misses = read_cache_misses_;
+  statistics.evictions = read_cache_evictions_;
+  statistics.bytes_held = read_cache_bytes_;
+  return statistics;
+}
+
+uint64_t SelfEncryptor::memory_usage() const {
+  uint64_t usage(Size(main_encrypt_queue_) + Size(chunk0_raw_) + Size(chunk1_raw_) +
+                 sequencer_->memory_size());
+  {
+    std::lock_guard<std::mutex> lock(pipeline_mutex_);
+    usage += static_cast<uint64_t>(queues_in_flight_) * kQueueCapacity_;
+    for (const auto& queue : spare_queues_)
+      usage += Size(queue);
+  }
+  {
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    usage += read_cache_bytes_;
+    for (const auto& entry : prefetched_chunks_)
+      usage += entry.second->ready ? Size(entry.second->data) : kDefaultChunkSize;
+  }
+  std::lock_guard<std::mutex> lock(buffer_mutex_);
+  return usage + Size(read_buffer_);
+}
+
 bool SelfEncryptor::Write(const char* data, uint32_t length, uint64_t position) {
   SCOPED_PROFILE
   if (length == 0)
     return true;
 
+  DiscardReadahead();
+  // Background batches read the pre-hashes of chunks 0 and 1 and of the chunks before them, so
+  // anything other than appending to the queue waits for them to finish.
+  int pipeline_result(CollectPipelineResult(position < 2 * kDefaultChunkSize ||
+                                            position < queue_start_position_));
+  if (pipeline_result != kSuccess) {
+    LOG(kError) << "Background encryption failed: " << pipeline_result;
+    return false;
+  }
+
   if (PrepareToWrite(length, position) != kSuccess) {
     LOG(kError) << "Failed to write " << length << " bytes at position " << position;
     return false;
@@ -302,33 +502,37 @@ bool SelfEncryptor::Write(const char* data, uint32_t length, uint64_t position)
   if (data_in_queue) {
     uint32_t seq_length(write_length);
     if (data_offset != 0 && GetLengthForSequencer(write_position, &seq_length)) {
-      if (sequencer_->Add(data + written, seq_length, write_position) != kSuccess) {
+      if (AddToSequencer(data + written, seq_length, write_position) != kSuccess) {
         LOG(kError) << "Failed to write " << length << " bytes at position " << position;
         return false;
       }
     }
     assert(data_map_.chunks.size() >= 2);
-    bool modified(false);
-    CalculatePreHash(0, chunk0_raw_.get(), normal_chunk_size_, &modified);
-    if (modified)
-      data_map_.chunks[0].size = 0;
-    CalculatePreHash(1, chunk1_raw_.get(), normal_chunk_size_, &modified);
-    if (modified)
-      data_map_.chunks[1].size = 0;
+    // Until the file is three chunks long, chunks 0 and 1 aren't needed by the queue and their size
+    // keeps changing, so they're left for Flush to pre-hash.
+    if (normal_chunk_size_ == kDefaultChunkSize) {
+      bool modified(false);
+      CalculatePreHash(0, chunk0_raw_.get(), normal_chunk_size_, &modified);
+      if (modified)
+        data_map_.chunks[0].size = 0;
+      CalculatePreHash(1, chunk1_raw_.get(), normal_chunk_size_, &modified);
+      if (modified)
+        data_map_.chunks[1].size = 0;
+    }
     if (PutToEncryptQueue(data + written, write_length, data_offset, queue_offset) != kSuccess) {
       LOG(kError) << "Failed to write " << length << " bytes at position " << position;
       return false;
     }
   } else if (GetLengthForSequencer(write_position, &write_length)) {
-    if (sequencer_->Add(data + written, write_length, write_position) != kSuccess) {
+    if (AddToSequencer(data + written, write_length, write_position) != kSuccess) {
       LOG(kError) << "Failed to write " << length << " bytes at position " << position;
       return false;
     }
   }
 
-  std::pair<uint64_t, ByteArray> next_seq_block(sequencer_->PeekBeyond(queue_start_position_));
+  SequenceBlockExtent next_seq_block(sequencer_->PeekBeyond(queue_start_position_));
   while (next_seq_block.first < queue_start_position_ + kQueueCapacity_) {
-    ByteArray extra(sequencer_->Get(next_seq_block.first));
+    SequencePiece extra(sequencer_->Get(next_seq_block.first));
     assert(extra);
     uint32_t extra_offset(0);
     if (next_seq_block.first < current_position_) {
@@ -362,7 +566,8 @@ int SelfEncryptor::PrepareToWrite(uint32_t length, uint64_t position) {
     return kSuccess;
 
   if (!main_encrypt_queue_) {
-    main_encrypt_queue_ = GetNewByteArray(kQueueCapacity_);
+    main_encrypt_queue_ =
+        GetNewByteArray(kQueueCapacity_, ByteArrayFill::kZeroed, ByteArrayBacking::kHugePages);
     if (position > queue_start_position_ && last_chunk_position_ > 2 * kDefaultChunkSize) {
       queue_start_position_ =
           std::min(last_chunk_position_, (position / kDefaultChunkSize) * kDefaultChunkSize);
@@ -379,33 +584,54 @@ int SelfEncryptor::PrepareToWrite(uint32_t length, uint64_t position) {
 
   if (!data_map_.chunks.empty()) {
     assert(data_map_.chunks.empty() || data_map_.chunks.size() >= 3);
-    ByteArray temp(GetNewByteArray(kDefaultChunkSize + 1));
-    uint32_t chunks_to_decrypt(std::min((kQueueCapacity_ / kDefaultChunkSize) + 2,
-                                        static_cast<uint32_t>(data_map_.chunks.size())));
-    bool consumed_whole_chunk(true);
-    uint64_t pos(0);
+    ByteArray temp(
+        GetNewByteArray(kDefaultChunkSize + kMinChunkSize, ByteArrayFill::kUninitialised));
+    // The chunks copied into chunk0_raw_ and chunk1_raw_, and those the queue covers, which needn't
+    // follow on from them if the first write is further into the file.
+    const uint64_t kQueueEnd(queue_start_position_ + kQueueCapacity_);
+    std::vector<uint32_t> chunk_nums;
+    std::vector<uint64_t> chunk_positions;
+    uint64_t chunk_position(0);
+    for (uint32_t i(0); i != data_map_.chunks.size() && chunk_position < kQueueEnd; ++i) {
+      uint64_t chunk_end(chunk_position + data_map_.chunks[i].size);
+      if (chunk_position < 2 * kDefaultChunkSize || chunk_end > queue_start_position_) {
+        chunk_nums.push_back(i);
+        chunk_positions.push_back(chunk_position);
+      }
+      chunk_position = chunk_end;
+    }
     uint32_t copied_to_queue(0);
-    for (uint32_t i(0); i != chunks_to_decrypt; ++i) {
-      int result(DecryptChunk(i, temp.get()));
+    std::vector<NonEmptyString> contents;
+    FetchStoredChunks(chunk_nums, &contents);
+    for (size_t i(0); i != chunk_nums.size(); ++i) {
+      int result(DecryptChunk(chunk_nums[i], temp.get(), &contents[i]));
       if (result != kSuccess) {
         LOG(kError) << "Failed to prepare for writing.";
         return result;
       }
-      uint32_t len(data_map_.chunks[i].size);
+      uint32_t len(data_map_.chunks[chunk_nums[i]].size);
+      uint64_t pos(chunk_positions[i]);
       uint32_t written = PutToInitialChunks(reinterpret_cast<char*>(temp.get()), &len, &pos);
-      consumed_whole_chunk = (len == 0);
-
-      if (!consumed_whole_chunk) {
-        uint32_t copied = MemCopy(main_encrypt_queue_, copied_to_queue, temp.get() + written, len);
-        assert(len == copied);
-        copied_to_queue += copied;
+      uint64_t begin(std::max(pos, queue_start_position_));
+      uint64_t end(std::min(pos + len, kQueueEnd));
+      if (begin < end) {
+        uint32_t queue_offset(static_cast<uint32_t>(begin - queue_start_position_));
+        uint32_t copy_size(static_cast<uint32_t>(end - begin));
+        uint32_t copied = MemCopy(main_encrypt_queue_, queue_offset,
+                                  temp.get() + written + (begin - pos), copy_size);
+        assert(copy_size == copied);
+        copied_to_queue = queue_offset + copied;
       }
     }
+    // The stored pre-hashes still hold unless the file has grown into a different chunk size.
+    const ChunkDetails::PreHashState kInitialChunkState(
+        data_map_.chunks[0].size == normal_chunk_size_ ? ChunkDetails::kOk
+                                                       : ChunkDetails::kOutdated);
     data_map_.chunks[0].size = 0;
-    data_map_.chunks[0].pre_hash_state = ChunkDetails::kOk;
+    data_map_.chunks[0].pre_hash_state = kInitialChunkState;
     data_map_.chunks[1].size = 0;
-    data_map_.chunks[1].pre_hash_state = ChunkDetails::kOk;
-    if (chunks_to_decrypt == 3) {
+    data_map_.chunks[1].pre_hash_state = kInitialChunkState;
+    if (data_map_.chunks.size() == 3) {
       current_position_ = queue_start_position_ + copied_to_queue;
       retrievable_from_queue_ = copied_to_queue;
       data_map_.chunks[2].pre_hash_state = ChunkDetails::kOutdated;
@@ -427,20 +653,17 @@ int SelfEncryptor::PrepareToWrite(uint32_t length, uint64_t position) {
 
 void SelfEncryptor::PutToReadCache(const char* data, uint32_t length, uint64_t position) {
   SCOPED_PROFILE
-  if (!prepared_for_reading_)
-    return;
-  if (position < cache_start_position_ + kDefaultByteArraySize_ &&
-      position + length >= cache_start_position_) {
-    uint32_t data_offset(0), cache_offset(0);
-    uint32_t copy_size(length);
-    if (position < cache_start_position_) {
-      data_offset = static_cast<uint32_t>(cache_start_position_ - position);
-      copy_size -= data_offset;
-    } else {
-      cache_offset = static_cast<uint32_t>(position - cache_start_position_);
-    }
-    copy_size = std::min(copy_size, kDefaultByteArraySize_ - cache_offset);
-    memcpy(read_cache_.get() + cache_offset, data + data_offset, copy_size);
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  uint64_t end(position + length);
+  auto itr(read_cache_index_.lower_bound(static_cast<uint32_t>(position / kDefaultChunkSize)));
+  for (; itr != read_cache_index_.end(); ++itr) {
+    uint64_t chunk_start(static_cast<uint64_t>((*itr).first) * kDefaultChunkSize);
+    if (chunk_start >= end)
+      break;
+    uint64_t begin(std::max(position, chunk_start));
+    uint64_t copy_end(std::min(end, chunk_start + kDefaultChunkSize));
+    memcpy((*(*itr).second).second->get() + (begin - chunk_start), data + (begin - position),
+           static_cast<size_t>(copy_end - begin));
   }
 }
 
@@ -458,25 +681,35 @@ void SelfEncryptor::PutToReadBuffer(const char* data, uint32_t length, uint64_t
 
 void SelfEncryptor::CalculateSizes(bool force) {
   SCOPED_PROFILE
+  const uint32_t kOldNormalChunkSize(normal_chunk_size_);
   if (normal_chunk_size_ != kDefaultChunkSize || force) {
     if (file_size_ < 3 * kMinChunkSize) {
       normal_chunk_size_ = 0;
       last_chunk_position_ = std::numeric_limits<uint64_t>::max();
-      return;
     } else if (file_size_ < 3 * kDefaultChunkSize) {
       normal_chunk_size_ = static_cast<uint32_t>(file_size_) / 3;
       last_chunk_position_ = 2 * normal_chunk_size_;
-      return;
+    } else {
+      normal_chunk_size_ = kDefaultChunkSize;
     }
-    normal_chunk_size_ = kDefaultChunkSize;
   }
 
-  assert(kDefaultChunkSize > 0);
-  uint64_t chunk_count_excluding_last = file_size_ / kDefaultChunkSize;
+  if (normal_chunk_size_ == kDefaultChunkSize) {
+    assert(kDefaultChunkSize > 0);
+    uint64_t chunk_count_excluding_last = file_size_ / kDefaultChunkSize;
+    if (file_size_ % kDefaultChunkSize < kMinChunkSize)
+      --chunk_count_excluding_last;
+    last_chunk_position_ = chunk_count_excluding_last * kDefaultChunkSize;
+  }
 
-  if (file_size_ % kDefaultChunkSize < kMinChunkSize)
-    --chunk_count_excluding_last;
-  last_chunk_position_ = chunk_count_excluding_last * kDefaultChunkSize;
+  // Chunks 0 and 1 span different bytes once the chunk size changes, so their pre-hashes are
+  // calculated afresh.
+  if (normal_chunk_size_ != kOldNormalChunkSize) {
+    for (uint32_t i(0); i != std::min(2U, static_cast<uint32_t>(data_map_.chunks.size())); ++i) {
+      if (data_map_.chunks[i].pre_hash_state == ChunkDetails::kOk)
+        data_map_.chunks[i].pre_hash_state = ChunkDetails::kOutdated;
+    }
+  }
 }
 
 uint32_t SelfEncryptor::PutToInitialChunks(const char* data, uint32_t* length, uint64_t* position) {
@@ -568,7 +801,7 @@ int SelfEncryptor::PutToEncryptQueue(const char* data, uint32_t length, uint32_t
     }
     data_offset += copy_length;
     length -= copy_length;
-    copy_length = std::min(length, kDefaultByteArraySize_);
+    copy_length = std::min(length, kQueueCapacity_ - queue_offset);
   }
   return kSuccess;
 }
@@ -588,7 +821,25 @@ bool SelfEncryptor::GetLengthForSequencer(uint64_t position, uint32_t* length) {
   return (position > queue_start_position_ + retrievable_from_queue_);
 }
 
-int SelfEncryptor::DecryptChunk(uint32_t chunk_num, byte* data) {
+int SelfEncryptor::AddToSequencer(const char* data, uint32_t length, uint64_t position) {
+  SCOPED_PROFILE
+  // With spilling, the sequencer holds no more than spill_threshold, which is counted already.
+  if (kOptions_.memory_limit != 0 && kOptions_.spill_threshold == 0 &&
+      BufferedBytes(kOptions_) + sequencer_->size() + length > kOptions_.memory_limit) {
+    LOG(kError) << "Holding " << length << " more bytes written out of order would exceed the "
+                << "memory limit of " << kOptions_.memory_limit;
+    return kMemoryLimitExceeded;
+  }
+  return sequencer_->Add(data, length, position);
+}
+
+int SelfEncryptor::DecryptChunk(uint32_t chunk_num, byte* data, const NonEmptyString* content) {
+  uint32_t length(chunk_num < data_map_.chunks.size() ? data_map_.chunks[chunk_num].size : 0);
+  return DecryptChunk(chunk_num, 0, length == 0 ? normal_chunk_size_ : length, data, content);
+}
+
+int SelfEncryptor::DecryptChunk(uint32_t chunk_num, uint32_t offset, uint32_t count, byte* data,
+                                const NonEmptyString* content) {
   SCOPED_PROFILE
   if (data_map_.chunks.size() <= chunk_num) {
     LOG(kWarning) << "Can't decrypt chunk " << chunk_num << " of " << data_map_.chunks.size();
@@ -597,83 +848,163 @@ int SelfEncryptor::DecryptChunk(uint32_t chunk_num, byte* data) {
 
   uint32_t length = data_map_.chunks[chunk_num].size;
   if (length == 0) {  // Chunk hasn't been encrypted yet
-    memset(data, 0, normal_chunk_size_);
+    memset(data, 0, count);
     return kSuccess;
   }
+  assert(static_cast<uint64_t>(offset) + count <= length);
 
-  ByteArray pad(GetNewByteArray(kPadSize));
-  ByteArray key(GetNewByteArray(crypto::AES256_KeySize));
-  ByteArray iv(GetNewByteArray(crypto::AES256_IVSize));
+  ChunkSecrets& secrets(GetChunkSecrets());
+  ByteArray& pad(secrets.pad);
+  ByteArray& key(secrets.key);
+  ByteArray& iv(secrets.iv);
   GetPadIvKey(chunk_num, key, iv, pad, false);
-  NonEmptyString content;
-  try {
-    content = buffer_.Get(data_map_.chunks[chunk_num].hash);
-  }
-  catch (...) {
-    LOG(kInfo) << "Failed to get data for " << HexSubstr(data_map_.chunks[chunk_num].hash)
-                << " from buffer, trying functor.";
+  if (!kOptions_.chunk_cache)
+    return DecodeStoredChunk(chunk_num, key, iv, pad, offset, count, data, content);
+
+  // The whole chunk is decrypted into the cache, or found there, and the range copied out.
+  std::shared_ptr<const ByteArray> plaintext;
+  int result(kOptions_.chunk_cache->Get(ChunkCacheKey(chunk_num, key, iv, pad), length,
+                                        [&](byte* output) {
+    return DecodeStoredChunk(chunk_num, key, iv, pad, 0, length, output, content);
+  }, &plaintext));
+  if (result != kSuccess)
+    return result;
+  memcpy(data, plaintext->get() + offset, count);
+  return kSuccess;
+}
+
+int SelfEncryptor::DecodeStoredChunk(uint32_t chunk_num, const ByteSpan& key, const ByteSpan& iv,
+                                     const ByteSpan& pad, uint32_t offset, uint32_t count,
+                                     byte* data, const NonEmptyString* content) {
+  SCOPED_PROFILE
+  uint32_t length = data_map_.chunks[chunk_num].size;
+  NonEmptyString fetched;
+  if (!content || !content->IsInitialised()) {
     try {
-      content = get_from_store_(data_map_.chunks[chunk_num].hash);
+      fetched = buffer_.Get(data_map_.chunks[chunk_num].hash);
     }
-    catch(const std::exception& e) {
-      LOG(kError) << "Failed to get data for " << HexSubstr(data_map_.chunks[chunk_num].hash)
-                  << " - " << e.what();
-      return kMissingChunk;
+    catch (...) {
+      LOG(kInfo) << "Failed to get data for " << HexSubstr(data_map_.chunks[chunk_num].hash)
+                  << " from buffer, trying functor.";
+      try {
+        fetched = get_from_store_(data_map_.chunks[chunk_num].hash);
+      }
+      catch(const std::exception& e) {
+        LOG(kError) << "Failed to get data for " << HexSubstr(data_map_.chunks[chunk_num].hash)
+                    << " - " << e.what();
+        return kMissingChunk;
+      }
     }
+    content = &fetched;
   }
 
-  if (content.string().empty()) {
+  if (content->string().empty()) {
     LOG(kError) << "Could not find chunk number " << chunk_num << ", hash "
                 << Base64Substr(data_map_.chunks[chunk_num].hash);
     return kMissingChunk;
   }
 
-  try {
-    CryptoPP::CFB_Mode<CryptoPP::AES>::Decryption decryptor(key.get(), crypto::AES256_KeySize,
-                                                            iv.get());
-    CryptoPP::StringSource filter(
-        content.string(), true, new XORFilter(
-            new CryptoPP::StreamTransformationFilter(
-                decryptor,
-                new CryptoPP::Gunzip(new CryptoPP::MessageQueue)),
-            pad.get()));
-    filter.Get(data, length);
-  }
-  catch (const std::exception& e) {
-    LOG(kError) << e.what();
-    return kDecryptionException;
+  int result(DecodeChunkRange(reinterpret_cast<const byte*>(content->string().data()),
+                              content->string().size(), data_map_.chunks[chunk_num].compression,
+                              key.get(), iv.get(), pad.get(), length, offset, data, count));
+  if (result != kSuccess) {
+    LOG(kError) << "Failed to decrypt chunk " << chunk_num;
+    return result;
   }
 //  DebugPrint(false, chunk_num, pad, key, iv, data, length, content);
 
   return kSuccess;
 }
 
-void SelfEncryptor::GetPadIvKey(uint32_t this_chunk_num, ByteArray key, ByteArray iv, ByteArray pad,
+std::string SelfEncryptor::ChunkCacheKey(uint32_t chunk_num, const ByteSpan& key,
+                                         const ByteSpan& iv, const ByteSpan& pad) const {
+  // The secrets themselves aren't kept in the key, only a hash of them.
+  ConstChunkDetailsRef chunk(data_map_.chunks[chunk_num]);
+  byte secrets[crypto::AES256_KeySize + crypto::AES256_IVSize + kPadSize];
+  memcpy(secrets, key.get(), crypto::AES256_KeySize);
+  memcpy(secrets + crypto::AES256_KeySize, iv.get(), crypto::AES256_IVSize);
+  memcpy(secrets + crypto::AES256_KeySize + crypto::AES256_IVSize, pad.get(), kPadSize);
+  std::string cache_key(chunk.hash.string());
+  cache_key.resize(kChunkHashSize + crypto::SHA512::DIGESTSIZE + sizeof(chunk.size) + 1);
+  byte* digest(reinterpret_cast<byte*>(&cache_key[kChunkHashSize]));
+  GetCryptoBackend().Sha512(secrets, sizeof(secrets), digest);
+  memcpy(digest + crypto::SHA512::DIGESTSIZE, &chunk.size, sizeof(chunk.size));
+  cache_key.back() = static_cast<char>(chunk.compression);
+  return cache_key;
+}
+
+bool SelfEncryptor::InChunkCache(uint32_t chunk_num) {
+  ChunkSecrets& secrets(GetChunkSecrets());
+  GetPadIvKey(chunk_num, secrets.key, secrets.iv, secrets.pad, false);
+  return kOptions_.chunk_cache->Contains(
+      ChunkCacheKey(chunk_num, secrets.key, secrets.iv, secrets.pad));
+}
+
+void SelfEncryptor::FetchStoredChunks(const std::vector<uint32_t>& chunk_nums,
+                                      std::vector<NonEmptyString>* contents) {
+  SCOPED_PROFILE
+  contents->assign(chunk_nums.size(), NonEmptyString());
+  if (!kOptions_.batch_get_from_store)
+    return;
+
+  std::vector<std::string> names;
+  std::vector<size_t> indices;
+  for (size_t i(0); i != chunk_nums.size(); ++i) {
+    ConstChunkDetailsRef chunk(data_map_.chunks[chunk_nums[i]]);
+    if (chunk.size == 0 || (kOptions_.chunk_cache && InChunkCache(chunk_nums[i])))
+      continue;
+    try {
+      (*contents)[i] = buffer_.Get(chunk.hash);
+    }
+    catch (...) {
+      names.push_back(chunk.hash);
+      indices.push_back(i);
+    }
+  }
+  if (names.empty())
+    return;
+
+  try {
+    std::vector<NonEmptyString> fetched(kOptions_.batch_get_from_store(names).get());
+    if (fetched.size() != names.size()) {
+      LOG(kWarning) << "Batched fetch returned " << fetched.size() << " of " << names.size()
+                    << " chunks.";
+      return;
+    }
+    for (size_t i(0); i != indices.size(); ++i)
+      (*contents)[indices[i]] = std::move(fetched[i]);
+  }
+  catch (const std::exception& e) {
+    LOG(kWarning) << "Batched fetch of " << names.size() << " chunks failed - " << e.what();
+  }
+}
+
+void SelfEncryptor::GetPadIvKey(uint32_t this_chunk_num, ByteSpan key, ByteSpan iv, ByteSpan pad,
                                 bool writing) {
   SCOPED_PROFILE
-  uint32_t num_chunks = static_cast<uint32_t>(data_map_.chunks.size());
-  uint32_t n_1_chunk = (this_chunk_num + num_chunks - 1) % num_chunks;
-  uint32_t n_2_chunk = (this_chunk_num + num_chunks - 2) % num_chunks;
-
-  const byte* n_1_pre_hash = data_map_.chunks[this_chunk_num].old_n1_pre_hash.get();
-  const byte* n_2_pre_hash = data_map_.chunks[this_chunk_num].old_n2_pre_hash.get();
-  if (writing) {
-    if (!n_1_pre_hash) {
-      assert(!n_2_pre_hash);
-      data_map_.chunks[this_chunk_num].old_n1_pre_hash.reset(new byte[crypto::SHA512::DIGESTSIZE]);
-      data_map_.chunks[this_chunk_num].old_n2_pre_hash.reset(new byte[crypto::SHA512::DIGESTSIZE]);
-    }
-    n_1_pre_hash = &data_map_.chunks[n_1_chunk].pre_hash[0];
-    n_2_pre_hash = &data_map_.chunks[n_2_chunk].pre_hash[0];
-    memcpy(data_map_.chunks[this_chunk_num].old_n1_pre_hash.get(), n_1_pre_hash,
-           crypto::SHA512::DIGESTSIZE);
-    memcpy(data_map_.chunks[this_chunk_num].old_n2_pre_hash.get(), n_2_pre_hash,
-           crypto::SHA512::DIGESTSIZE);
-  } else {
-    if (!n_1_pre_hash) {
-      assert(!n_2_pre_hash);
-      n_1_pre_hash = &data_map_.chunks[n_1_chunk].pre_hash[0];
-      n_2_pre_hash = &data_map_.chunks[n_2_chunk].pre_hash[0];
+  // Only chunks 0 and 1 wrap around to the end of the file.  Later ones don't read the chunk count,
+  // which the writing thread may be growing while a pipelined batch is encrypted.
+  uint32_t n_1_chunk(this_chunk_num - 1), n_2_chunk(this_chunk_num - 2);
+  if (this_chunk_num < 2) {
+    uint32_t num_chunks = static_cast<uint32_t>(data_map_.chunks.size());
+    n_1_chunk = (this_chunk_num + num_chunks - 1) % num_chunks;
+    n_2_chunk = (this_chunk_num + num_chunks - 2) % num_chunks;
+  }
+
+  const byte* n_1_pre_hash = &data_map_.chunks[n_1_chunk].pre_hash[0];
+  const byte* n_2_pre_hash = &data_map_.chunks[n_2_chunk].pre_hash[0];
+  std::array<byte, 2 * kChunkHashSize> old_pre_hashes;
+  {
+    std::lock_guard<std::mutex> old_pre_hashes_guard(old_pre_hashes_mutex_);
+    auto itr(old_pre_hashes_.find(this_chunk_num));
+    if (itr != old_pre_hashes_.end()) {
+      if (writing) {
+        old_pre_hashes_.erase(itr);
+      } else {
+        old_pre_hashes = (*itr).second;
+        n_1_pre_hash = &old_pre_hashes[0];
+        n_2_pre_hash = &old_pre_hashes[kChunkHashSize];
+      }
     }
   }
 
@@ -709,94 +1040,192 @@ int SelfEncryptor::ProcessMainQueue() {
 
   uint32_t first_queue_chunk_index =
       static_cast<uint32_t>(queue_start_position_ / kDefaultChunkSize);
-  data_map_.chunks.resize(std::max(static_cast<uint32_t>(data_map_.chunks.size()),
-                                    first_queue_chunk_index + chunks_to_process));
-#ifdef MAIDSAFE_OMP_ENABLED
-#pragma omp parallel for
-#endif
-  for (int64_t i = 0; i < chunks_to_process; ++i) {
-    bool modified(false);
-    uint32_t chunk_index(first_queue_chunk_index + static_cast<uint32_t>(i));
-    data_map_.chunks[chunk_index].pre_hash_state = ChunkDetails::kOutdated;
-    CalculatePreHash(chunk_index,
-                     main_encrypt_queue_.get() + (static_cast<uint32_t>(i) * kDefaultChunkSize),
-                     kDefaultChunkSize, &modified);
-    if (modified)
-      DeleteChunk(chunk_index);
+  const uint32_t kChunkCount(first_queue_chunk_index + chunks_to_process);
+  if (kChunkCount > data_map_.chunks.size()) {
+    // Batches still being encrypted in the background refer into the chunk vector.
+    if (kChunkCount > data_map_.chunks.capacity()) {
+      int result(CollectPipelineResult(true));
+      if (result != kSuccess)
+        return result;
+    }
+    data_map_.chunks.resize(kChunkCount);
   }
-
   int64_t first_chunk_index(0);
   if (data_map_.chunks[first_queue_chunk_index - 1].pre_hash_state == ChunkDetails::kEmpty ||
       data_map_.chunks[first_queue_chunk_index - 2].pre_hash_state == ChunkDetails::kEmpty) {
-    sequencer_->Add(reinterpret_cast<char*>(main_encrypt_queue_.get()), kDefaultChunkSize,
-                    queue_start_position_);
-    sequencer_->Add(reinterpret_cast<char*>(main_encrypt_queue_.get() + kDefaultChunkSize),
-                    kDefaultChunkSize, queue_start_position_ + kDefaultChunkSize);
+    // Room for these two chunks is reserved in BufferedBytes, so they bypass the memory limit.
+    char* queue(reinterpret_cast<char*>(main_encrypt_queue_.get()));
+    int result(sequencer_->Add(queue, kDefaultChunkSize, queue_start_position_));
+    if (result == kSuccess) {
+      result = sequencer_->Add(queue + kDefaultChunkSize, kDefaultChunkSize,
+                               queue_start_position_ + kDefaultChunkSize);
+    }
+    if (result != kSuccess) {
+      LOG(kError) << "Failed to park the first two queued chunks in the sequencer.";
+      return result;
+    }
     first_chunk_index = 2;
   }
 
-  int result(kSuccess);
-#ifdef MAIDSAFE_OMP_ENABLED
-#pragma omp parallel for
-#endif
-  for (int64_t i = first_chunk_index; i < chunks_to_process; ++i) {
-    int res(EncryptChunk(first_queue_chunk_index + static_cast<uint32_t>(i),
-                         main_encrypt_queue_.get() + (i * kDefaultChunkSize), kDefaultChunkSize));
-    if (res != kSuccess) {
-      std::lock_guard<std::mutex> guard(data_mutex_);
-      LOG(kError) << "Failed processing main queue at chunk " << first_queue_chunk_index + i;
-      result = res;
-    }
+  std::vector<const byte*> chunk_data(chunks_to_process);
+  std::unique_ptr<bool[]> modified(new bool[chunks_to_process]);
+  for (uint32_t i(0); i != chunks_to_process; ++i) {
+    chunk_data[i] = main_encrypt_queue_.get() + (i * kDefaultChunkSize);
+    data_map_.chunks[first_queue_chunk_index + i].pre_hash_state = ChunkDetails::kOutdated;
+  }
+  CalculatePreHashes(first_queue_chunk_index, &chunk_data[0], kDefaultChunkSize, chunks_to_process,
+                     modified.get());
+  for (uint32_t i(0); i != chunks_to_process; ++i) {
+    if (modified[i])
+      DeleteChunk(first_queue_chunk_index + i);
   }
 
+  uint32_t start_point(chunks_to_process * kDefaultChunkSize);
+  uint32_t move_size(retrievable_from_queue_ - start_point);
+  if (kOptions_.pipeline_buffers > 1 && move_size <= start_point)
+    return EncryptQueueInBackground(first_queue_chunk_index, first_chunk_index, chunks_to_process);
+
+  int result(EncryptQueuedChunks(main_encrypt_queue_.get(), first_queue_chunk_index,
+                                 first_chunk_index, chunks_to_process));
   if (result == kSuccess && chunks_to_process > 0) {
-    uint32_t start_point(chunks_to_process * kDefaultChunkSize);
-    uint32_t move_size(retrievable_from_queue_ - start_point);
     if (start_point < move_size)
       return result;
     uint32_t copied =
         MemCopy(main_encrypt_queue_, 0, main_encrypt_queue_.get() + start_point, move_size);
     assert(move_size == copied);
     static_cast<void>(copied);
-    queue_start_position_ += (chunks_to_process * kDefaultChunkSize);
-    retrievable_from_queue_ -= (chunks_to_process * kDefaultChunkSize);
+    queue_start_position_ += start_point;
+    retrievable_from_queue_ -= start_point;
     memset(main_encrypt_queue_.get() + retrievable_from_queue_, 0,
            kQueueCapacity_ - retrievable_from_queue_);
   }
   return result;
 }
 
+int SelfEncryptor::EncryptQueuedChunks(byte* queue, uint32_t first_queue_chunk_index,
+                                       int64_t first, int64_t end) {
+  int result(kSuccess);
+  executor_.ParallelFor(first, end, [&](int64_t i) {
+    int res(EncryptChunk(first_queue_chunk_index + static_cast<uint32_t>(i),
+                         queue + (i * kDefaultChunkSize), kDefaultChunkSize));
+    if (res != kSuccess) {
+      std::lock_guard<std::mutex> guard(data_mutex_);
+      LOG(kError) << "Failed processing main queue at chunk " << first_queue_chunk_index + i;
+      result = res;
+    }
+  });
+  return result;
+}
+
+int SelfEncryptor::EncryptQueueInBackground(uint32_t first_queue_chunk_index, int64_t first,
+                                            uint32_t chunks_to_process) {
+  SCOPED_PROFILE
+  ByteArray next_queue;
+  {
+    // Backpressure: wait while every other queue is still being encrypted.
+    std::unique_lock<std::mutex> lock(pipeline_mutex_);
+    WaitFor(&lock, &pipeline_condition_,
+            [this] { return queues_in_flight_ + 1 < kOptions_.pipeline_buffers; });
+    if (!spare_queues_.empty()) {
+      next_queue = std::move(spare_queues_.back());
+      spare_queues_.pop_back();
+    }
+  }
+  if (!next_queue) {
+    next_queue = GetNewByteArray(kQueueCapacity_, ByteArrayFill::kUninitialised,
+                                 ByteArrayBacking::kHugePages);
+  }
+
+  // The partial chunk at the end of the full queue starts the next one.
+  uint32_t start_point(chunks_to_process * kDefaultChunkSize);
+  uint32_t move_size(retrievable_from_queue_ - start_point);
+  memcpy(next_queue.get(), main_encrypt_queue_.get() + start_point, move_size);
+  memset(next_queue.get() + move_size, 0, kQueueCapacity_ - move_size);
+  std::shared_ptr<ByteArray> full_queue(
+      std::make_shared<ByteArray>(std::move(main_encrypt_queue_)));
+  main_encrypt_queue_ = std::move(next_queue);
+  queue_start_position_ += start_point;
+  retrievable_from_queue_ -= start_point;
+
+  {
+    std::lock_guard<std::mutex> lock(pipeline_mutex_);
+    ++queues_in_flight_;
+  }
+  executor_.Post([this, full_queue, first_queue_chunk_index, first, chunks_to_process] {
+    int result(kEncryptionException);
+    try {
+      result = EncryptQueuedChunks(full_queue->get(), first_queue_chunk_index, first,
+                                   chunks_to_process);
+    }
+    catch (const std::exception& e) {
+      LOG(kError) << "Failed encrypting queued chunks: " << e.what();
+    }
+    std::lock_guard<std::mutex> lock(pipeline_mutex_);
+    if (result != kSuccess && pipeline_result_ == kSuccess)
+      pipeline_result_ = result;
+    spare_queues_.push_back(std::move(*full_queue));
+    --queues_in_flight_;
+    pipeline_condition_.notify_all();
+  });
+  return kSuccess;
+}
+
+int SelfEncryptor::CollectPipelineResult(bool wait) {
+  std::unique_lock<std::mutex> lock(pipeline_mutex_);
+  if (wait)
+    WaitFor(&lock, &pipeline_condition_, [this] { return queues_in_flight_ == 0; });
+  int result(pipeline_result_);
+  pipeline_result_ = kSuccess;
+  return result;
+}
+
+void SelfEncryptor::WaitFor(std::unique_lock<std::mutex>* lock,
+                            std::condition_variable* condition,
+                            const std::function<bool()>& ready) {
+  while (!ready()) {
+    lock->unlock();
+    bool ran_task(executor_.RunPendingTask());
+    lock->lock();
+    // Nothing queued, so what's awaited is running elsewhere and will notify.  Poll anyway, in
+    // case it queues more work meanwhile.
+    if (!ran_task && !ready())
+      condition->wait_for(*lock, std::chrono::milliseconds(1));
+  }
+}
+
 int SelfEncryptor::EncryptChunk(uint32_t chunk_num, byte* data, uint32_t length) {
   SCOPED_PROFILE
-  assert(data_map_.chunks.size() > chunk_num);
   data_map_.chunks[chunk_num].hash.resize(crypto::SHA512::DIGESTSIZE);
 
-  ByteArray pad(GetNewByteArray(kPadSize));
-  ByteArray key(GetNewByteArray(crypto::AES256_KeySize));
-  ByteArray iv(GetNewByteArray(crypto::AES256_IVSize));
+  ChunkSecrets& secrets(GetChunkSecrets());
+  ByteArray& pad(secrets.pad);
+  ByteArray& key(secrets.key);
+  ByteArray& iv(secrets.iv);
   GetPadIvKey(chunk_num, key, iv, pad, true);
-  int result(kSuccess);
-  try {
-    CryptoPP::CFB_Mode<CryptoPP::AES>::Encryption encryptor(key.get(), crypto::AES256_KeySize,
-                                                            iv.get());
-
-    std::string chunk_content;
-    chunk_content.reserve(length);
-    CryptoPP::Gzip aes_filter(
-        new CryptoPP::StreamTransformationFilter(
-            encryptor, new XORFilter(new CryptoPP::StringSink(chunk_content), pad.get())),
-        1);
-    aes_filter.Put2(data, length, -1, true);
-
-    ByteArray post_hash(GetNewByteArray(crypto::SHA512::DIGESTSIZE));
-    CryptoPP::SHA512().CalculateDigest(
-        post_hash.get(), reinterpret_cast<const byte*>(chunk_content.data()), chunk_content.size());
-    data_map_.chunks[chunk_num]
-        .hash.assign(reinterpret_cast<char*>(post_hash.get()), crypto::SHA512::DIGESTSIZE);
+  CompressionType compression(kCompression_.type);
+  if (kCompression_.skip_incompressible && compression != CompressionType::kStore) {
+    ++chunks_probed_;
+    if (LooksIncompressible(data, length)) {
+      compression = CompressionType::kStore;
+      ++chunks_skipped_;
+      bytes_skipped_ += length;
+    }
+  }
+  std::string chunk_content(MaxEncodedChunkSize(compression, length), 0);
+  uint32_t encoded_size(0);
+  // The chunk name is hashed block by block as each is encrypted, rather than in a second pass.
+  std::unique_ptr<HashFunction> post_hash(NewChunkHash(data_map_.self_encryption_version));
+  int result(EncodeChunk(data, length, compression, kCompression_.level, key.get(), iv.get(),
+                         pad.get(), reinterpret_cast<byte*>(&chunk_content[0]), &encoded_size,
+                         post_hash.get()));
+  if (result == kSuccess) {
+    data_map_.chunks[chunk_num].compression = compression;
+    chunk_content.resize(encoded_size);
+    post_hash->Final(reinterpret_cast<byte*>(&data_map_.chunks[chunk_num].hash[0]));
 
     data_map_.chunks[chunk_num].storage_state = ChunkDetails::kPending;
     try {
-      buffer_.Store(data_map_.chunks[chunk_num].hash, NonEmptyString(chunk_content));
+      buffer_.Store(data_map_.chunks[chunk_num].hash, NonEmptyString(std::move(chunk_content)));
     }
     catch (...) {
       LOG(kError) << "Could not store " << Base64Substr(data_map_.chunks[chunk_num].hash);
@@ -805,10 +1234,6 @@ int SelfEncryptor::EncryptChunk(uint32_t chunk_num, byte* data, uint32_t length)
     }
 //    DebugPrint(true, chunk_num, pad, key, iv, data, length, chunk_content);
   }
-  catch (const std::exception& e) {
-    LOG(kError) << e.what();
-    result = kEncryptionException;
-  }
 
   data_map_.chunks[chunk_num].size = length;  // keep pre-compressed length
   return result;
@@ -816,40 +1241,76 @@ int SelfEncryptor::EncryptChunk(uint32_t chunk_num, byte* data, uint32_t length)
 
 void SelfEncryptor::CalculatePreHash(uint32_t chunk_num, const byte* data, uint32_t length,
                                      bool* modified) {
-  SCOPED_PROFILE
-  if (data_map_.chunks[chunk_num].pre_hash_state == ChunkDetails::kOk) {
-    *modified = false;
-    return;
+  CalculatePreHashes(chunk_num, &data, length, 1, modified);
+}
+
+void SelfEncryptor::KeepOldPreHashes(uint32_t chunk_num) {
+  std::lock_guard<std::mutex> old_pre_hashes_guard(old_pre_hashes_mutex_);
+  for (uint32_t successor(std::max(chunk_num + 1, 2U));
+       successor <= chunk_num + 2 && successor < data_map_.chunks.size(); ++successor) {
+    if (old_pre_hashes_.count(successor) != 0)
+      continue;
+    std::array<byte, 2 * kChunkHashSize>& old_pre_hashes(old_pre_hashes_[successor]);
+    memcpy(&old_pre_hashes[0], data_map_.chunks[successor - 1].pre_hash, kChunkHashSize);
+    memcpy(&old_pre_hashes[kChunkHashSize], data_map_.chunks[successor - 2].pre_hash,
+           kChunkHashSize);
   }
+}
 
-  if (data_map_.chunks[chunk_num].pre_hash_state == ChunkDetails::kOutdated) {
-    ByteArray temp(GetNewByteArray(crypto::SHA512::DIGESTSIZE));
-    CryptoPP::SHA512().CalculateDigest(temp.get(), data, length);
-    *modified = false;
-    {
-      std::lock_guard<std::mutex> guard(data_mutex_);
-      for (int i(0); i != crypto::SHA512::DIGESTSIZE; ++i) {
-        *modified = (*(temp.get() + i) != data_map_.chunks[chunk_num].pre_hash[i]);
-        if (*modified)
-          break;
-      }
+void SelfEncryptor::CalculatePreHashes(uint32_t first_chunk_num, const byte* const* data,
+                                       uint32_t length, uint32_t count, bool* modified) {
+  SCOPED_PROFILE
+  std::vector<const byte*> to_hash;
+  std::vector<uint32_t> to_hash_indices;
+  for (uint32_t i(0); i != count; ++i) {
+    modified[i] = false;
+    if (data_map_.chunks[first_chunk_num + i].pre_hash_state != ChunkDetails::kOk) {
+      to_hash.push_back(data[i]);
+      to_hash_indices.push_back(i);
     }
+  }
+  if (to_hash.empty())
+    return;
 
-    if (!(*modified)) {
-      data_map_.chunks[chunk_num].pre_hash_state = ChunkDetails::kOk;
-      return;
+  const int64_t kHashCount(static_cast<int64_t>(to_hash.size()));
+  std::vector<byte> hashes(to_hash.size() * crypto::SHA512::DIGESTSIZE);
+  std::vector<byte*> digests(to_hash.size());
+  for (size_t i(0); i != to_hash.size(); ++i)
+    digests[i] = &hashes[i * crypto::SHA512::DIGESTSIZE];
+  // Batches fill the multi-buffer hasher's lanes; separate batches can run on separate threads.
+  const int64_t kBatchSize(static_cast<int64_t>(Sha512MultiBufferLanes()));
+  executor_.ParallelFor(0, (kHashCount + kBatchSize - 1) / kBatchSize, [&](int64_t batch) {
+    const int64_t kFirst(batch * kBatchSize);
+    HashChunks(data_map_.self_encryption_version, &to_hash[kFirst], length,
+               static_cast<size_t>(std::min(kBatchSize, kHashCount - kFirst)), &digests[kFirst]);
+  });
+
+  for (size_t i(0); i != to_hash.size(); ++i) {
+    ChunkDetailsRef chunk(data_map_.chunks[first_chunk_num + to_hash_indices[i]]);
+    bool& chunk_modified(modified[to_hash_indices[i]]);
+    if (chunk.pre_hash_state == ChunkDetails::kOutdated) {
+      chunk_modified = (memcmp(digests[i], chunk.pre_hash, crypto::SHA512::DIGESTSIZE) != 0);
+      if (!chunk_modified) {
+        chunk.pre_hash_state = ChunkDetails::kOk;
+        continue;
+      }
+    } else {
+      chunk_modified = true;
     }
-    memcpy(data_map_.chunks[chunk_num].pre_hash, temp.get(), crypto::SHA512::DIGESTSIZE);
-  } else {
-    *modified = true;
-    CryptoPP::SHA512().CalculateDigest(&data_map_.chunks[chunk_num].pre_hash[0], data, length);
+    // Stored successors were encrypted with the old pre-hash, even if it was never calculated.
+    KeepOldPreHashes(first_chunk_num + to_hash_indices[i]);
+    memcpy(chunk.pre_hash, digests[i], crypto::SHA512::DIGESTSIZE);
+    chunk.pre_hash_state = ChunkDetails::kOk;
   }
-
-  data_map_.chunks[chunk_num].pre_hash_state = ChunkDetails::kOk;
 }
 
 bool SelfEncryptor::Flush() {
   SCOPED_PROFILE
+  int pipeline_result(CollectPipelineResult(true));
+  if (pipeline_result != kSuccess) {
+    LOG(kError) << "Background encryption failed: " << pipeline_result;
+    return false;
+  }
   if (flushed_ || !prepared_for_writing_)
     return true;
 
@@ -857,6 +1318,8 @@ bool SelfEncryptor::Flush() {
     data_map_.content.assign(reinterpret_cast<char*>(chunk0_raw_.get()),
                               static_cast<size_t>(file_size_));
     data_map_.chunks.clear();
+    std::lock_guard<std::mutex> old_pre_hashes_guard(old_pre_hashes_mutex_);
+    old_pre_hashes_.clear();
     flushed_ = true;
     return true;
   } else {
@@ -865,17 +1328,8 @@ bool SelfEncryptor::Flush() {
 
   CalculateSizes(true);
 
-  // Get pre-encryption hashes for chunks 0 & 1
   if (data_map_.chunks.size() < 2)
     data_map_.chunks.resize(2);
-  bool chunk0_modified(false);
-  CalculatePreHash(0, chunk0_raw_.get(), normal_chunk_size_, &chunk0_modified);
-  // If chunk 0 was previously modified, it may already have had its pre-enc
-  // hash updated to allow chunk 2 to be stored.  In this case, the modification
-  // is indicated by a size of 0 in the data map.
-  if (data_map_.chunks[0].size == 0)
-    chunk0_modified = true;
-  bool pre_pre_chunk_pre_hash_modified(chunk0_modified);
   byte* chunk1_start(chunk1_raw_.get());
   ByteArray temp;
   if (normal_chunk_size_ != kDefaultChunkSize) {
@@ -884,7 +1338,7 @@ bool SelfEncryptor::Flush() {
       chunk1_start = chunk0_raw_.get() + normal_chunk_size_;
     } else {
       // Some at end of chunk0_raw_ and rest in start of chunk1_raw_
-      temp = GetNewByteArray(normal_chunk_size_);
+      temp = GetNewByteArray(normal_chunk_size_, ByteArrayFill::kUninitialised);
       uint32_t size_chunk0(kDefaultChunkSize - normal_chunk_size_);
       uint32_t size_chunk1(normal_chunk_size_ - size_chunk0);
       uint32_t copied = MemCopy(temp, 0, chunk0_raw_.get() + normal_chunk_size_, size_chunk0);
@@ -895,8 +1349,24 @@ bool SelfEncryptor::Flush() {
       chunk1_start = temp.get();
     }
   }
-  bool chunk1_modified(false);
-  CalculatePreHash(1, chunk1_start, normal_chunk_size_, &chunk1_modified);
+
+  // Get pre-encryption hashes for chunks 0 & 1
+  const byte* initial_chunks[2] = {chunk0_raw_.get(), chunk1_start};
+  bool initial_chunks_modified[2] = {false, false};
+  CalculatePreHashes(0, initial_chunks, normal_chunk_size_, 2, initial_chunks_modified);
+  // Recorded as for Write, so that a Flush which fails part way still re-encrypts them next time.
+  for (uint32_t i(0); i != 2; ++i) {
+    if (initial_chunks_modified[i])
+      data_map_.chunks[i].size = 0;
+  }
+  bool chunk0_modified(initial_chunks_modified[0]);
+  // If chunk 0 was previously modified, it may already have had its pre-enc
+  // hash updated to allow chunk 2 to be stored.  In this case, the modification
+  // is indicated by a size of 0 in the data map.
+  if (data_map_.chunks[0].size == 0)
+    chunk0_modified = true;
+  bool pre_pre_chunk_pre_hash_modified(chunk0_modified);
+  bool chunk1_modified(initial_chunks_modified[1]);
   // If chunk 1 was previously modified, it may already have had its pre-enc
   // hash updated to allow chunks 2 & 3 to be stored.  In this case, the
   // modification is indicated by a size of 0 in the data map.
@@ -906,6 +1376,8 @@ bool SelfEncryptor::Flush() {
 
   // Empty queue (after this call it will contain 0 or 1 chunks).
   int result(ProcessMainQueue());
+  if (result == kSuccess)
+    result = CollectPipelineResult(true);
   if (result != kSuccess) {
     LOG(kError) << "Failed in Flush.";
     return false;
@@ -918,130 +1390,249 @@ bool SelfEncryptor::Flush() {
 
   uint64_t flush_position(2 * normal_chunk_size_);
   uint32_t chunk_index(2);
-  bool this_chunk_modified(false);
-  bool this_chunk_has_data_in_sequencer(false);
-  bool this_chunk_has_data_in_queue(false);
   uint32_t retrieved_from_queue(0);
-  bool this_chunk_has_data_in_c0_or_c1(false);
-
-  std::pair<uint64_t, ByteArray> sequence_block(sequencer_->GetFirst());
-  uint64_t sequence_block_position(sequence_block.first);
-  ByteArray sequence_block_data(sequence_block.second);
-  uint32_t sequence_block_size(Size(sequence_block.second));
-  uint32_t sequence_block_copied(0);
 
-  ByteArray chunk_array(GetNewByteArray(kDefaultChunkSize + kMinChunkSize));
+  // Chunks 2 onwards are flushed a window at a time in two phases.  First the window's plaintexts
+  // are assembled (decrypting the old chunks in parallel) and pre-hashed; then, with every n-1 and
+  // n-2 pre-hash known, the chunks which need it are encrypted in parallel.
+  const uint32_t kWindow(std::max(1U, std::min(kOptions_.flush_window, kNewChunkCount)));
+  std::vector<ByteArray> chunk_arrays;
+  for (uint32_t i(0); i != kWindow; ++i) {
+    chunk_arrays.push_back(
+        GetNewByteArray(kDefaultChunkSize + kMinChunkSize, ByteArrayFill::kUninitialised));
+  }
+  std::vector<uint32_t> chunk_sizes(kWindow);
+  std::unique_ptr<bool[]> decrypt(new bool[kWindow]), chunk_modified(new bool[kWindow]),
+      stale(new bool[kWindow]), encrypt(new bool[kWindow]);
+  // Buffered data to be copied over each chunk once it's decrypted, and the sequencer blocks they
+  // point into which have already been taken from sequencer_.
+  std::vector<std::vector<FlushOverlay>> overlays(kWindow);
+  std::vector<SequenceBlock> used_sequence_blocks;
+  // The window's chunk details and old pre-hashes from before it was pre-hashed.
+  std::vector<ChunkDetails> old_details;
+  std::map<uint32_t, std::array<byte, 2 * kChunkHashSize>> window_old_pre_hashes;
+  // Windows already flushed stay flushed if a later one fails.  The failed window gives back the
+  // data it took from the sequencer, and chunks 0 and 1 (which depend on the last two chunks) are
+  // marked for re-encryption, so that Flush can be called again.
+  auto abandon_window([&] {
+    for (const auto& sequence_block : used_sequence_blocks) {
+      if (sequencer_->Add(reinterpret_cast<const char*>(sequence_block.second.get()),
+                          Size(sequence_block.second), sequence_block.first) != kSuccess) {
+        LOG(kError) << "Lost data written at " << sequence_block.first;
+      }
+    }
+    used_sequence_blocks.clear();
+    data_map_.chunks[0].size = 0;
+    data_map_.chunks[1].size = 0;
+    LOG(kError) << "Failed in Flush.";
+  });
   uint32_t this_chunk_size(normal_chunk_size_);
   while (flush_position <= last_chunk_position_) {
-    if (chunk_index == kNewChunkCount - 1) {  // on last chunk
-      this_chunk_size = static_cast<uint32_t>(file_size_ - last_chunk_position_);
-    }
+    const uint32_t kFirstIndex(chunk_index);
+    uint32_t count(0);
+    // Whether chunks n-1 and n-2 may get new pre-hashes, and so whether chunk n may need to be
+    // re-encrypted (so its old content decrypted).
+    bool pre_pre_chunk_may_be_modified(pre_pre_chunk_pre_hash_modified);
+    bool pre_chunk_may_be_modified(pre_chunk_pre_hash_modified);
+    while (count != kWindow && flush_position <= last_chunk_position_) {
+      if (chunk_index == kNewChunkCount - 1) {  // on last chunk
+        this_chunk_size = static_cast<uint32_t>(file_size_ - last_chunk_position_);
+      }
+      chunk_sizes[count] = this_chunk_size;
+      std::vector<FlushOverlay>& chunk_overlays(overlays[count]);
+      chunk_overlays.clear();
+      bool this_chunk_modified(false);
+
+      // Everything before flush_position has already been taken, so these all lie in this chunk.
+      std::vector<SequenceBlock> sequence_blocks(
+          sequencer_->GetBefore(flush_position + this_chunk_size));
+      bool this_chunk_has_data_in_sequencer(!sequence_blocks.empty());
+      if (this_chunk_has_data_in_sequencer)
+        this_chunk_modified = true;
+
+      bool this_chunk_has_data_in_queue(false);
+      if (flush_position <= queue_start_position_ + retrievable_from_queue_ &&
+          flush_position + this_chunk_size > queue_start_position_ &&
+          retrievable_from_queue_ - retrieved_from_queue != 0) {
+        this_chunk_has_data_in_queue = true;
+        this_chunk_modified = true;
+      }
 
-    memset(chunk_array.get(), 0, Size(chunk_array));
-    if (sequence_block_position < flush_position + this_chunk_size) {
-      this_chunk_has_data_in_sequencer = true;
-      this_chunk_modified = true;
-    }
+      bool this_chunk_has_data_in_c0_or_c1(false);
+      if (flush_position < 2 * kDefaultChunkSize) {
+        this_chunk_has_data_in_c0_or_c1 = true;
+        this_chunk_modified = true;
+      }
 
-    if (flush_position <= queue_start_position_ + retrievable_from_queue_ &&
-        flush_position + this_chunk_size > queue_start_position_ &&
-        retrievable_from_queue_ - retrieved_from_queue != 0) {
-      this_chunk_has_data_in_queue = true;
-      this_chunk_modified = true;
-    }
+      if (data_map_.chunks[chunk_index].size == 0)
+        this_chunk_modified = true;
 
-    if (flush_position < 2 * kDefaultChunkSize) {
-      this_chunk_has_data_in_c0_or_c1 = true;
-      this_chunk_modified = true;
-    }
-
-    if (data_map_.chunks[chunk_index].size == 0)
-      this_chunk_modified = true;
+      // A chunk still encrypted with old n-1 or n-2 pre-hashes (say after an earlier Flush failed)
+      // is re-encrypted even if they don't change again this time.
+      {
+        std::lock_guard<std::mutex> old_pre_hashes_guard(old_pre_hashes_mutex_);
+        stale[count] = old_pre_hashes_.count(chunk_index) != 0;
+      }
 
-    // Read in any data from previously-encrypted chunk
-    if (chunk_index < kOldChunkCount &&
-        (pre_pre_chunk_pre_hash_modified || pre_chunk_pre_hash_modified || this_chunk_modified)) {
-      DecryptChunk(chunk_index, chunk_array.get());
-    }
+      // Read in any data from previously-encrypted chunk
+      decrypt[count] = chunk_index < kOldChunkCount &&
+                       (pre_pre_chunk_may_be_modified || pre_chunk_may_be_modified ||
+                        this_chunk_modified || stale[count]);
+
+      // Overwrite with any data in chunk0_raw_ and/or chunk1_raw_
+      uint32_t copied(0);
+      if (this_chunk_has_data_in_c0_or_c1) {
+        uint32_t offset(static_cast<uint32_t>(flush_position));
+        uint32_t size_in_chunk0(0), c1_offset(0);
+        if (offset < kDefaultChunkSize) {  // in chunk 0
+          size_in_chunk0 = std::min(kDefaultChunkSize - offset, this_chunk_size);
+          chunk_overlays.push_back(FlushOverlay(0, chunk0_raw_.get() + offset, size_in_chunk0));
+          copied = size_in_chunk0;
+        } else if (offset < 2 * kDefaultChunkSize) {
+          c1_offset = offset - kDefaultChunkSize;
+        }
+        uint32_t size_in_chunk1(
+            std::min(this_chunk_size - size_in_chunk0, kDefaultChunkSize - c1_offset));
+        if (size_in_chunk1 != 0) {  // in chunk 1
+          chunk_overlays.push_back(
+              FlushOverlay(size_in_chunk0, chunk1_raw_.get() + c1_offset, size_in_chunk1));
+          copied += size_in_chunk1;
+        }
+      }
 
-    // Overwrite with any data in chunk0_raw_ and/or chunk1_raw_
-    uint32_t copied(0);
-    if (this_chunk_has_data_in_c0_or_c1) {
-      uint32_t offset(static_cast<uint32_t>(flush_position));
-      uint32_t size_in_chunk0(0), c1_offset(0);
-      if (offset < kDefaultChunkSize) {  // in chunk 0
-        size_in_chunk0 = std::min(kDefaultChunkSize - offset, this_chunk_size);
-        copied = MemCopy(chunk_array, 0, chunk0_raw_.get() + offset, size_in_chunk0);
-        assert(size_in_chunk0 == copied);
-      } else if (offset < 2 * kDefaultChunkSize) {
-        c1_offset = offset - kDefaultChunkSize;
+      // Overwrite with any data in queue
+      if (this_chunk_has_data_in_queue) {
+        uint32_t copy_size(
+            std::min(retrievable_from_queue_ - retrieved_from_queue, this_chunk_size));
+        chunk_overlays.push_back(
+            FlushOverlay(copied, main_encrypt_queue_.get() + retrieved_from_queue, copy_size));
+        retrieved_from_queue += copy_size;
       }
-      uint32_t size_in_chunk1(
-          std::min(this_chunk_size - size_in_chunk0, kDefaultChunkSize - c1_offset));
-      if (size_in_chunk1 != 0) {  // in chunk 1
-        copied +=
-            MemCopy(chunk_array, size_in_chunk0, chunk1_raw_.get() + c1_offset, size_in_chunk1);
-        assert(size_in_chunk0 + size_in_chunk1 == copied);
+
+      // Overwrite with any data from sequencer
+      for (auto& sequence_block : sequence_blocks) {
+        assert(sequence_block.first >= flush_position);
+        chunk_overlays.push_back(
+            FlushOverlay(static_cast<uint32_t>(sequence_block.first - flush_position),
+                         sequence_block.second.get(), Size(sequence_block.second)));
+        used_sequence_blocks.push_back(std::move(sequence_block));
       }
-    }
 
-    // Overwrite with any data in queue
-    if (this_chunk_has_data_in_queue) {
-      uint32_t copy_size(std::min(retrievable_from_queue_ - retrieved_from_queue, this_chunk_size));
-      copied =
-          MemCopy(chunk_array, copied, main_encrypt_queue_.get() + retrieved_from_queue, copy_size);
-      retrieved_from_queue += copy_size;
-      assert(copy_size == copied);
+      chunk_modified[count] = this_chunk_modified;
+      pre_pre_chunk_may_be_modified = pre_chunk_may_be_modified;
+      pre_chunk_may_be_modified = this_chunk_modified;
+      flush_position += this_chunk_size;
+      ++chunk_index;
+      ++count;
     }
 
-    // Overwrite with any data from sequencer
-    if (this_chunk_has_data_in_sequencer) {
-      while (sequence_block_position + sequence_block_copied < flush_position + this_chunk_size) {
-        uint32_t copy_size(
-            std::min(sequence_block_size - sequence_block_copied,
-                     static_cast<uint32_t>(flush_position + this_chunk_size -
-                                           (sequence_block_position + sequence_block_copied))));
-        uint32_t copy_offset(0);
-        if (sequence_block_position > flush_position)
-          copy_offset = std::min(this_chunk_size - copy_size,
-                                 static_cast<uint32_t>(sequence_block_position - flush_position));
-        copied = MemCopy(chunk_array, copy_offset,
-                         sequence_block_data.get() + sequence_block_copied, copy_size);
-        assert(copy_size == copied);
-        if (sequence_block_copied + copy_size == sequence_block_size) {
-          sequence_block = sequencer_->GetFirst();
-          sequence_block_position = sequence_block.first;
-          sequence_block_data = sequence_block.second;
-          sequence_block_size = Size(sequence_block.second);
-          sequence_block_copied = 0;
-        } else {
-          sequence_block_copied += copy_size;
+    // Phase 1: assemble the plaintexts.
+    std::vector<uint32_t> chunk_nums;
+    for (uint32_t i(0); i != count; ++i) {
+      if (decrypt[i])
+        chunk_nums.push_back(kFirstIndex + i);
+    }
+    std::vector<NonEmptyString> contents;
+    FetchStoredChunks(chunk_nums, &contents);
+    std::vector<const NonEmptyString*> chunk_contents(count, nullptr);
+    for (size_t i(0); i != chunk_nums.size(); ++i)
+      chunk_contents[chunk_nums[i] - kFirstIndex] = &contents[i];
+    int decrypt_result(kSuccess);
+    executor_.ParallelFor(0, count, [&](int64_t i) {
+      ByteArray& chunk_array(chunk_arrays[static_cast<size_t>(i)]);
+      memset(chunk_array.get(), 0, Size(chunk_array));
+      if (decrypt[i]) {
+        int res(DecryptChunk(kFirstIndex + static_cast<uint32_t>(i), chunk_array.get(),
+                             chunk_contents[static_cast<size_t>(i)]));
+        if (res != kSuccess) {
+          std::lock_guard<std::mutex> guard(data_mutex_);
+          decrypt_result = res;
+          return;
         }
       }
+      for (const auto& overlay : overlays[static_cast<size_t>(i)]) {
+        uint32_t copied = MemCopy(chunk_array, overlay.offset, overlay.data, overlay.size);
+        assert(overlay.size == copied);
+        static_cast<void>(copied);
+      }
+    });
+    // Re-encrypting a chunk whose old content couldn't be read would store zeros in its place.
+    if (decrypt_result != kSuccess) {
+      abandon_window();
+      return false;
     }
 
-    if (this_chunk_modified) {
-      data_map_.chunks[chunk_index].pre_hash_state = ChunkDetails::kOutdated;
-      CalculatePreHash(chunk_index, chunk_array.get(), this_chunk_size, &this_chunk_modified);
+    old_details.clear();
+    for (uint32_t i(0); i != count; ++i)
+      old_details.push_back(ChunkDetails(data_map_.chunks[kFirstIndex + i]));
+    {
+      std::lock_guard<std::mutex> old_pre_hashes_guard(old_pre_hashes_mutex_);
+      window_old_pre_hashes.clear();
+      window_old_pre_hashes.insert(old_pre_hashes_.lower_bound(kFirstIndex),
+                                   old_pre_hashes_.lower_bound(kFirstIndex + count + 2));
     }
 
-    if (pre_pre_chunk_pre_hash_modified || pre_chunk_pre_hash_modified || this_chunk_modified) {
-      DeleteChunk(chunk_index);
-      result = EncryptChunk(chunk_index, chunk_array.get(), this_chunk_size);
-      if (result != kSuccess) {
-        LOG(kError) << "Failed in Flush.";
-        return false;
+    // ... and pre-hash the modified chunks, in runs of consecutive chunks of equal size.
+    for (uint32_t i(0); i != count;) {
+      if (!chunk_modified[i]) {
+        ++i;
+        continue;
       }
+      uint32_t run_end(i);
+      std::vector<const byte*> chunk_data;
+      while (run_end != count && chunk_modified[run_end] &&
+             chunk_sizes[run_end] == chunk_sizes[i]) {
+        data_map_.chunks[kFirstIndex + run_end].pre_hash_state = ChunkDetails::kOutdated;
+        chunk_data.push_back(chunk_arrays[run_end].get());
+        ++run_end;
+      }
+      CalculatePreHashes(kFirstIndex + i, &chunk_data[0], chunk_sizes[i], run_end - i,
+                         &chunk_modified[i]);
+      i = run_end;
     }
 
-    flush_position += this_chunk_size;
-    ++chunk_index;
-    pre_pre_chunk_pre_hash_modified = pre_chunk_pre_hash_modified;
-    pre_chunk_pre_hash_modified = this_chunk_modified;
-    this_chunk_modified = false;
-    this_chunk_has_data_in_sequencer = false;
-    this_chunk_has_data_in_queue = false;
-    this_chunk_has_data_in_c0_or_c1 = false;
+    // Phase 2: re-encrypt each chunk whose content or n-1 or n-2 pre-hash has changed.  The old
+    // chunks are only deleted once the whole window is stored.
+    for (uint32_t i(0); i != count; ++i) {
+      encrypt[i] = pre_pre_chunk_pre_hash_modified || pre_chunk_pre_hash_modified ||
+                   chunk_modified[i] || stale[i];
+      pre_pre_chunk_pre_hash_modified = pre_chunk_pre_hash_modified;
+      pre_chunk_pre_hash_modified = chunk_modified[i];
+    }
+    int encrypt_result(kSuccess);
+    executor_.ParallelFor(0, count, [&](int64_t i) {
+      if (!encrypt[i])
+        return;
+      int res(EncryptChunk(kFirstIndex + static_cast<uint32_t>(i),
+                           chunk_arrays[static_cast<size_t>(i)].get(),
+                           chunk_sizes[static_cast<size_t>(i)]));
+      if (res != kSuccess) {
+        std::lock_guard<std::mutex> guard(data_mutex_);
+        encrypt_result = res;
+      }
+    });
+    // Either the new chunks or the old ones are deleted, other than any which are the same.
+    for (uint32_t i(0); i != count; ++i) {
+      if (!encrypt[i] || old_details[i].hash == data_map_.chunks[kFirstIndex + i].hash)
+        continue;
+      if (encrypt_result == kSuccess)
+        DeleteChunk(old_details[i].hash);
+      else
+        DeleteChunk(kFirstIndex + i);
+    }
+    if (encrypt_result != kSuccess) {
+      for (uint32_t i(0); i != count; ++i)
+        data_map_.chunks[kFirstIndex + i] = old_details[i];
+      {
+        std::lock_guard<std::mutex> old_pre_hashes_guard(old_pre_hashes_mutex_);
+        old_pre_hashes_.erase(old_pre_hashes_.lower_bound(kFirstIndex),
+                              old_pre_hashes_.lower_bound(kFirstIndex + count + 2));
+        old_pre_hashes_.insert(window_old_pre_hashes.begin(), window_old_pre_hashes.end());
+      }
+      abandon_window();
+      return false;
+    }
+    used_sequence_blocks.clear();
   }
 
   assert(flush_position == file_size_);
@@ -1058,6 +1649,7 @@ bool SelfEncryptor::Flush() {
     DeleteChunk(0);
     result = EncryptChunk(0, chunk0_raw_.get(), normal_chunk_size_);
     if (result != kSuccess) {
+      data_map_.chunks[0].size = 0;
       LOG(kError) << "Failed in Flush.";
       return false;
     }
@@ -1071,6 +1663,7 @@ bool SelfEncryptor::Flush() {
     DeleteChunk(1);
     result = EncryptChunk(1, chunk1_start, normal_chunk_size_);
     if (result != kSuccess) {
+      data_map_.chunks[1].size = 0;
       LOG(kError) << "Failed in Flush.";
       return false;
     }
@@ -1088,46 +1681,236 @@ bool SelfEncryptor::Read(char* data, uint32_t length, uint64_t position) {
   if (ReadFromBuffer(data, length, position))
     return true;
 
-  PrepareToRead();
+  if (CollectPipelineResult(true) != kSuccess) {
+    LOG(kError) << "Background encryption failed before reading at position " << position;
+    return false;
+  }
 
-  if (length < kDefaultByteArraySize_) {
-    if (position < cache_start_position_ ||
-        position + length > cache_start_position_ + kDefaultByteArraySize_) {
-      // populate read_cache_.
-      if (Transmogrify(read_cache_.get(), kDefaultByteArraySize_, position) != kSuccess) {
-        LOG(kError) << "Failed to read " << length << " bytes at position " << position;
-        return false;
-      }
-      cache_start_position_ = position;
+  // A read as large as the whole cache would only evict everything else from it.
+  if (length >= kReadCacheSize_ || ChunkAligned(length, position))
+    return ReadDirect(data, length, position);
+
+  // Chunks in the middle of the read which it covers in full are read straight into data, and
+  // only those at either end which it covers in part go through the read cache.
+  uint64_t end(position + length);
+  uint64_t middle_begin((position + kDefaultChunkSize - 1) / kDefaultChunkSize * kDefaultChunkSize);
+  uint64_t middle_end(end / kDefaultChunkSize * kDefaultChunkSize);
+  if (middle_begin > middle_end)
+    middle_begin = middle_end = end;
+  int result(kSuccess);
+  if (position < middle_begin)
+    result = ReadThroughCache(data, static_cast<uint32_t>(middle_begin - position), position);
+  if (result == kSuccess && middle_begin < middle_end) {
+    result = Transmogrify(data + (middle_begin - position),
+                          static_cast<uint32_t>(middle_end - middle_begin), middle_begin);
+  }
+  if (result == kSuccess && middle_end < end) {
+    result = ReadThroughCache(data + (middle_end - position),
+                              static_cast<uint32_t>(end - middle_end), middle_end);
+  }
+  if (result != kSuccess) {
+    LOG(kError) << "Failed to read " << length << " bytes at position " << position;
+    return false;
+  }
+  RecordRead(position, length);
+  return true;
+}
+
+int SelfEncryptor::ReadThroughCache(char* data, uint32_t length, uint64_t position) {
+  SCOPED_PROFILE
+  uint32_t chunk_index(static_cast<uint32_t>(position / kDefaultChunkSize));
+  uint64_t chunk_start(static_cast<uint64_t>(chunk_index) * kDefaultChunkSize);
+  assert(position + length <= chunk_start + kDefaultChunkSize);
+  std::shared_ptr<ByteArray> chunk;
+  {
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    auto itr(read_cache_index_.find(chunk_index));
+    if (itr != read_cache_index_.end()) {
+      read_cache_.splice(read_cache_.begin(), read_cache_, (*itr).second);
+      chunk = (*(*itr).second).second;
+      ++read_cache_hits_;
+    } else {
+      ++read_cache_misses_;
     }
-    memcpy(data, read_cache_.get() + static_cast<uint32_t>(position - cache_start_position_),
-           length);
-  } else {
-    // length requested larger than cache size, just go ahead and read
-    if (Transmogrify(data, length, position) != kSuccess) {
-      LOG(kError) << "Failed to read " << length << " bytes at position " << position;
-      return false;
+  }
+
+  if (!chunk) {
+    // Decrypted without holding read_mutex_, so that readers which miss work in parallel.
+    chunk = std::make_shared<ByteArray>(
+        GetNewByteArray(kDefaultChunkSize, ByteArrayFill::kUninitialised));
+    int result(Transmogrify(reinterpret_cast<char*>(chunk->get()), kDefaultChunkSize,
+                            chunk_start));
+    if (result != kSuccess)
+      return result;
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    if (read_cache_index_.count(chunk_index) == 0) {
+      read_cache_.push_front(std::make_pair(chunk_index, chunk));
+      read_cache_index_.insert(std::make_pair(chunk_index, read_cache_.begin()));
+      read_cache_bytes_ += Size(*chunk);
+      TrimReadCache();
     }
   }
+  memcpy(data, chunk->get() + (position - chunk_start), length);
+  return kSuccess;
+}
+
+void SelfEncryptor::TrimReadCache() {
+  while (read_cache_bytes_ > kReadCacheSize_ && !read_cache_.empty()) {
+    read_cache_bytes_ -= Size(*read_cache_.back().second);
+    read_cache_index_.erase(read_cache_.back().first);
+    read_cache_.pop_back();
+    ++read_cache_evictions_;
+  }
+}
+
+void SelfEncryptor::ClearReadCache() {
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  read_cache_.clear();
+  read_cache_index_.clear();
+  read_cache_bytes_ = 0;
+}
+
+bool SelfEncryptor::ChunkAligned(uint32_t length, uint64_t position) const {
+  return !prepared_for_writing_ && normal_chunk_size_ == kDefaultChunkSize &&
+         position % kDefaultChunkSize == 0 &&
+         (length % kDefaultChunkSize == 0 || position + length >= file_size_);
+}
+
+bool SelfEncryptor::ReadDirect(char* data, uint32_t length, uint64_t position) {
+  if (Transmogrify(data, length, position) != kSuccess) {
+    LOG(kError) << "Failed to read " << length << " bytes at position " << position;
+    return false;
+  }
+  RecordRead(position, length);
   return true;
 }
 
+std::future<int> SelfEncryptor::WriteAsync(const char* data, uint32_t length,
+                                           uint64_t position) {
+  std::shared_ptr<std::promise<int>> promise(std::make_shared<std::promise<int>>());
+  std::future<int> future(promise->get_future());
+  WriteAsync(data, length, position, [promise](int result) { promise->set_value(result); });
+  return future;
+}
+
+void SelfEncryptor::WriteAsync(const char* data, uint32_t length, uint64_t position,
+                               CompletionHandler handler) {
+  EnqueueAsync([this, data, length, position] {
+    return Write(data, length, position) ? kSuccess : kEncryptionException;
+  }, handler);
+}
+
+std::future<int> SelfEncryptor::ReadAsync(char* data, uint32_t length, uint64_t position) {
+  std::shared_ptr<std::promise<int>> promise(std::make_shared<std::promise<int>>());
+  std::future<int> future(promise->get_future());
+  ReadAsync(data, length, position, [promise](int result) { promise->set_value(result); });
+  return future;
+}
+
+void SelfEncryptor::ReadAsync(char* data, uint32_t length, uint64_t position,
+                              CompletionHandler handler) {
+  EnqueueAsync([this, data, length, position] {
+    return Read(data, length, position) ? kSuccess : kDecryptionException;
+  }, handler);
+}
+
+std::future<int> SelfEncryptor::FlushAsync() {
+  std::shared_ptr<std::promise<int>> promise(std::make_shared<std::promise<int>>());
+  std::future<int> future(promise->get_future());
+  FlushAsync([promise](int result) { promise->set_value(result); });
+  return future;
+}
+
+void SelfEncryptor::FlushAsync(CompletionHandler handler) {
+  EnqueueAsync([this] { return Flush() ? kSuccess : kEncryptionException; }, handler);
+}
+
+void SelfEncryptor::EnqueueAsync(std::function<int()> operation, CompletionHandler handler) {
+  {
+    std::lock_guard<std::mutex> lock(async_mutex_);
+    async_operations_.push_back(std::make_pair(std::move(operation), std::move(handler)));
+    if (async_running_)
+      return;
+    async_running_ = true;
+  }
+  executor_.Post([this] { RunNextAsync(); });
+}
+
+void SelfEncryptor::RunNextAsync() {
+  SCOPED_PROFILE
+  std::pair<std::function<int()>, CompletionHandler> next;
+  {
+    std::lock_guard<std::mutex> lock(async_mutex_);
+    next = std::move(async_operations_.front());
+    async_operations_.pop_front();
+  }
+  int result(kEncryptionException);
+  try {
+    result = next.first();
+  }
+  catch (const std::exception& e) {
+    LOG(kError) << "Asynchronous call failed: " << e.what();
+  }
+
+  // The handler runs before the next call starts, so that calls also complete in order.  It may
+  // destroy this, in which case the destructor sets destroyed and nothing after touches this.
+  if (next.second) {
+    bool destroyed(false);
+    {
+      std::lock_guard<std::mutex> lock(async_mutex_);
+      async_handler_thread_ = std::this_thread::get_id();
+      async_destroyed_ = &destroyed;
+    }
+    try {
+      next.second(result);
+    }
+    catch (const std::exception& e) {
+      LOG(kError) << "Completion handler threw: " << e.what();
+    }
+    if (destroyed)
+      return;
+  }
+
+  // Once async_running_ is cleared this may be destroyed, so nothing after that touches it.
+  bool more(false);
+  {
+    std::lock_guard<std::mutex> lock(async_mutex_);
+    async_handler_thread_ = std::thread::id();
+    async_destroyed_ = nullptr;
+    more = !async_operations_.empty();
+    if (!more) {
+      async_running_ = false;
+      async_condition_.notify_all();
+    }
+  }
+  // One call per posted task, so that a busy file doesn't keep a thread to itself.
+  if (more)
+    executor_.Post([this] { RunNextAsync(); });
+}
+
 bool SelfEncryptor::ReadFromBuffer(char* data, uint32_t length, uint64_t position) {
   SCOPED_PROFILE
+  if (kOptions_.read_buffer_size == 0)
+    return false;
   if (!buffer_activated_) {
-    uint64_t diff((position > last_read_position_) ? (position - last_read_position_)
-                                                   : (last_read_position_ - position));
-    last_read_position_ = position;
-    if (diff > kDefaultByteArraySize_)
-      ++buffer_length_;
-    // trigger buffering once detected too many jumpping reading
-    if (buffer_length_ > 5) {
-      if (size() > kMaxBufferSize_)
-        buffer_length_ = kMaxBufferSize_;
+    // Other readers wait here while the buffer is filled, then read from it.
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    if (!buffer_activated_) {
+      uint64_t diff((position > last_read_position_) ? (position - last_read_position_)
+                                                     : (last_read_position_ - position));
+      last_read_position_ = position;
+      if (diff > kReadCacheSize_)
+        ++buffer_length_;
+      // trigger buffering once detected too many jumpping reading
+      if (buffer_length_ <= 5)
+        return false;
+      if (size() > kOptions_.read_buffer_size)
+        buffer_length_ = kOptions_.read_buffer_size;
       else
         buffer_length_ = static_cast<uint32_t>(size());
       try {
-        read_buffer_.reset(new char[buffer_length_]);
+        read_buffer_ = GetNewByteArray(buffer_length_, ByteArrayFill::kUninitialised,
+                                       ByteArrayBacking::kHugePages);
       }
       catch (const std::exception& e) {
         LOG(kError) << "Failed to read " << buffer_length_ << " bytes: " << e.what();
@@ -1135,35 +1918,32 @@ bool SelfEncryptor::ReadFromBuffer(char* data, uint32_t length, uint64_t positio
         return false;
       }
       // always buffering from 0
-      if (Transmogrify(read_buffer_.get(), buffer_length_, 0) != kSuccess) {
+      if (Transmogrify(reinterpret_cast<char*>(read_buffer_.get()), buffer_length_, 0) !=
+          kSuccess) {
         LOG(kError) << "Failed to read " << buffer_length_ << " bytes";
         return false;
       }
       buffer_activated_ = true;
     }
   }
-  if (buffer_activated_) {
-    if ((position + length) < buffer_length_) {
-      memcpy(data, read_buffer_.get() + position, length);
-      return true;
-    }
+  // Once activated, read_buffer_ and buffer_length_ only change during writes.
+  if ((position + length) < buffer_length_) {
+    memcpy(data, read_buffer_.get() + position, length);
+    return true;
   }
   return false;
 }
 
-void SelfEncryptor::PrepareToRead() {
-  SCOPED_PROFILE
-  if (prepared_for_reading_)
-    return;
-
-  read_cache_.reset(new char[kDefaultByteArraySize_]);
-  cache_start_position_ = std::numeric_limits<uint64_t>::max();
-  prepared_for_reading_ = true;
-}
-
 int SelfEncryptor::Transmogrify(char* data, uint32_t length, uint64_t position) {
   SCOPED_PROFILE
-  memset(data, 0, length);
+  // Stored chunks are decrypted straight into data, so unless in-process data is to be laid over
+  // them, only what lies beyond the end of the file needs zeroing.
+  if (prepared_for_writing_ || file_size_ < 3 * kMinChunkSize) {
+    memset(data, 0, length);
+  } else if (position + length > file_size_) {
+    uint32_t file_bytes(position < file_size_ ? static_cast<uint32_t>(file_size_ - position) : 0);
+    memset(data + file_bytes, 0, length - file_bytes);
+  }
 
   // For tiny files, all data is in data_map_.content or chunk0_raw_.
   if (file_size_ < 3 * kMinChunkSize) {
@@ -1195,6 +1975,11 @@ int SelfEncryptor::Transmogrify(char* data, uint32_t length, uint64_t position)
   if (!prepared_for_writing_)
     return kSuccess;
   ReadInProcessData(data, length, position);
+  // Until the next Flush, stored chunks can still hold data beyond a truncated end of the file.
+  if (position + length > file_size_) {
+    uint32_t file_bytes(position < file_size_ ? static_cast<uint32_t>(file_size_ - position) : 0);
+    memset(data + file_bytes, 0, length - file_bytes);
+  }
   return kSuccess;
 }
 
@@ -1207,22 +1992,25 @@ int SelfEncryptor::ReadDataMapChunks(char* data, uint32_t length, uint64_t posit
   uint32_t num_chunks = static_cast<uint32_t>(data_map_.chunks.size());
   if (normal_chunk_size_ != kDefaultChunkSize) {
     assert(file_size_ < 3 * kDefaultChunkSize + kMinChunkSize - 1);
-    ByteArray temp(GetNewByteArray(static_cast<uint32_t>(file_size_)));
-#ifdef MAIDSAFE_OMP_ENABLED
-#pragma omp parallel for
-#endif
-    for (int64_t i = 0; i < num_chunks; ++i) {
+    ByteArray temp(
+        GetNewByteArray(static_cast<uint32_t>(file_size_), ByteArrayFill::kUninitialised));
+    std::vector<uint32_t> chunk_nums(num_chunks);
+    std::iota(chunk_nums.begin(), chunk_nums.end(), 0);
+    std::vector<NonEmptyString> contents;
+    FetchStoredChunks(chunk_nums, &contents);
+    executor_.ParallelFor(0, num_chunks, [&](int64_t i) {
       uint32_t this_chunk_size(data_map_.chunks[static_cast<uint32_t>(i)].size);
       if (this_chunk_size != 0) {
         uint64_t offset = (static_cast<uint32_t>(i) * normal_chunk_size_);
-        int res = DecryptChunk(static_cast<uint32_t>(i), temp.get() + offset);
+        int res = DecryptChunk(static_cast<uint32_t>(i), temp.get() + offset,
+                               &contents[static_cast<size_t>(i)]);
         if (res != kSuccess) {
           std::lock_guard<std::mutex> guard(data_mutex_);
           LOG(kError) << "Failed to decrypt chunk " << i;
           result = res;
         }
       }
-    }
+    });
     if (result != kSuccess)
       return result;
 
@@ -1233,58 +2021,220 @@ int SelfEncryptor::ReadDataMapChunks(char* data, uint32_t length, uint64_t posit
 
   uint32_t first_chunk_index =
       std::min(num_chunks - 1, static_cast<uint32_t>(position / kDefaultChunkSize));
-  uint32_t first_chunk_offset(position % kDefaultChunkSize);
-  uint32_t first_chunk_size(0);
-  if (data_map_.chunks[first_chunk_index].size > first_chunk_offset)
-    first_chunk_size = data_map_.chunks[first_chunk_index].size - first_chunk_offset;
-
   uint32_t last_chunk_index =
       std::min(num_chunks - 1, static_cast<uint32_t>((position + length - 1) / kDefaultChunkSize));
-  uint32_t last_chunk_size(
-      std::min(static_cast<uint32_t>(position + length - (last_chunk_index * kDefaultChunkSize)),
-               data_map_.chunks[last_chunk_index].size));
 
-#ifdef MAIDSAFE_OMP_ENABLED
-#pragma omp parallel for
-#endif
-#ifdef __GNUC__
-  for (uint32_t i = first_chunk_index; i <= last_chunk_index; ++i) {
-#else
-  for (int64_t i = first_chunk_index; i <= last_chunk_index; ++i) {
-#endif
-    uint32_t this_chunk_size(data_map_.chunks[static_cast<uint32_t>(i)].size);
-    if (this_chunk_size != 0) {
-      if (i == first_chunk_index) {
-        ByteArray temp(GetNewByteArray(this_chunk_size));
-        int res = DecryptChunk(static_cast<uint32_t>(i), temp.get());
-        if (res != kSuccess) {
-          LOG(kError) << "Failed to decrypt chunk " << i;
-          result = res;
-        }
-        memcpy(data, temp.get() + first_chunk_offset, first_chunk_size);
-      } else if (i == last_chunk_index) {
-        ByteArray temp(GetNewByteArray(this_chunk_size));
-        int res = DecryptChunk(static_cast<uint32_t>(i), temp.get());
-        if (res != kSuccess) {
-          LOG(kError) << "Failed to decrypt chunk " << i;
-          result = res;
-        }
-        uint32_t offset = kDefaultChunkSize - first_chunk_offset +
-                          (last_chunk_index - first_chunk_index - 1) * kDefaultChunkSize;
-        memcpy(data + offset, temp.get(), last_chunk_size);
+  // Chunks already being read ahead aren't requested again.  Under a memory limit, only reads which
+  // fit in a read cache are fetched in one batch.
+  std::vector<uint32_t> chunk_nums;
+  std::vector<NonEmptyString> contents;
+  std::vector<const NonEmptyString*> chunk_contents(last_chunk_index - first_chunk_index + 1,
+                                                    nullptr);
+  if (kOptions_.batch_get_from_store && last_chunk_index != first_chunk_index &&
+      (kOptions_.memory_limit == 0 ||
+       last_chunk_index - first_chunk_index <= kOptions_.read_cache_chunks)) {
+    {
+      std::lock_guard<std::mutex> lock(read_mutex_);
+      for (uint32_t i(first_chunk_index); i <= last_chunk_index; ++i) {
+        if (prefetched_chunks_.count(i) == 0)
+          chunk_nums.push_back(i);
+      }
+    }
+    FetchStoredChunks(chunk_nums, &contents);
+    for (size_t i(0); i != chunk_nums.size(); ++i)
+      chunk_contents[chunk_nums[i] - first_chunk_index] = &contents[i];
+  }
+
+  // Each chunk is decrypted straight into its place in data, only the part of an edge chunk which
+  // was asked for being written.
+  executor_.ParallelFor(first_chunk_index, static_cast<int64_t>(last_chunk_index) + 1,
+                        [&](int64_t i) {
+    uint32_t chunk_num(static_cast<uint32_t>(i));
+    uint32_t this_chunk_size(data_map_.chunks[chunk_num].size);
+    const NonEmptyString* content(chunk_contents[chunk_num - first_chunk_index]);
+    uint64_t chunk_start(static_cast<uint64_t>(chunk_num) * kDefaultChunkSize);
+    uint64_t begin(std::max(position, chunk_start));
+    if (this_chunk_size == 0) {
+      // Not encrypted yet, so reads as zeros.
+      uint64_t end(std::min(position + length, chunk_start + kDefaultChunkSize));
+      if (begin < end)
+        memset(data + (begin - position), 0, static_cast<size_t>(end - begin));
+      return;
+    }
+    uint64_t end(std::min(position + length, chunk_start + this_chunk_size));
+    if (begin >= end)
+      return;
+    int res = FetchChunk(chunk_num, static_cast<uint32_t>(begin - chunk_start),
+                         static_cast<uint32_t>(end - begin),
+                         reinterpret_cast<byte*>(data + (begin - position)), content);
+    if (res != kSuccess) {
+      std::lock_guard<std::mutex> guard(data_mutex_);
+      LOG(kError) << "Failed to decrypt chunk " << i;
+      result = res;
+    }
+  });
+  return result;
+}
+
+int SelfEncryptor::FetchChunk(uint32_t chunk_num, uint32_t offset, uint32_t count, byte* data,
+                              const NonEmptyString* content) {
+  SCOPED_PROFILE
+  std::shared_ptr<PrefetchedChunk> prefetched;
+  {
+    std::unique_lock<std::mutex> lock(read_mutex_);
+    auto itr(prefetched_chunks_.find(chunk_num));
+    if (itr != prefetched_chunks_.end()) {
+      prefetched = itr->second;
+      prefetched_chunks_.erase(itr);
+      if (!prefetched->ready) {
+        // The reader has caught up with the prefetches, so look further ahead.
+        readahead_window_ = std::min(2 * readahead_window_, kOptions_.readahead_chunks);
+        WaitFor(&lock, &readahead_condition_, [&] { return prefetched->ready; });
       } else {
-        uint32_t offset = kDefaultChunkSize - first_chunk_offset +
-                          static_cast<uint32_t>(i - first_chunk_index - 1) * kDefaultChunkSize;
-        int res = DecryptChunk(static_cast<uint32_t>(i), reinterpret_cast<byte*>(&data[offset]));
-        if (res != kSuccess) {
-          std::lock_guard<std::mutex> guard(data_mutex_);
-          LOG(kError) << "Failed to decrypt chunk " << i;
-          result = res;
+        // Everything ahead is decrypted before it's needed, so fewer chunks would do.
+        bool all_ready(true);
+        for (const auto& entry : prefetched_chunks_)
+          all_ready = all_ready && entry.second->ready;
+        if (all_ready)
+          readahead_window_ = std::max(readahead_window_ - 1, kMinReadaheadChunks);
+      }
+    }
+  }
+
+  if (!prefetched || prefetched->result != kSuccess)
+    return DecryptChunk(chunk_num, offset, count, data, content);
+  memcpy(data, prefetched->data.get() + offset, count);
+  return kSuccess;
+}
+
+void SelfEncryptor::RecordRead(uint64_t position, uint32_t length) {
+  SCOPED_PROFILE
+  std::vector<std::pair<uint32_t, std::shared_ptr<PrefetchedChunk>>> to_fetch;
+  {
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    // Find the reader this read continues, or else replace the least recently used one.
+    ReadStream* stream(nullptr);
+    for (auto& candidate : read_streams_) {
+      if (candidate.next_position == position) {
+        stream = &candidate;
+        break;
+      }
+    }
+    bool sequential(stream != nullptr);
+    if (!sequential) {
+      if (read_streams_.size() < kMaxReadStreams) {
+        read_streams_.push_back(ReadStream());
+        stream = &read_streams_.back();
+      } else {
+        stream = &*std::min_element(read_streams_.begin(), read_streams_.end(),
+                                    [](const ReadStream& lhs, const ReadStream& rhs) {
+                                      return lhs.last_used < rhs.last_used;
+                                    });
+      }
+      stream->sequential_reads = 0;
+    }
+    stream->next_position = position + length;
+    stream->last_used = ++read_count_;
+
+    if (!sequential) {
+      // Drop chunks fetched for a reader which has gone elsewhere, and be more cautious next time.
+      const uint64_t kReach(kOptions_.readahead_chunks);
+      size_t prefetched_count(prefetched_chunks_.size());
+      for (auto itr(prefetched_chunks_.begin()); itr != prefetched_chunks_.end();) {
+        bool wanted(false);
+        for (const auto& other : read_streams_) {
+          uint64_t first(other.next_position / kDefaultChunkSize);
+          wanted = wanted || (itr->first >= first && itr->first <= first + kReach);
         }
+        if (wanted)
+          ++itr;
+        else
+          itr = prefetched_chunks_.erase(itr);
       }
+      if (prefetched_chunks_.size() != prefetched_count)
+        readahead_window_ = std::max(readahead_window_ / 2, kMinReadaheadChunks);
+      return;
+    }
+    if (++stream->sequential_reads < kSequentialReadsBeforeReadahead || prepared_for_writing_ ||
+        normal_chunk_size_ != kDefaultChunkSize || executor_.Concurrency() < 2 ||
+        kOptions_.readahead_chunks < kMinReadaheadChunks) {
+      return;
+    }
+
+    // Fetch from the chunk holding the end of the read, unless it's already in the read cache.
+    uint64_t end(position + length);
+    uint32_t num_chunks(static_cast<uint32_t>(data_map_.chunks.size()));
+    uint32_t first(static_cast<uint32_t>(
+        std::min(end / kDefaultChunkSize, static_cast<uint64_t>(num_chunks))));
+    uint32_t last(std::min(num_chunks, first + readahead_window_));
+    for (uint32_t chunk_num(first); chunk_num < last; ++chunk_num) {
+      if (data_map_.chunks[chunk_num].size == 0 || prefetched_chunks_.count(chunk_num) != 0 ||
+          read_cache_index_.count(chunk_num) != 0) {
+        continue;
+      }
+      std::shared_ptr<PrefetchedChunk> prefetched(std::make_shared<PrefetchedChunk>());
+      prefetched_chunks_.insert(std::make_pair(chunk_num, prefetched));
+      to_fetch.push_back(std::make_pair(chunk_num, prefetched));
+      ++prefetches_in_flight_;
     }
   }
-  return result;
+
+  // Posted outside the lock, as an executor may run the tasks on this thread.  With a batched
+  // fetch, one task requests all the chunks and then decrypts them in parallel.
+  if (kOptions_.batch_get_from_store && to_fetch.size() > 1) {
+    executor_.Post([this, to_fetch] {
+      std::vector<uint32_t> chunk_nums;
+      for (const auto& fetch : to_fetch)
+        chunk_nums.push_back(fetch.first);
+      std::vector<NonEmptyString> contents(to_fetch.size());
+      try {
+        FetchStoredChunks(chunk_nums, &contents);
+      }
+      catch (const std::exception& e) {
+        LOG(kError) << "Failed requesting chunks to prefetch: " << e.what();
+      }
+      executor_.ParallelFor(0, static_cast<int64_t>(to_fetch.size()), [&](int64_t i) {
+        const auto& fetch(to_fetch[static_cast<size_t>(i)]);
+        PrefetchChunk(fetch.first, fetch.second, &contents[static_cast<size_t>(i)]);
+      });
+    });
+    return;
+  }
+  for (const auto& fetch : to_fetch) {
+    uint32_t chunk_num(fetch.first);
+    std::shared_ptr<PrefetchedChunk> prefetched(fetch.second);
+    executor_.Post([this, chunk_num, prefetched] {
+      PrefetchChunk(chunk_num, prefetched, nullptr);
+    });
+  }
+}
+
+void SelfEncryptor::PrefetchChunk(uint32_t chunk_num, std::shared_ptr<PrefetchedChunk> prefetched,
+                                  const NonEmptyString* content) {
+  ByteArray data;
+  int result(kDecryptionException);
+  try {
+    data = GetNewByteArray(data_map_.chunks[chunk_num].size, ByteArrayFill::kUninitialised);
+    result = DecryptChunk(chunk_num, data.get(), content);
+  }
+  catch (const std::exception& e) {
+    LOG(kError) << "Failed prefetching chunk " << chunk_num << ": " << e.what();
+  }
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  prefetched->data = std::move(data);
+  prefetched->result = result;
+  prefetched->ready = true;
+  --prefetches_in_flight_;
+  readahead_condition_.notify_all();
+}
+
+void SelfEncryptor::DiscardReadahead() {
+  std::unique_lock<std::mutex> lock(read_mutex_);
+  WaitFor(&lock, &readahead_condition_, [this] { return prefetches_in_flight_ == 0; });
+  prefetched_chunks_.clear();
+  for (auto& stream : read_streams_)
+    stream.sequential_reads = 0;
+  readahead_window_ = kMinReadaheadChunks;
 }
 
 void SelfEncryptor::ReadInProcessData(char * data, uint32_t length, uint64_t position) {
@@ -1326,38 +2276,17 @@ void SelfEncryptor::ReadInProcessData(char * data, uint32_t length, uint64_t pos
   }
 
   // Get data from sequencer if required.
-  std::pair<uint64_t, ByteArray> sequence_block(sequencer_->Peek(length, position));
-  uint64_t sequence_block_position(sequence_block.first);
-  ByteArray sequence_block_data(sequence_block.second);
-  uint32_t sequence_block_size(Size(sequence_block.second));
-  uint64_t seq_position(position);
-  uint32_t sequence_block_offset(0);
-
-  while (position < sequence_block_position + sequence_block_size &&
-         position + length >= sequence_block_position) {
-    if (position < sequence_block_position) {
-      data_offset = static_cast<uint32_t>(sequence_block_position - position);
-      sequence_block_offset = 0;
-    } else {
-      data_offset = 0;
-      sequence_block_offset = static_cast<uint32_t>(position - sequence_block_position);
-    }
-    copy_length = std::min(length - data_offset,
-                           static_cast<uint32_t>(sequence_block_position + sequence_block_size -
-                                                 position - data_offset));
-
-    memcpy(data + data_offset, sequence_block_data.get() + sequence_block_offset, copy_length);
-
-    seq_position = sequence_block_position + sequence_block_size;
-    sequence_block = sequencer_->PeekBeyond(seq_position);
-    sequence_block_position = sequence_block.first;
-    sequence_block_data = sequence_block.second;
-    sequence_block_size = Size(sequence_block.second);
-  }
+  sequencer_->Read(data, length, position);
 }
 
 bool SelfEncryptor::Truncate(uint64_t position) {
   SCOPED_PROFILE
+  DiscardReadahead();
+  ClearReadCache();
+  if (CollectPipelineResult(true) != kSuccess) {
+    LOG(kError) << "Background encryption failed before truncating to " << position;
+    return false;
+  }
   if (position > file_size_)
     return TruncateUp(position);
   else if (position < file_size_)
@@ -1406,13 +2335,14 @@ bool SelfEncryptor::TruncateDown(uint64_t position) {
 
 bool SelfEncryptor::TruncateUp(uint64_t position) {
   SCOPED_PROFILE
-  if (file_size_ < kDefaultByteArraySize_) {
-    uint64_t target_position(std::min(position, static_cast<uint64_t>(kDefaultByteArraySize_)));
+  const uint32_t kQueueSize(kQueueCapacity_ - kDefaultChunkSize);
+  if (file_size_ < kQueueSize) {
+    uint64_t target_position(std::min(position, static_cast<uint64_t>(kQueueSize)));
     if (!AppendNulls(target_position)) {
       LOG(kError) << "Failed to append nulls to beyond end of Chunk 1";
       return false;
     }
-    if (position <= kDefaultByteArraySize_)
+    if (position <= kQueueSize)
       return true;
   }
   truncated_file_size_ = position;
@@ -1421,32 +2351,37 @@ bool SelfEncryptor::TruncateUp(uint64_t position) {
 
 bool SelfEncryptor::AppendNulls(uint64_t position) {
   SCOPED_PROFILE
-  std::unique_ptr<char[]> tail_data(new char[kDefaultByteArraySize_]);
-  memset(tail_data.get(), 0, kDefaultByteArraySize_);
+  const uint32_t kQueueSize(kQueueCapacity_ - kDefaultChunkSize);
+  std::unique_ptr<char[]> tail_data(new char[kQueueSize]);
+  memset(tail_data.get(), 0, kQueueSize);
   uint64_t current_position(file_size_);
   uint64_t length(position - current_position);
-  while (length > kDefaultByteArraySize_) {
-    if (!Write(tail_data.get(), kDefaultByteArraySize_, current_position))
+  while (length > kQueueSize) {
+    if (!Write(tail_data.get(), kQueueSize, current_position))
       return false;
-    current_position += kDefaultByteArraySize_;
-    length -= kDefaultByteArraySize_;
+    current_position += kQueueSize;
+    length -= kQueueSize;
   }
   return Write(tail_data.get(), static_cast<uint32_t>(length), current_position);
 }
 
 void SelfEncryptor::DeleteChunk(uint32_t chunk_num) {
-  SCOPED_PROFILE
-  std::lock_guard<std::mutex> data_guard(data_mutex_);
-  if (data_map_.chunks[chunk_num].hash.empty())
-    return;
-
   /*if (chunk_num < original_data_map_->chunks.size() &&
       data_map_.chunks[chunk_num].hash == original_data_map_->chunks[chunk_num].hash) {
     return;
   }*/
 
+  DeleteChunk(data_map_.chunks[chunk_num].hash);
+}
+
+void SelfEncryptor::DeleteChunk(const std::string& hash) {
+  SCOPED_PROFILE
+  std::lock_guard<std::mutex> data_guard(data_mutex_);
+  if (hash.empty())
+    return;
+
   try {
-    buffer_.Delete(data_map_.chunks[chunk_num].hash);
+    buffer_.Delete(hash);
   }
   catch (...) {
   }
@@ -16,6 +16,10 @@
     See the Licences for the specific language governing permissions and limitations relating to
     use of the MaidSafe Software.                                                                 */
 
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
 #include "boost/assert.hpp"
 #include "maidsafe/common/log.h"
 #include "maidsafe/encrypt/sequencer.h"
@@ -26,183 +30,322 @@ namespace maidsafe {
 namespace encrypt {
 
 namespace {
-const SequenceBlock kInvalidSeqBlock(std::make_pair(std::numeric_limits<uint64_t>::max(),
-                                                    ByteArray()));
-}  // unnamed namespace
+const uint64_t kInvalidSeqPosition(std::numeric_limits<uint64_t>::max());
+const SequenceBlockExtent kInvalidSeqBlockExtent(kInvalidSeqPosition, 0);
 
-int Sequencer::Add(const char* data, uint32_t length, uint64_t position) {
-  try {
-    // If the insertion point is past the current end, just insert a new element
-    if (blocks_.empty() ||
-        position > (*blocks_.rbegin()).first + Size((*blocks_.rbegin()).second)) {
-      auto result = blocks_.insert(std::make_pair(position, GetNewByteArray(length)));
-      assert(result.second);
-      if (MemCopy((*(result.first)).second, 0, data, length) != length) {
-        LOG(kError) << "Error adding " << length << " bytes to sequencer at " << position;
-        return kSequencerAddError;
-      }
-      return kSuccess;
-    }
+template <typename Block>
+SequenceBlockExtent Extent(const std::pair<const uint64_t, Block>& block) {
+  return SequenceBlockExtent(block.first, Size(block.second));
+}
 
-    auto lower_itr = blocks_.lower_bound(position);
-    auto upper_itr = blocks_.upper_bound(position + length);
+template <typename BlockMap>
+SequenceBlockExtent PeekBeyondIn(const BlockMap& blocks, uint64_t position) {
+  auto itr(blocks.lower_bound(position));
+  return itr == blocks.end() ? kInvalidSeqBlockExtent : Extent(*itr);
+}
 
-    // Check to see if new data spans part of, or joins onto, data of element
-    // preceding lower_itr
-    if (lower_itr == blocks_.end() ||
-        (lower_itr != blocks_.begin() && (*lower_itr).first != position)) {
-      --lower_itr;
-      if ((*lower_itr).first + Size((*lower_itr).second) < position)
-        ++lower_itr;
-    }
+template <typename BlockMap>
+SequenceBlockExtent PeekIn(const BlockMap& blocks, uint32_t length, uint64_t position) {
+  if (blocks.empty())
+    return kInvalidSeqBlockExtent;
 
-    uint64_t lower_start_position((*lower_itr).first);
-    uint64_t new_start_position(position);
-    uint32_t pre_overlap_size(0);
-    bool reduced_upper(false);
+  auto itr(blocks.lower_bound(position));
+  if (itr != blocks.end() && (*itr).first == position)
+    return Extent(*itr);
 
-    if (position > lower_start_position) {
-      assert(position - lower_start_position < std::numeric_limits<uint32_t>::max());
-      pre_overlap_size = static_cast<uint32_t>(position - lower_start_position);
-      new_start_position = lower_start_position;
-    }
+  if (itr == blocks.end() || itr != blocks.begin())
+    --itr;
 
-    // Check to see if new data spans part of, or joins onto, data of element
-    // preceding upper_itr
-    if (upper_itr != blocks_.begin()) {
-      --upper_itr;
-      reduced_upper = true;
-    }
-    uint64_t upper_start_position((*upper_itr).first);
-    uint32_t upper_size(Size((*upper_itr).second));
-
-    uint64_t post_overlap_posn(position + length);
-    uint32_t post_overlap_size(0);
-
-    if ((position + length) < (upper_start_position + upper_size) && reduced_upper) {
-      assert(upper_size > post_overlap_posn - upper_start_position);
-      assert(upper_size - (post_overlap_posn - upper_start_position) <
-                   std::numeric_limits<uint32_t>::max());
-      post_overlap_size =
-          upper_size - static_cast<uint32_t>(post_overlap_posn - upper_start_position);
-    }
+  if ((*itr).first < position) {
+    if ((*itr).first + Size((*itr).second) > position)
+      return Extent(*itr);
+    else
+      ++itr;
+  }
 
-    ByteArray new_entry = GetNewByteArray(pre_overlap_size + length + post_overlap_size);
+  if (itr == blocks.end())
+    return kInvalidSeqBlockExtent;
 
-    if (MemCopy(new_entry, 0, (*lower_itr).second.get(), pre_overlap_size) != pre_overlap_size) {
-      LOG(kError) << "Error adding pre-overlap";
-      return kSequencerAddError;
-    }
+  return ((*itr).first < length + position) ? Extent(*itr) : kInvalidSeqBlockExtent;
+}
 
-    if (MemCopy(new_entry, pre_overlap_size, data, length) != length) {
-      LOG(kError) << "Error adding mid-overlap";
-      return kSequencerAddError;
-    }
+// The block which spans position, or if none, the first one starting after it.
+template <typename BlockMap>
+typename BlockMap::iterator FindFrom(BlockMap* blocks, uint64_t position) {
+  auto itr(blocks->lower_bound(position));
+  if (itr != blocks->begin()) {
+    auto previous(std::prev(itr));
+    if ((*previous).first + Size((*previous).second) > position)
+      return previous;
+  }
+  return itr;
+}
 
-    if (MemCopy(new_entry, pre_overlap_size + length,
-                (*upper_itr).second.get() + (post_overlap_posn - upper_start_position),
-                post_overlap_size) != post_overlap_size) {
-      LOG(kError) << "Error adding post-overlap";
-      return kSequencerAddError;
-    }
+// The block which starts before position and ends after it, or end() if none does.
+template <typename BlockMap>
+typename BlockMap::iterator FindSpanning(BlockMap* blocks, uint64_t position) {
+  auto itr(FindFrom(blocks, position));
+  return (itr != blocks->end() && (*itr).first < position) ? itr : blocks->end();
+}
+
+// The two tiers never overlap, so the block starting first is the one wanted.
+SequenceBlockExtent Earlier(const SequenceBlockExtent& lhs, const SequenceBlockExtent& rhs) {
+  return lhs.first <= rhs.first ? lhs : rhs;
+}
+
+std::shared_ptr<SequenceBuffer> NewBuffer(const byte* data, uint32_t size, uint64_t position) {
+  ByteArray copy(GetNewByteArray(size, ByteArrayFill::kUninitialised));
+  memcpy(copy.get(), data, size);
+  return std::make_shared<SequenceBuffer>(std::move(copy), position);
+}
 
-    if (reduced_upper)
-      ++upper_itr;
-    blocks_.erase(lower_itr, upper_itr);
-    auto result = blocks_.insert(std::make_pair(new_start_position, new_entry));
-    assert(result.second);
-    static_cast<void>(result);
+SequencePiece WholePiece(ByteArray data, uint64_t position) {
+  uint32_t size(Size(data));
+  return SequencePiece(std::make_shared<SequenceBuffer>(std::move(data), position), 0, size);
+}
+}  // unnamed namespace
+
+Sequencer::Sequencer(uint64_t spill_threshold)
+    : kSpillThreshold_(spill_threshold),
+      blocks_(),
+      spilled_blocks_(),
+      spill_file_(),
+      memory_size_(0),
+      spilled_size_(0) {}
+
+Sequencer::~Sequencer() {}
+
+int Sequencer::Add(const char* data, uint32_t length, uint64_t position) {
+  if (length == 0)
+    return kSuccess;
+  try {
+    EraseFromSpill(position, position + length);
+    EraseFromMemory(position, position + length);
+    if (kSpillThreshold_ != 0 && length > kSpillThreshold_) {
+      // Too big to hold at all, so goes straight to the spill file without being copied first.
+      Spill(reinterpret_cast<const byte*>(data), length, position);
+    } else {
+      Insert(position, SequencePiece(NewBuffer(reinterpret_cast<const byte*>(data), length,
+                                               position), 0, length));
+      if (kSpillThreshold_ != 0)
+        SpillExcess();
+    }
   }
   catch (const std::exception& e) {
-    // TODO(DI) here we need to catch the error - likely out of mem.  We
-    // should then set up a flilestream in boost::tmp_dir, empty sequencer and
-    // this write data to the file and set a flag to say we have written a
-    // fstream.  All further writes to fstream.  On destruct - write all data
-    // from fstream to SE::write method. This will encrypt whole file.  Write
-    // 0s where there are 0s in the fstream.  Read from fstream as well as
-    // write, maybe make protected getter/setter and we can run all tests
-    // against the fstream as well.  Else fail ???
-    LOG(kError) << e.what();
+    LOG(kError) << "Error adding " << length << " bytes to sequencer at " << position << ": "
+                << e.what();
     return kSequencerException;
   }
   return kSuccess;
 }
 
-ByteArray Sequencer::Get(uint64_t position) {
+SequencePiece Sequencer::Get(uint64_t position) {
   auto itr(blocks_.find(position));
-  if (itr == blocks_.end())
-    return ByteArray();
-  ByteArray result((*itr).second);
-  blocks_.erase(itr);
+  if (itr == blocks_.end()) {
+    auto spilled_itr(spilled_blocks_.find(position));
+    return spilled_itr == spilled_blocks_.end() ? SequencePiece()
+                                                : WholePiece(Unspill(spilled_itr), position);
+  }
+  SequencePiece result((*itr).second);
+  Remove(itr);
   return result;
 }
 
 SequenceBlock Sequencer::GetFirst() {
-  if (blocks_.empty())
-    return kInvalidSeqBlock;
-  auto result(*blocks_.begin());
-  blocks_.erase(blocks_.begin());
+  if (blocks_.empty() && spilled_blocks_.empty())
+    return SequenceBlock(kInvalidSeqPosition, SequencePiece());
+  if (blocks_.empty() ||
+      (!spilled_blocks_.empty() && spilled_blocks_.begin()->first < blocks_.begin()->first)) {
+    uint64_t position(spilled_blocks_.begin()->first);
+    return SequenceBlock(position, WholePiece(Unspill(spilled_blocks_.begin()), position));
+  }
+  SequenceBlock result(*blocks_.begin());
+  Remove(blocks_.begin());
   return result;
 }
 
-SequenceBlock Sequencer::PeekBeyond(uint64_t position) const {
-  auto itr(blocks_.lower_bound(position));
-  return itr == blocks_.end() ? kInvalidSeqBlock : *itr;
+std::vector<SequenceBlock> Sequencer::GetBefore(uint64_t position) {
+  std::vector<SequenceBlock> result;
+  SplitAt(position);
+  while (PeekBeyond(0).first < position)
+    result.push_back(GetFirst());
+  if (kSpillThreshold_ != 0)
+    SpillExcess();
+  return result;
 }
 
-SequenceBlock Sequencer::Peek(uint32_t length, uint64_t position) const {
-  if (blocks_.empty())
-    return kInvalidSeqBlock;
+SequenceBlockExtent Sequencer::PeekBeyond(uint64_t position) const {
+  return Earlier(PeekBeyondIn(blocks_, position), PeekBeyondIn(spilled_blocks_, position));
+}
 
-  auto itr(blocks_.lower_bound(position));
-  if (itr != blocks_.end() && (*itr).first == position)
-    return *itr;
+SequenceBlockExtent Sequencer::Peek(uint32_t length, uint64_t position) const {
+  return Earlier(PeekIn(blocks_, length, position), PeekIn(spilled_blocks_, length, position));
+}
 
-  if (itr == blocks_.end() || itr != blocks_.begin())
-    --itr;
+void Sequencer::Read(char* data, uint32_t length, uint64_t position) const {
+  const uint64_t kEnd(position + length);
+  SequenceBlockExtent block(Peek(length, position));
+  while (block.first < kEnd) {
+    uint64_t copy_start(std::max(block.first, position));
+    uint32_t block_offset(static_cast<uint32_t>(copy_start - block.first));
+    uint32_t copy_size(static_cast<uint32_t>(
+        std::min(block.first + block.second, kEnd) - copy_start));
+    char* destination(data + (copy_start - position));
+    auto itr(blocks_.find(block.first));
+    if (itr != blocks_.end()) {
+      memcpy(destination, (*itr).second.get() + block_offset, copy_size);
+    } else {
+      spill_file_->Read(spilled_blocks_.find(block.first)->second, block_offset, copy_size,
+                        reinterpret_cast<byte*>(destination));
+    }
+    block = PeekBeyond(block.first + block.second);
+  }
+}
 
-  if ((*itr).first < position) {
-    if ((*itr).first + Size((*itr).second) > position)
-      return *itr;
-    else
-      ++itr;
+void Sequencer::Truncate(uint64_t position) {
+  EraseFromMemory(position, kInvalidSeqPosition);
+  EraseFromSpill(position, kInvalidSeqPosition);
+}
+
+void Sequencer::clear() {
+  blocks_.clear();
+  spilled_blocks_.clear();
+  spill_file_.reset();
+  memory_size_ = 0;
+  spilled_size_ = 0;
+}
+
+void Sequencer::Insert(uint64_t position, const SequencePiece& piece) {
+  SequenceBuffer& buffer(*piece.buffer());
+  if (buffer.live == 0)
+    memory_size_ += Size(buffer.data);
+  buffer.live += Size(piece);
+  auto result(blocks_.insert(std::make_pair(position, piece)));
+  assert(result.second);
+  static_cast<void>(result);
+}
+
+SequenceBlockMap::iterator Sequencer::Remove(SequenceBlockMap::iterator itr) {
+  SequenceBuffer& buffer(*(*itr).second.buffer());
+  assert(buffer.live >= Size((*itr).second));
+  buffer.live -= Size((*itr).second);
+  if (buffer.live == 0)
+    memory_size_ -= Size(buffer.data);
+  return blocks_.erase(itr);
+}
+
+void Sequencer::EraseFromMemory(uint64_t position, uint64_t end) {
+  std::vector<std::shared_ptr<SequenceBuffer>> trimmed;
+  auto itr(FindFrom(&blocks_, position));
+  while (itr != blocks_.end() && (*itr).first < end) {
+    uint64_t piece_position((*itr).first);
+    SequencePiece piece((*itr).second);
+    uint64_t piece_end(piece_position + Size(piece));
+    itr = Remove(itr);
+    if (piece_position < position) {
+      Insert(piece_position,
+             piece.Slice(0, static_cast<uint32_t>(position - piece_position)));
+    }
+    if (piece_end > end) {
+      Insert(end, piece.Slice(static_cast<uint32_t>(end - piece_position),
+                              static_cast<uint32_t>(piece_end - end)));
+    }
+    if (piece.buffer()->live != 0)
+      trimmed.push_back(piece.buffer());
+  }
+  for (const auto& buffer : trimmed) {
+    if (buffer->live != 0 && 2 * static_cast<uint64_t>(buffer->live) < Size(buffer->data))
+      Compact(buffer);
   }
+}
 
-  if (itr == blocks_.end())
-    return kInvalidSeqBlock;
+void Sequencer::EraseFromSpill(uint64_t position, uint64_t end) {
+  auto itr(FindFrom(&spilled_blocks_, position));
+  while (itr != spilled_blocks_.end() && (*itr).first < end) {
+    uint64_t block_position((*itr).first);
+    uint64_t block_end(block_position + Size((*itr).second));
+    if (block_position >= position && block_end <= end) {
+      spill_file_->Free((*itr).second);
+      spilled_size_ -= Size((*itr).second);
+      itr = spilled_blocks_.erase(itr);
+      continue;
+    }
+    // Only the pieces at either edge are partly kept, and each is at most kMaxExtentSize.
+    auto next(std::next(itr));
+    ByteArray block(Unspill(itr));
+    if (block_position < position)
+      Spill(block.get(), static_cast<uint32_t>(position - block_position), block_position);
+    if (block_end > end)
+      Spill(block.get() + (end - block_position), static_cast<uint32_t>(block_end - end), end);
+    itr = next;
+  }
+}
 
-  return ((*itr).first < length + position) ? *itr : kInvalidSeqBlock;
+void Sequencer::Compact(const std::shared_ptr<SequenceBuffer>& buffer) {
+  const uint64_t kEnd(buffer->position + Size(buffer->data));
+  for (auto itr(blocks_.lower_bound(buffer->position));
+       itr != blocks_.end() && (*itr).first < kEnd; ++itr) {
+    if ((*itr).second.buffer() != buffer)
+      continue;
+    uint32_t size(Size((*itr).second));
+    auto copy(NewBuffer((*itr).second.get(), size, (*itr).first));
+    copy->live = size;
+    memory_size_ += size;
+    buffer->live -= size;
+    (*itr).second = SequencePiece(copy, 0, size);
+  }
+  assert(buffer->live == 0);
+  memory_size_ -= Size(buffer->data);
 }
 
-void Sequencer::Truncate(uint64_t position) {
-  if (blocks_.empty())
+void Sequencer::SplitAt(uint64_t position) {
+  auto itr(FindSpanning(&blocks_, position));
+  if (itr != blocks_.end()) {
+    uint32_t head_size(static_cast<uint32_t>(position - (*itr).first));
+    SequencePiece tail((*itr).second.Slice(head_size, Size((*itr).second) - head_size));
+    (*itr).second = (*itr).second.Slice(0, head_size);
+    blocks_.insert(std::make_pair(position, tail));
     return;
+  }
+  auto spilled_itr(FindSpanning(&spilled_blocks_, position));
+  if (spilled_itr != spilled_blocks_.end()) {
+    uint64_t block_position((*spilled_itr).first);
+    SequencePiece block(WholePiece(Unspill(spilled_itr), block_position));
+    uint32_t head_size(static_cast<uint32_t>(position - block_position));
+    Insert(block_position, block.Slice(0, head_size));
+    Insert(position, block.Slice(head_size, Size(block) - head_size));
+  }
+}
 
-  // Find the block which spans position, or if none, the first one starting
-  // after position
-  auto lower_itr(blocks_.lower_bound(position));
-  if (lower_itr == blocks_.end() ||
-      (lower_itr != blocks_.begin() && (*lower_itr).first != position)) {
-    --lower_itr;
+void Sequencer::Spill(const byte* data, uint32_t length, uint64_t position) {
+  if (!spill_file_)
+    spill_file_.reset(new SpillFile);
+  uint32_t spilled(0);
+  while (spilled != length) {
+    uint32_t piece_size(std::min(length - spilled, SpillFile::kMaxExtentSize));
+    SpillExtent extent(spill_file_->Write(data + spilled, piece_size));
+    spilled_blocks_.insert(std::make_pair(position + spilled, extent));
+    spilled_size_ += piece_size;
+    spilled += piece_size;
   }
-  if ((*lower_itr).first < position) {
-    // If it spans, truncate the block
-    if ((*lower_itr).first + Size((*lower_itr).second) > position) {
-      uint32_t reduced_size =
-          static_cast<uint32_t>((*lower_itr).first + Size((*lower_itr).second) - position);
-      ByteArray temp(GetNewByteArray(reduced_size));
-#ifndef NDEBUG
-      uint32_t copied =
-#endif
-          MemCopy(temp, 0, (*lower_itr).second.get(), reduced_size);
-      assert(reduced_size == copied);
-      (*lower_itr).second = temp;
-    }
-    // Move to first block past position
-    ++lower_itr;
+}
+
+// The blocks furthest into the file will be the last to be taken by the write queue or Flush.
+void Sequencer::SpillExcess() {
+  while (memory_size_ > kSpillThreshold_ && !blocks_.empty()) {
+    auto last(std::prev(blocks_.end()));
+    Spill((*last).second.get(), Size((*last).second), (*last).first);
+    Remove(last);
   }
+}
 
-  blocks_.erase(lower_itr, blocks_.end());
+ByteArray Sequencer::Unspill(SpilledBlockMap::iterator itr) {
+  ByteArray block(GetNewByteArray(Size((*itr).second), ByteArrayFill::kUninitialised));
+  spill_file_->Read((*itr).second, 0, Size(block), block.get());
+  spill_file_->Free((*itr).second);
+  spilled_size_ -= Size(block);
+  spilled_blocks_.erase(itr);
+  return block;
 }
 
 }  // namespace encrypt
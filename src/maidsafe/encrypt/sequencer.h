@@ -22,45 +22,125 @@
 #include <cstdint>
 #include <limits>
 #include <map>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include "maidsafe/encrypt/byte_array.h"
+#include "maidsafe/encrypt/spill_file.h"
 
 namespace maidsafe {
 
 namespace encrypt {
 
-typedef std::map<uint64_t, ByteArray> SequenceBlockMap;
-typedef SequenceBlockMap::value_type SequenceBlock;
+// The bytes of one Add, shared by every piece still referring to them.  live counts the bytes of
+// those pieces still held by the Sequencer.
+struct SequenceBuffer {
+  SequenceBuffer(ByteArray data_in, uint64_t position_in)
+      : data(std::move(data_in)), position(position_in), live(0) {}
+  ByteArray data;
+  uint64_t position;
+  uint32_t live;
+};
+
+// A run of sequenced data within a SequenceBuffer.  Splitting or trimming a run only makes new
+// pieces of the same buffer, so no data is copied.
+class SequencePiece {
+ public:
+  SequencePiece() : buffer_(), offset_(0), size_(0) {}
+  SequencePiece(std::shared_ptr<SequenceBuffer> buffer, uint32_t offset, uint32_t size)
+      : buffer_(std::move(buffer)), offset_(offset), size_(size) {}
+  byte* get() const { return buffer_ ? buffer_->data.get() + offset_ : nullptr; }
+  uint32_t size() const { return size_; }
+  explicit operator bool() const { return buffer_ != nullptr; }
+  // The piece covering count bytes from offset bytes into this one.
+  SequencePiece Slice(uint32_t offset, uint32_t count) const {
+    return SequencePiece(buffer_, offset_ + offset, count);
+  }
+  const std::shared_ptr<SequenceBuffer>& buffer() const { return buffer_; }
 
+ private:
+  std::shared_ptr<SequenceBuffer> buffer_;
+  uint32_t offset_, size_;
+};
+
+inline uint32_t Size(const SequencePiece& piece) { return piece.size(); }
+
+typedef std::map<uint64_t, SequencePiece> SequenceBlockMap;
+typedef std::map<uint64_t, SpillExtent> SpilledBlockMap;
+typedef std::pair<uint64_t, SequencePiece> SequenceBlock;
+// Position and size of a block held by the Sequencer.
+typedef std::pair<uint64_t, uint32_t> SequenceBlockExtent;
+
+// Holds data written out of order until it can be used, as a piece table: each Add copies its
+// data once into a new buffer, and only trims or splits the pieces of earlier writes which it
+// overlaps.  Neighbouring blocks are never joined, so a block may adjoin the next.  A buffer kept
+// alive by pieces covering less than half of it is compacted, so overwritten data doesn't pin
+// memory.
+//
+// If spill_threshold is non-zero, then once the buffers held in memory exceed it, the blocks
+// furthest into the file are moved to a SpillFile until they no longer do.  Spilled blocks are
+// split into pieces of at most SpillFile::kMaxExtentSize.  Blocks never overlap, whichever of the
+// two tiers they are held in, and every method covers both tiers.
 class Sequencer {
  public:
-  Sequencer() : blocks_() {}
-  // Adds a new block to the map.  If this overlaps or joins any existing ones,
-  // the new block is set to cover the total span of all the overlapping blocks
-  // and the old ones are removed.
+  explicit Sequencer(uint64_t spill_threshold = 0);
+  ~Sequencer();
+  // Adds a new block to the map, replacing whatever parts of existing blocks it
+  // overlaps.
   int Add(const char* data, uint32_t length, uint64_t position);
   // Returns and removes the block of sequenced data at position in the map.  If
-  // no block exists at position, it returns a default (NULL) ByteArray.
-  ByteArray Get(uint64_t position);
+  // no block exists at position, it returns a default (NULL) SequencePiece.
+  SequencePiece Get(uint64_t position);
   // Returns and removes the first block of sequenced data in the map.  If the
-  // map is empty, it returns kInvalidSeqBlock.
+  // map is empty, it returns a block at kInvalidSeqPosition.
   SequenceBlock GetFirst();
+  // Returns and removes, in order, every block of sequenced data before
+  // position, splitting any block which spans it.
+  std::vector<SequenceBlock> GetBefore(uint64_t position);
   // Returns without removing the first block of sequenced data in the map which
-  // compares >= position.  If this is the map end, it returns kInvalidSeqBlock.
-  SequenceBlock PeekBeyond(uint64_t position) const;
+  // compares >= position.  If this is the map end, it returns kInvalidSeqBlockExtent.
+  SequenceBlockExtent PeekBeyond(uint64_t position) const;
   // Returns without removing the first block of sequenced data in the map which
   // has data contained within area defined by position and length.  If this is
-  // the map end, it returns kInvalidSeqBlock.
-  SequenceBlock Peek(uint32_t length, uint64_t position) const;
+  // the map end, it returns kInvalidSeqBlockExtent.
+  SequenceBlockExtent Peek(uint32_t length, uint64_t position) const;
+  // Copies whatever sequenced data lies within the area defined by position and
+  // length over the corresponding bytes of data, leaving the rest untouched.
+  // May be called concurrently, but not alongside any of the non-const methods.
+  void Read(char* data, uint32_t length, uint64_t position) const;
   // Removes all blocks after position, and reduces any block spanning position
   // to terminate at position.
   void Truncate(uint64_t position);
-  void clear() { blocks_.clear(); }
+  // Total bytes held, whether in memory or spilled.
+  uint64_t size() const { return memory_size_ + spilled_size_; }
+  // Bytes of the buffers held in memory, including any overwritten parts not yet compacted.
+  uint64_t memory_size() const { return memory_size_; }
+  void clear();
 
  private:
   Sequencer& operator=(const Sequencer&);
   Sequencer(const Sequencer&);
+  void Insert(uint64_t position, const SequencePiece& piece);
+  // Removes the piece at itr from blocks_, returning the iterator following it.
+  SequenceBlockMap::iterator Remove(SequenceBlockMap::iterator itr);
+  // Removes the given area from blocks_, keeping any parts of blocks either side of it.
+  void EraseFromMemory(uint64_t position, uint64_t end);
+  // Removes the given area from spilled_blocks_, re-spilling any parts of pieces either side.
+  void EraseFromSpill(uint64_t position, uint64_t end);
+  // Gives each piece of buffer its own copy of its data, so that the rest can be freed.
+  void Compact(const std::shared_ptr<SequenceBuffer>& buffer);
+  // Ensures that no block in either tier spans position.
+  void SplitAt(uint64_t position);
+  void Spill(const byte* data, uint32_t length, uint64_t position);
+  void SpillExcess();
+  ByteArray Unspill(SpilledBlockMap::iterator itr);
+
+  const uint64_t kSpillThreshold_;
   SequenceBlockMap blocks_;
+  SpilledBlockMap spilled_blocks_;
+  std::unique_ptr<SpillFile> spill_file_;
+  uint64_t memory_size_, spilled_size_;
 };
 
 }  // namespace encrypt
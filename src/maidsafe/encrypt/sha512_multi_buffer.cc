@@ -0,0 +1,123 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/encrypt/sha512_multi_buffer.h"
+
+#include <algorithm>
+
+#include "maidsafe/encrypt/cpu_features.h"
+#include "maidsafe/encrypt/crypto_backend.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace detail {
+
+const uint64_t kSha512RoundConstants[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL};
+
+const uint64_t kSha512InitialState[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL};
+
+}  // namespace detail
+
+namespace {
+
+typedef void (*MultiBufferKernel)(const byte* const*, size_t, byte* const*);
+
+struct MultiBufferEngine {
+  MultiBufferKernel kernel;
+  size_t lanes;
+  // Fewest messages worth a pass of the kernel; fewer are hashed singly by the crypto backend.
+  size_t min_messages;
+};
+
+MultiBufferEngine SelectEngine() {
+  MultiBufferEngine engine = {nullptr, 1, 1};
+#ifdef MAIDSAFE_ENCRYPT_X86_SIMD
+  const CpuFeatures& features(GetCpuFeatures());
+  if (features.avx512f) {
+    engine.kernel = &detail::Sha512MultiBufferAvx512;
+    engine.lanes = 8;
+    engine.min_messages = 5;
+  } else if (features.avx2) {
+    engine.kernel = &detail::Sha512MultiBufferAvx2;
+    engine.lanes = 4;
+    engine.min_messages = 3;
+  }
+#endif
+  return engine;
+}
+
+const MultiBufferEngine& GetEngine() {
+  static const MultiBufferEngine engine(SelectEngine());
+  return engine;
+}
+
+}  // unnamed namespace
+
+void Sha512MultiBuffer(const byte* const* data, size_t length, size_t count,
+                       byte* const* digests) {
+  const MultiBufferEngine& engine(GetEngine());
+  size_t done(0);
+  if (engine.kernel) {
+    const byte* lane_data[8];
+    byte* lane_digests[8];
+    byte unused_digest[64];
+    while (count - done >= engine.min_messages) {
+      // A short final batch repeats the first message in the spare lanes and discards the result.
+      for (size_t lane(0); lane != engine.lanes; ++lane) {
+        const bool kInUse(done + lane < count);
+        lane_data[lane] = data[kInUse ? done + lane : done];
+        lane_digests[lane] = kInUse ? digests[done + lane] : unused_digest;
+      }
+      engine.kernel(lane_data, length, lane_digests);
+      done += std::min(engine.lanes, count - done);
+    }
+  }
+  const CryptoBackend& backend(GetCryptoBackend());
+  for (; done != count; ++done)
+    backend.Sha512(data[done], length, digests[done]);
+}
+
+size_t Sha512MultiBufferLanes() { return GetEngine().lanes; }
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
@@ -0,0 +1,59 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_ENCRYPT_SHA512_MULTI_BUFFER_H_
+#define MAIDSAFE_ENCRYPT_SHA512_MULTI_BUFFER_H_
+
+#include <cstdint>
+
+#include "cryptopp/config.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+// Writes the SHA-512 digests of "count" independent messages, each "length" bytes long, to
+// digests[0] to digests[count - 1].  Where the CPU allows, the messages are hashed together in
+// the 64-bit lanes of AVX-512 (8 messages) or AVX2 (4 messages) registers, which is considerably
+// faster per message than hashing them one at a time.  Any leftover messages too few to fill a
+// worthwhile share of the lanes are hashed by the crypto backend.
+void Sha512MultiBuffer(const byte* const* data, size_t length, size_t count,
+                       byte* const* digests);
+
+// The number of messages hashed per pass by Sha512MultiBuffer on this CPU; 1 if no vector
+// implementation is available.  Callers get the best throughput batching multiples of this.
+size_t Sha512MultiBufferLanes();
+
+namespace detail {
+
+extern const uint64_t kSha512RoundConstants[80];
+extern const uint64_t kSha512InitialState[8];
+
+#ifdef MAIDSAFE_ENCRYPT_X86_SIMD
+// Hash exactly 4 or 8 messages respectively.
+void Sha512MultiBufferAvx2(const byte* const* data, size_t length, byte* const* digests);
+void Sha512MultiBufferAvx512(const byte* const* data, size_t length, byte* const* digests);
+#endif
+
+}  // namespace detail
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_ENCRYPT_SHA512_MULTI_BUFFER_H_
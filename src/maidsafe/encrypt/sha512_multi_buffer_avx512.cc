@@ -0,0 +1,78 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+// Compiled with AVX-512F code generation enabled (see CMakeLists.txt).  Only called after a
+// runtime check confirms the CPU supports it.
+
+#include "maidsafe/encrypt/sha512_multi_buffer.h"
+
+#ifdef MAIDSAFE_ENCRYPT_X86_SIMD
+#include <immintrin.h>
+
+#include "maidsafe/encrypt/sha512_multi_buffer_impl.h"
+#endif
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace detail {
+
+#ifdef MAIDSAFE_ENCRYPT_X86_SIMD
+namespace {
+
+// Uses the native 64-bit rotate, and ternary logic for the three-input functions.
+struct Avx512Lanes {
+  typedef __m512i Vector;
+  enum { kLanes = 8 };
+
+  static Vector Set1(uint64_t value) { return _mm512_set1_epi64(static_cast<int64_t>(value)); }
+  static Vector Load(const uint64_t* source) { return _mm512_loadu_si512(source); }
+  static void Store(uint64_t* target, Vector value) { _mm512_storeu_si512(target, value); }
+  static Vector Add(Vector lhs, Vector rhs) { return _mm512_add_epi64(lhs, rhs); }
+  static Vector Xor3(Vector x, Vector y, Vector z) {
+    return _mm512_ternarylogic_epi64(x, y, z, 0x96);
+  }
+  template <int bits>
+  static Vector Ror(Vector value) {
+    return _mm512_ror_epi64(value, bits);
+  }
+  template <int bits>
+  static Vector Shr(Vector value) {
+    return _mm512_srli_epi64(value, bits);
+  }
+  static Vector Ch(Vector x, Vector y, Vector z) {
+    return _mm512_ternarylogic_epi64(x, y, z, 0xca);
+  }
+  static Vector Maj(Vector x, Vector y, Vector z) {
+    return _mm512_ternarylogic_epi64(x, y, z, 0xe8);
+  }
+};
+
+}  // unnamed namespace
+
+void Sha512MultiBufferAvx512(const byte* const* data, size_t length, byte* const* digests) {
+  Sha512MultiBufferHash<Avx512Lanes>(data, length, digests);
+}
+#endif
+
+}  // namespace detail
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
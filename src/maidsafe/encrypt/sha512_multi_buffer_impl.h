@@ -0,0 +1,171 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+// Lane-generic SHA-512 (FIPS 180-4) used by the ISA-specific multi-buffer kernels.  Each kernel
+// supplies a "Lanes" policy wrapping its vector type and includes this from its own translation
+// unit, so the template is only ever instantiated with the matching code generation flags.
+
+#ifndef MAIDSAFE_ENCRYPT_SHA512_MULTI_BUFFER_IMPL_H_
+#define MAIDSAFE_ENCRYPT_SHA512_MULTI_BUFFER_IMPL_H_
+
+#include <cstdint>
+#include <cstring>
+
+#include "maidsafe/encrypt/sha512_multi_buffer.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace detail {
+
+const size_t kSha512BlockSize(128);
+
+inline uint64_t LoadBigEndian64(const byte* source) {
+  uint64_t value(0);
+  for (int i(0); i != 8; ++i)
+    value = (value << 8) | source[i];
+  return value;
+}
+
+// One round in place: *d receives the new e and *h the new a.  Successive rounds rotate the roles
+// of the eight variables rather than moving them.
+template <typename Lanes>
+inline void Sha512Round(const typename Lanes::Vector& a, const typename Lanes::Vector& b,
+                        const typename Lanes::Vector& c, typename Lanes::Vector* d,
+                        const typename Lanes::Vector& e, const typename Lanes::Vector& f,
+                        const typename Lanes::Vector& g, typename Lanes::Vector* h,
+                        const typename Lanes::Vector& constant_plus_word) {
+  typedef typename Lanes::Vector Vector;
+  const Vector sum1(Lanes::Xor3(Lanes::template Ror<14>(e), Lanes::template Ror<18>(e),
+                                Lanes::template Ror<41>(e)));
+  const Vector temp1(Lanes::Add(Lanes::Add(*h, sum1),
+                                Lanes::Add(Lanes::Ch(e, f, g), constant_plus_word)));
+  const Vector sum0(Lanes::Xor3(Lanes::template Ror<28>(a), Lanes::template Ror<34>(a),
+                                Lanes::template Ror<39>(a)));
+  *d = Lanes::Add(*d, temp1);
+  *h = Lanes::Add(temp1, Lanes::Add(sum0, Lanes::Maj(a, b, c)));
+}
+
+// "words" holds the 16 message words of one block for every lane, word-major, i.e. word t of lane
+// l is words[t * Lanes::kLanes + l].
+template <typename Lanes>
+void Sha512MultiBufferCompress(typename Lanes::Vector* state, const uint64_t* words) {
+  typedef typename Lanes::Vector Vector;
+  // The whole message schedule is expanded up front so that the rounds below index it directly.
+  Vector w[80];
+  for (int t(0); t != 16; ++t)
+    w[t] = Lanes::Load(words + t * Lanes::kLanes);
+  for (int t(16); t != 80; ++t) {
+    const Vector& w15(w[t - 15]);
+    const Vector& w2(w[t - 2]);
+    const Vector s0(Lanes::Xor3(Lanes::template Ror<1>(w15), Lanes::template Ror<8>(w15),
+                                Lanes::template Shr<7>(w15)));
+    const Vector s1(Lanes::Xor3(Lanes::template Ror<19>(w2), Lanes::template Ror<61>(w2),
+                                Lanes::template Shr<6>(w2)));
+    w[t] = Lanes::Add(Lanes::Add(w[t - 16], s0), Lanes::Add(w[t - 7], s1));
+  }
+
+  Vector a(state[0]), b(state[1]), c(state[2]), d(state[3]);
+  Vector e(state[4]), f(state[5]), g(state[6]), h(state[7]);
+  for (int t(0); t != 80; t += 8) {
+    const uint64_t* constants(kSha512RoundConstants + t);
+    Sha512Round<Lanes>(a, b, c, &d, e, f, g, &h, Lanes::Add(Lanes::Set1(constants[0]), w[t]));
+    Sha512Round<Lanes>(h, a, b, &c, d, e, f, &g, Lanes::Add(Lanes::Set1(constants[1]), w[t + 1]));
+    Sha512Round<Lanes>(g, h, a, &b, c, d, e, &f, Lanes::Add(Lanes::Set1(constants[2]), w[t + 2]));
+    Sha512Round<Lanes>(f, g, h, &a, b, c, d, &e, Lanes::Add(Lanes::Set1(constants[3]), w[t + 3]));
+    Sha512Round<Lanes>(e, f, g, &h, a, b, c, &d, Lanes::Add(Lanes::Set1(constants[4]), w[t + 4]));
+    Sha512Round<Lanes>(d, e, f, &g, h, a, b, &c, Lanes::Add(Lanes::Set1(constants[5]), w[t + 5]));
+    Sha512Round<Lanes>(c, d, e, &f, g, h, a, &b, Lanes::Add(Lanes::Set1(constants[6]), w[t + 6]));
+    Sha512Round<Lanes>(b, c, d, &e, f, g, h, &a, Lanes::Add(Lanes::Set1(constants[7]), w[t + 7]));
+  }
+
+  state[0] = Lanes::Add(state[0], a);
+  state[1] = Lanes::Add(state[1], b);
+  state[2] = Lanes::Add(state[2], c);
+  state[3] = Lanes::Add(state[3], d);
+  state[4] = Lanes::Add(state[4], e);
+  state[5] = Lanes::Add(state[5], f);
+  state[6] = Lanes::Add(state[6], g);
+  state[7] = Lanes::Add(state[7], h);
+}
+
+template <typename Lanes>
+void Sha512MultiBufferHash(const byte* const* data, size_t length, byte* const* digests) {
+  typedef typename Lanes::Vector Vector;
+  const size_t kLanes(Lanes::kLanes);
+  Vector state[8];
+  for (int i(0); i != 8; ++i)
+    state[i] = Lanes::Set1(kSha512InitialState[i]);
+
+  uint64_t words[16 * kLanes];
+  const size_t kFullBlocks(length / kSha512BlockSize);
+  for (size_t block(0); block != kFullBlocks; ++block) {
+    for (size_t lane(0); lane != kLanes; ++lane) {
+      const byte* source(data[lane] + block * kSha512BlockSize);
+      for (size_t t(0); t != 16; ++t)
+        words[t * kLanes + lane] = LoadBigEndian64(source + 8 * t);
+    }
+    Sha512MultiBufferCompress<Lanes>(state, words);
+  }
+
+  // The messages all have the same length, so they all need the same number of final blocks: the
+  // remaining bytes, 0x80, zeros and the 128-bit big-endian bit count.
+  const size_t kTailSize(length % kSha512BlockSize);
+  const size_t kFinalBlocks(kTailSize < kSha512BlockSize - 16 ? 1 : 2);
+  byte tails[kLanes][2 * kSha512BlockSize];
+  for (size_t lane(0); lane != kLanes; ++lane) {
+    byte* tail(tails[lane]);
+    memset(tail, 0, sizeof(tails[lane]));
+    memcpy(tail, data[lane] + kFullBlocks * kSha512BlockSize, kTailSize);
+    tail[kTailSize] = 0x80;
+    byte* bit_count(tail + kFinalBlocks * kSha512BlockSize - 16);
+    const uint64_t kHigh(static_cast<uint64_t>(length) >> 61);
+    const uint64_t kLow(static_cast<uint64_t>(length) << 3);
+    for (int i(0); i != 8; ++i) {
+      bit_count[i] = static_cast<byte>(kHigh >> (56 - 8 * i));
+      bit_count[8 + i] = static_cast<byte>(kLow >> (56 - 8 * i));
+    }
+  }
+  for (size_t block(0); block != kFinalBlocks; ++block) {
+    for (size_t lane(0); lane != kLanes; ++lane) {
+      const byte* source(tails[lane] + block * kSha512BlockSize);
+      for (size_t t(0); t != 16; ++t)
+        words[t * kLanes + lane] = LoadBigEndian64(source + 8 * t);
+    }
+    Sha512MultiBufferCompress<Lanes>(state, words);
+  }
+
+  uint64_t result[8 * kLanes];
+  for (int i(0); i != 8; ++i)
+    Lanes::Store(result + i * kLanes, state[i]);
+  for (size_t lane(0); lane != kLanes; ++lane) {
+    for (int i(0); i != 8; ++i) {
+      for (int j(0); j != 8; ++j)
+        digests[lane][8 * i + j] = static_cast<byte>(result[i * kLanes + lane] >> (56 - 8 * j));
+    }
+  }
+}
+
+}  // namespace detail
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_ENCRYPT_SHA512_MULTI_BUFFER_IMPL_H_
@@ -0,0 +1,202 @@
+/*  Copyright 2011 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/encrypt/spill_file.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "boost/filesystem/operations.hpp"
+#include "boost/interprocess/file_mapping.hpp"
+#include "boost/interprocess/mapped_region.hpp"
+#include "maidsafe/common/crypto.h"
+#include "maidsafe/common/error.h"
+#include "maidsafe/common/log.h"
+#include "maidsafe/common/utils.h"
+
+#include "maidsafe/encrypt/config.h"
+#include "maidsafe/encrypt/crypto_backend.h"
+
+namespace fs = boost::filesystem;
+namespace bi = boost::interprocess;
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace {
+
+// The file grows, and is mapped, this many bytes at a time.
+const uint64_t kSegmentSize(64 * kDefaultChunkSize);
+
+}  // unnamed namespace
+
+const uint32_t SpillFile::kMaxExtentSize(kDefaultChunkSize);
+
+SpillFile::SpillFile()
+    : path_(),
+      mapping_(),
+      segments_(),
+      free_space_(),
+      key_(),
+      next_nonce_(0) {
+  std::string key(RandomString(crypto::AES256_KeySize));
+  key_.assign(key.begin(), key.end());
+}
+
+SpillFile::~SpillFile() {
+  std::fill(key_.begin(), key_.end(), 0);
+  segments_.clear();
+  mapping_.reset();
+  if (!path_.empty()) {
+    boost::system::error_code error_code;
+    fs::remove(path_, error_code);
+    if (error_code)
+      LOG(kWarning) << "Failed to remove " << path_ << ": " << error_code.message();
+  }
+}
+
+SpillExtent SpillFile::Write(const byte* data, uint32_t size) {
+  assert(size <= kMaxExtentSize);
+  SpillExtent extent;
+  extent.offset = Allocate(size);
+  extent.size = size;
+  extent.nonce = next_nonce_++;
+  try {
+    byte iv[crypto::AES256_IVSize];
+    Iv(extent.nonce, iv);
+    std::unique_ptr<StreamCipher> encryptor(GetCryptoBackend().NewAes256CfbEncryptor());
+    encryptor->SetKeyWithIv(key_.data(), iv);
+    encryptor->ProcessData(Address(extent.offset), data, size);
+  }
+  catch (...) {
+    Free(extent);
+    throw;
+  }
+  return extent;
+}
+
+void SpillFile::Read(const SpillExtent& extent, uint32_t offset, uint32_t length,
+                     byte* data) const {
+  assert(static_cast<uint64_t>(offset) + length <= extent.size);
+  if (length == 0)
+    return;
+  // In CFB mode each block's IV is the ciphertext of the block before, so decryption can start at
+  // whichever block holds offset.
+  const uint32_t kBlockSize(crypto::AES256_IVSize);
+  const byte* cipher_text(Address(extent.offset));
+  uint32_t block_start(offset - offset % kBlockSize);
+  byte iv[crypto::AES256_IVSize];
+  if (block_start == 0)
+    Iv(extent.nonce, iv);
+  else
+    memcpy(iv, cipher_text + block_start - kBlockSize, kBlockSize);
+  std::unique_ptr<StreamCipher> decryptor(GetCryptoBackend().NewAes256CfbDecryptor());
+  decryptor->SetKeyWithIv(key_.data(), iv);
+
+  if (block_start != offset) {
+    byte block[crypto::AES256_IVSize];
+    uint32_t block_size(std::min(kBlockSize, extent.size - block_start));
+    decryptor->ProcessData(block, cipher_text + block_start, block_size);
+    uint32_t copy_size(std::min(length, block_start + block_size - offset));
+    memcpy(data, block + (offset - block_start), copy_size);
+    data += copy_size;
+    length -= copy_size;
+    offset = block_start + block_size;
+  }
+  if (length != 0)
+    decryptor->ProcessData(data, cipher_text + offset, length);
+}
+
+void SpillFile::Free(const SpillExtent& extent) {
+  if (extent.size == 0)
+    return;
+  uint64_t offset(extent.offset), size(extent.size);
+  auto next(free_space_.lower_bound(offset));
+  if (next != free_space_.begin()) {
+    auto previous(next);
+    --previous;
+    if (previous->first + previous->second == offset &&
+        previous->first / kSegmentSize == offset / kSegmentSize) {
+      offset = previous->first;
+      size += previous->second;
+      free_space_.erase(previous);
+    }
+  }
+  if (next != free_space_.end() && offset + size == next->first &&
+      next->first / kSegmentSize == offset / kSegmentSize) {
+    size += next->second;
+    free_space_.erase(next);
+  }
+  free_space_.insert(std::make_pair(offset, size));
+}
+
+uint64_t SpillFile::Allocate(uint32_t size) {
+  auto itr(std::find_if(free_space_.begin(), free_space_.end(),
+                        [size](const std::pair<const uint64_t, uint64_t>& run) {
+                          return run.second >= size;
+                        }));
+  if (itr == free_space_.end()) {
+    AddSegment();
+    itr = --free_space_.end();
+  }
+  uint64_t offset(itr->first), remaining(itr->second - size);
+  free_space_.erase(itr);
+  if (remaining != 0)
+    free_space_.insert(std::make_pair(offset + size, remaining));
+  return offset;
+}
+
+void SpillFile::AddSegment() {
+  uint64_t file_size(segments_.size() * kSegmentSize);
+  if (!mapping_) {
+    path_ = fs::temp_directory_path() /
+            fs::unique_path("maidsafe_encrypt_spill_%%%%-%%%%-%%%%-%%%%");
+    std::ofstream file(path_.string(), std::ios::binary | std::ios::trunc);
+    if (!file) {
+      LOG(kError) << "Failed to create " << path_;
+      path_.clear();
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::unable_to_handle_request));
+    }
+  }
+  fs::resize_file(path_, file_size + kSegmentSize);
+  if (!mapping_)
+    mapping_.reset(new bi::file_mapping(path_.string().c_str(), bi::read_write));
+  segments_.emplace_back(new bi::mapped_region(*mapping_, bi::read_write,
+                                               static_cast<bi::offset_t>(file_size),
+                                               static_cast<size_t>(kSegmentSize)));
+  free_space_.insert(std::make_pair(file_size, kSegmentSize));
+}
+
+byte* SpillFile::Address(uint64_t offset) const {
+  return static_cast<byte*>(segments_[static_cast<size_t>(offset / kSegmentSize)]->get_address()) +
+         offset % kSegmentSize;
+}
+
+void SpillFile::Iv(uint64_t nonce, byte* iv) const {
+  memset(iv, 0, crypto::AES256_IVSize);
+  for (int i(0); i != 8; ++i)
+    iv[i] = static_cast<byte>(nonce >> (8 * i));
+}
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
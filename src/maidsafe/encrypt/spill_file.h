@@ -0,0 +1,90 @@
+/*  Copyright 2011 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_ENCRYPT_SPILL_FILE_H_
+#define MAIDSAFE_ENCRYPT_SPILL_FILE_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "boost/filesystem/path.hpp"
+#include "cryptopp/config.h"
+
+namespace boost {
+namespace interprocess {
+class file_mapping;
+class mapped_region;
+}  // namespace interprocess
+}  // namespace boost
+
+namespace maidsafe {
+
+namespace encrypt {
+
+// Where a run of bytes was stored in a SpillFile.
+struct SpillExtent {
+  SpillExtent() : offset(0), size(0), nonce(0) {}
+  uint64_t offset;
+  uint32_t size;
+  uint64_t nonce;
+};
+
+inline uint32_t Size(const SpillExtent& extent) { return extent.size; }
+
+// Temporary file, memory-mapped a segment at a time, holding runs of bytes which would otherwise
+// take up memory.  Each run is encrypted with AES-256-CFB under a random key which only ever
+// exists in this object, using a fresh IV per run, so nothing readable is left on disk.  The file
+// is created by the first Write and removed on destruction.  Space freed is reused by later
+// writes.  Read may be called concurrently, but not alongside Write or Free.  Failures throw.
+class SpillFile {
+ public:
+  // Most bytes which a single Write may store.
+  static const uint32_t kMaxExtentSize;
+
+  SpillFile();
+  ~SpillFile();
+  SpillExtent Write(const byte* data, uint32_t size);
+  // Decrypts length bytes starting offset bytes into extent.
+  void Read(const SpillExtent& extent, uint32_t offset, uint32_t length, byte* data) const;
+  void Free(const SpillExtent& extent);
+
+ private:
+  SpillFile(const SpillFile&);
+  SpillFile& operator=(const SpillFile&);
+
+  uint64_t Allocate(uint32_t size);
+  void AddSegment();
+  byte* Address(uint64_t offset) const;
+  void Iv(uint64_t nonce, byte* iv) const;
+
+  boost::filesystem::path path_;
+  std::unique_ptr<boost::interprocess::file_mapping> mapping_;
+  std::vector<std::unique_ptr<boost::interprocess::mapped_region>> segments_;
+  // Unused runs of the file, by offset.  None crosses a segment boundary.
+  std::map<uint64_t, uint64_t> free_space_;
+  std::vector<byte> key_;
+  uint64_t next_nonce_;
+};
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_ENCRYPT_SPILL_FILE_H_
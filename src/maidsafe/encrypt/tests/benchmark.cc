@@ -16,7 +16,10 @@
     See the Licences for the specific language governing permissions and limitations relating to
     use of the MaidSafe Software.                                                                 */
 
+#include <atomic>
 #include <chrono>
+#include <cstdlib>
+#include <new>
 
 #include "boost/filesystem/operations.hpp"
 
@@ -24,10 +27,31 @@
 #include "maidsafe/common/test.h"
 #include "maidsafe/common/data_stores/local_store.h"
 
+#include "maidsafe/encrypt/byte_array.h"
+#include "maidsafe/encrypt/chunk_codec.h"
+#include "maidsafe/encrypt/config.h"
+#include "maidsafe/encrypt/sequencer.h"
 #include "maidsafe/encrypt/tests/encrypt_test_base.h"
 
 namespace fs = boost::filesystem;
 
+namespace {
+
+// Counts every heap allocation made by this executable, so benchmarks can report allocations per
+// operation.
+std::atomic<uint64_t> g_allocation_count(0);
+
+}  // unnamed namespace
+
+void* operator new(size_t size) {
+  ++g_allocation_count;
+  if (void* memory = std::malloc(size == 0 ? 1 : size))
+    return memory;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+
 namespace maidsafe {
 
 namespace encrypt {
@@ -48,25 +72,32 @@ class Benchmark : public EncryptTestBase, public testing::TestWithParam<uint32_t
 
  protected:
   void PrintResult(const chrono_time_point& start_time, const chrono_time_point& stop_time,
-                   bool encrypting, bool compressible) {
+                   bool encrypting, const std::string& description) {
     uint64_t duration =
         std::chrono::duration_cast<std::chrono::microseconds>(stop_time - start_time).count();
     if (duration == 0)
       duration = 1;
     uint64_t rate((static_cast<uint64_t>(kTestDataSize_) * 1000000) / duration);
     std::string encrypted(encrypting ? "Self-encrypted " : "Self-decrypted ");
-    std::string comp(compressible ? "compressible" : "incompressible");
-    std::cout << encrypted << BytesToBinarySiUnits(kTestDataSize_) << " of " << comp << " data in "
+    std::cout << encrypted << BytesToBinarySiUnits(kTestDataSize_) << " of " << description
+              << " data in "
               << BytesToBinarySiUnits(kPieceSize_) << " pieces in " << (duration / 1000)
               << " milliseconds at a speed of " << BytesToBinarySiUnits(rate) << "/s\n";
   }
-  void WriteThenRead(bool compressible) {
+  // Starts a new file using the given version, discarding the current one.
+  void ResetSelfEncryptor(EncryptionAlgorithm version) {
+    self_encryptor_.reset();
+    data_map_ = DataMap();
+    data_map_.self_encryption_version = version;
+    self_encryptor_.reset(new SelfEncryptor(data_map_, local_store_, get_from_store_, options_));
+  }
+  void WriteThenRead(const std::string& description) {
     chrono_time_point start_time(std::chrono::high_resolution_clock::now());
     for (uint32_t i(0); i < kTestDataSize_; i += kPieceSize_)
       ASSERT_TRUE(self_encryptor_->Write(&original_[i], kPieceSize_, i));
     self_encryptor_->Flush();
     chrono_time_point stop_time(std::chrono::high_resolution_clock::now());
-    PrintResult(start_time, stop_time, true, compressible);
+    PrintResult(start_time, stop_time, true, description);
 
     start_time = std::chrono::high_resolution_clock::now();
     for (uint32_t i(0); i < kTestDataSize_; i += kPieceSize_)
@@ -74,23 +105,124 @@ class Benchmark : public EncryptTestBase, public testing::TestWithParam<uint32_t
     stop_time = std::chrono::high_resolution_clock::now();
     for (uint32_t i(0); i < kTestDataSize_; ++i)
       ASSERT_EQ(original_[i], decrypted_[i]) << "failed @ count " << i;
-    PrintResult(start_time, stop_time, false, compressible);
+    PrintResult(start_time, stop_time, false, description);
+
+    ByteArrayPoolStatistics pool(GetByteArrayPoolStatistics());
+    std::cout << "ByteArray pool served " << pool.pool_hits << " of " << pool.allocations
+              << " buffers (" << static_cast<int>(pool.HitRate() * 100) << "%) and holds "
+              << BytesToBinarySiUnits(pool.bytes_held) << '\n';
   }
   const uint32_t kTestDataSize_, kPieceSize_;
 };
 
 TEST_P(Benchmark, FUNC_BenchmarkCompressible) {
   memset(original_.get(), 'a', kTestDataSize_);
-  WriteThenRead(true);
+  WriteThenRead("compressible");
 }
 
 TEST_P(Benchmark, FUNC_BenchmarkIncompressible) {
   memcpy(original_.get(), RandomString(kTestDataSize_).data(), kTestDataSize_);
-  WriteThenRead(true);
+  WriteThenRead("incompressible");
+
+  // Version 1 probes each chunk and stores incompressible ones without running them through gzip.
+  ResetSelfEncryptor(EncryptionAlgorithm::kSelfEncryptionVersion1);
+  WriteThenRead("incompressible (probed)");
+  CompressionStatistics statistics(self_encryptor_->compression_statistics());
+  std::cout << "Probe skipped compression of " << statistics.chunks_skipped << " of "
+            << statistics.chunks_probed << " chunks ("
+            << BytesToBinarySiUnits(statistics.bytes_skipped) << ")\n";
+  EXPECT_EQ(statistics.chunks_probed, statistics.chunks_skipped);
 }
 
 INSTANTIATE_TEST_CASE_P(WriteRead, Benchmark, testing::Values(0, 4096, 65536, 1048576));
 
+// Encodes and decodes many 4KB chunks, as for a directory of small files, where the per-chunk
+// setup of cipher, deflate and key buffers is significant.  The first chunk on a thread creates
+// the reusable contexts; later chunks should only rekey them.
+TEST(ChunkCodecBenchmark, FUNC_SmallChunkSetupCost) {
+  const uint32_t kChunkSize(4096);
+  const int kChunkCount(20000);
+  std::string data(RandomString(kChunkSize / 2) + std::string(kChunkSize / 2, 'a'));
+  std::string key(RandomString(crypto::AES256_KeySize)), iv(RandomString(crypto::AES256_IVSize));
+  std::string pad(RandomString(kPadSize));
+  std::string encoded(MaxEncodedChunkSize(CompressionType::kGzip, kChunkSize), 0);
+  std::string decoded(kChunkSize, 0);
+  auto round_trip([&] {
+    uint32_t encoded_size(0);
+    ASSERT_EQ(kSuccess, EncodeChunk(reinterpret_cast<const byte*>(data.data()), kChunkSize,
+                                    CompressionType::kGzip, 1,
+                                    reinterpret_cast<const byte*>(key.data()),
+                                    reinterpret_cast<const byte*>(iv.data()),
+                                    reinterpret_cast<const byte*>(pad.data()),
+                                    reinterpret_cast<byte*>(&encoded[0]), &encoded_size));
+    ASSERT_EQ(kSuccess, DecodeChunk(reinterpret_cast<const byte*>(encoded.data()), encoded_size,
+                                    CompressionType::kGzip,
+                                    reinterpret_cast<const byte*>(key.data()),
+                                    reinterpret_cast<const byte*>(iv.data()),
+                                    reinterpret_cast<const byte*>(pad.data()),
+                                    reinterpret_cast<byte*>(&decoded[0]), kChunkSize));
+  });
+
+  uint64_t allocations(g_allocation_count);
+  round_trip();
+  std::cout << "First 4KB chunk encoded and decoded with " << g_allocation_count - allocations
+            << " allocations\n";
+  ASSERT_EQ(data, decoded);
+
+  allocations = g_allocation_count;
+  std::chrono::time_point<std::chrono::high_resolution_clock> start_time(
+      std::chrono::high_resolution_clock::now());
+  for (int i(0); i != kChunkCount; ++i)
+    round_trip();
+  uint64_t duration(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::high_resolution_clock::now() - start_time).count());
+  std::cout << "Further " << kChunkCount << " 4KB chunks encoded and decoded with "
+            << static_cast<double>(g_allocation_count - allocations) / kChunkCount
+            << " allocations and " << static_cast<double>(duration) / kChunkCount
+            << " microseconds per chunk\n";
+  EXPECT_EQ(data, decoded);
+}
+
+// Adds many small adjoining blocks, as from a file system writing out of order, then takes them
+// out a chunk at a time as Flush does.  The even-numbered blocks go in first, back to front, and
+// then each odd-numbered one fills the gap between two of them.
+TEST(SequencerBenchmark, FUNC_InterleavedSmallWrites) {
+  const uint32_t kBlockSize(1024);
+  const uint32_t kBlockCount(100000);
+  std::string data(RandomString(kBlockSize * kBlockCount));
+  Sequencer sequencer;
+
+  uint64_t allocations(g_allocation_count);
+  std::chrono::time_point<std::chrono::high_resolution_clock> start_time(
+      std::chrono::high_resolution_clock::now());
+  for (uint32_t parity(0); parity != 2; ++parity) {
+    for (uint32_t i(kBlockCount - 2 + parity); i < kBlockCount; i -= 2) {
+      ASSERT_EQ(kSuccess, sequencer.Add(&data[static_cast<size_t>(i) * kBlockSize], kBlockSize,
+                                        static_cast<uint64_t>(i) * kBlockSize));
+    }
+  }
+  uint64_t duration(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::high_resolution_clock::now() - start_time).count());
+  std::cout << kBlockCount << " interleaved " << BytesToBinarySiUnits(kBlockSize)
+            << " blocks added in " << duration / 1000 << " milliseconds with "
+            << static_cast<double>(g_allocation_count - allocations) / kBlockCount
+            << " allocations per block\n";
+  EXPECT_EQ(static_cast<uint64_t>(kBlockSize) * kBlockCount, sequencer.size());
+
+  std::string sequenced;
+  start_time = std::chrono::high_resolution_clock::now();
+  for (uint64_t end(kDefaultChunkSize); sequencer.size() != 0; end += kDefaultChunkSize) {
+    for (const auto& block : sequencer.GetBefore(end)) {
+      ASSERT_EQ(sequenced.size(), block.first);
+      sequenced.append(reinterpret_cast<const char*>(block.second.get()), Size(block.second));
+    }
+  }
+  duration = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::high_resolution_clock::now() - start_time).count();
+  std::cout << "Taken back a chunk at a time in " << duration / 1000 << " milliseconds\n";
+  EXPECT_EQ(data, sequenced);
+}
+
 // This test is to allow confirmation that memory usage is capped at an
 // acceptable level.  While the test is running, memory usage must be visually
 // monitored.
@@ -109,7 +241,8 @@ TEST(MassiveFile, FUNC_MemCheck) {
 
   DataMap data_map;
   std::unique_ptr<SelfEncryptor> self_encryptor(new SelfEncryptor(data_map, buffer,
-      [&buffer](const std::string& name) { return buffer.Get(name); }, kNumProcs));
+      [&buffer](const std::string& name) { return buffer.Get(name); },
+      OptionsWithParallelism(kNumProcs)));
 
   const uint32_t kDataSize((1 << 20) + 1);
   boost::scoped_array<char> original(new char[kDataSize]);
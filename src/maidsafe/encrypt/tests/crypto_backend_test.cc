@@ -0,0 +1,167 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "maidsafe/common/test.h"
+#include "maidsafe/common/utils.h"
+
+#include "maidsafe/encrypt/blake2b.h"
+#include "maidsafe/encrypt/crypto_backend.h"
+#include "maidsafe/encrypt/sha512_multi_buffer.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace test {
+
+namespace {
+
+std::string Sha512(const CryptoBackend& backend, const std::string& input) {
+  std::string digest(64, 0);
+  backend.Sha512(reinterpret_cast<const byte*>(input.data()), input.size(),
+                 reinterpret_cast<byte*>(&digest[0]));
+  return digest;
+}
+
+// Hashes input in randomly-sized pieces to exercise the incremental interface.
+std::string IncrementalSha512(const CryptoBackend& backend, const std::string& input) {
+  std::unique_ptr<HashFunction> hash(backend.NewSha512());
+  size_t done(0);
+  while (done != input.size()) {
+    size_t length(std::min(input.size() - done, static_cast<size_t>(RandomUint32() % 300)));
+    hash->Update(reinterpret_cast<const byte*>(input.data()) + done, length);
+    done += length;
+  }
+  std::string digest(hash->DigestSize(), 0);
+  hash->Final(reinterpret_cast<byte*>(&digest[0]));
+  return digest;
+}
+
+// Encrypts or decrypts input in randomly-sized pieces, which must continue the same CFB stream.
+std::string Aes256Cfb(const CryptoBackend& backend, bool encrypt, const std::string& key,
+                      const std::string& iv, const std::string& input) {
+  std::unique_ptr<StreamCipher> cipher(encrypt ? backend.NewAes256CfbEncryptor()
+                                               : backend.NewAes256CfbDecryptor());
+  cipher->SetKeyWithIv(reinterpret_cast<const byte*>(key.data()),
+                       reinterpret_cast<const byte*>(iv.data()));
+  std::string output(input);
+  size_t done(0);
+  while (done != output.size()) {
+    size_t length(std::min(output.size() - done, static_cast<size_t>(RandomUint32() % 100)));
+    byte* data(reinterpret_cast<byte*>(&output[0]) + done);
+    cipher->ProcessData(data, data, length);
+    done += length;
+  }
+  return output;
+}
+
+void ExpectConformance(const CryptoBackend& reference, const CryptoBackend& backend) {
+  for (size_t size : {0U, 1U, 15U, 16U, 17U, 111U, 112U, 128U, 129U, 4096U, 65537U}) {
+    std::string input(RandomString(size));
+    std::string expected_digest(Sha512(reference, input));
+    EXPECT_EQ(expected_digest, Sha512(backend, input)) << backend.name() << ", size " << size;
+    EXPECT_EQ(expected_digest, IncrementalSha512(backend, input)) << backend.name();
+
+    std::string key(RandomString(32)), iv(RandomString(16));
+    std::string cipher_text(Aes256Cfb(reference, true, key, iv, input));
+    EXPECT_EQ(cipher_text, Aes256Cfb(backend, true, key, iv, input)) << backend.name();
+    EXPECT_EQ(input, Aes256Cfb(backend, false, key, iv, cipher_text)) << backend.name();
+  }
+}
+
+}  // unnamed namespace
+
+TEST(CryptoBackendTest, BEH_SelectedBackendMatchesCryptoPP) {
+  ExpectConformance(GetCryptoPPBackend(), GetCryptoPPBackend());
+  ExpectConformance(GetCryptoPPBackend(), GetCryptoBackend());
+}
+
+#ifdef MAIDSAFE_ENCRYPT_OPENSSL_BACKEND
+TEST(CryptoBackendTest, BEH_OpenSslMatchesCryptoPP) {
+  ExpectConformance(GetCryptoPPBackend(), GetOpenSslBackend());
+  ExpectConformance(GetOpenSslBackend(), GetCryptoPPBackend());
+}
+#endif
+
+TEST(Blake2bTest, BEH_KnownAnswers) {
+  // Test vectors from RFC 7693 Appendix A and the BLAKE2 reference implementation.
+  const std::pair<std::string, std::string> kVectors[] = {
+      {"",
+       "786a02f742015903c6c6fd852552d272912f4740e15847618a86e217f71f5419d25e1031afee585313896444"
+       "934eb04b903a685b1448b755d56f701afe9be2ce"},
+      {"abc",
+       "ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6fdbffa2d17d87c5392aab792dc252d5de"
+       "4533cc9518d38aa8dbf1925ab92386edd4009923"}};
+  for (const auto& vector : kVectors) {
+    std::string digest(Blake2b512::kDigestSize, 0);
+    Blake2b512Hash(reinterpret_cast<const byte*>(vector.first.data()), vector.first.size(),
+                   reinterpret_cast<byte*>(&digest[0]));
+    EXPECT_EQ(vector.second, HexEncode(digest));
+  }
+
+  // Incremental hashing across block boundaries must match the one-shot result, and Final must
+  // leave the object ready for reuse.
+  Blake2b512 hash;
+  for (size_t size : {0U, 1U, 127U, 128U, 129U, 256U, 65537U}) {
+    std::string input(RandomString(size));
+    std::string expected(Blake2b512::kDigestSize, 0), actual(Blake2b512::kDigestSize, 0);
+    Blake2b512Hash(reinterpret_cast<const byte*>(input.data()), size,
+                   reinterpret_cast<byte*>(&expected[0]));
+    size_t done(0);
+    while (done != size) {
+      size_t length(std::min(size - done, static_cast<size_t>(RandomUint32() % 300)));
+      hash.Update(reinterpret_cast<const byte*>(input.data()) + done, length);
+      done += length;
+    }
+    hash.Final(reinterpret_cast<byte*>(&actual[0]));
+    EXPECT_EQ(expected, actual) << "size " << size;
+  }
+}
+
+TEST(Sha512MultiBufferTest, BEH_MatchesSingleBuffer) {
+  // Lengths either side of the padding boundaries, and counts which leave partial batches.
+  for (size_t length : {0U, 1U, 111U, 112U, 127U, 128U, 129U, 240U, 1000U, 65537U}) {
+    for (size_t count(1); count != 3 * Sha512MultiBufferLanes() + 2; ++count) {
+      std::vector<std::string> inputs(count), digests(count, std::string(64, 0));
+      std::vector<const byte*> data;
+      std::vector<byte*> outputs;
+      for (size_t i(0); i != count; ++i) {
+        inputs[i] = RandomString(length);
+        data.push_back(reinterpret_cast<const byte*>(inputs[i].data()));
+        outputs.push_back(reinterpret_cast<byte*>(&digests[i][0]));
+      }
+      Sha512MultiBuffer(&data[0], length, count, &outputs[0]);
+      for (size_t i(0); i != count; ++i) {
+        EXPECT_EQ(Sha512(GetCryptoBackend(), inputs[i]), digests[i])
+            << "length " << length << ", message " << i << " of " << count;
+      }
+    }
+  }
+}
+
+}  // namespace test
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
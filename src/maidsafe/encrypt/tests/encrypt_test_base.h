@@ -34,11 +34,17 @@ namespace encrypt {
 
 namespace test {
 
+inline SelfEncryptorOptions OptionsWithParallelism(int parallelism) {
+  SelfEncryptorOptions options;
+  options.parallelism = static_cast<uint32_t>(parallelism);
+  return options;
+}
+
 class EncryptTestBase {
  public:
   explicit EncryptTestBase(int num_procs)
       : test_dir_(maidsafe::test::CreateTestPath()),
-        num_procs_(num_procs),
+        options_(OptionsWithParallelism(num_procs)),
         local_store_(MemoryUsage(1024 * 1024), DiskUsage(4294967296),
                      [](const std::string& name, const NonEmptyString&) {
                         LOG(kError) << "Buffer full - deleting " << Base64Substr(name);
@@ -47,7 +53,7 @@ class EncryptTestBase {
                       *test_dir_),
         data_map_(),
         get_from_store_([this](const std::string& name) { return local_store_.Get(name); }),
-        self_encryptor_(new SelfEncryptor(data_map_, local_store_, get_from_store_, num_procs_)),
+        self_encryptor_(new SelfEncryptor(data_map_, local_store_, get_from_store_, options_)),
         original_(),
         decrypted_() {}
 
@@ -55,7 +61,7 @@ class EncryptTestBase {
 
  protected:
   maidsafe::test::TestPath test_dir_;
-  int num_procs_;
+  SelfEncryptorOptions options_;
   data_stores::DataBuffer<std::string> local_store_;
   DataMap data_map_;
   std::function<NonEmptyString(const std::string&)> get_from_store_;
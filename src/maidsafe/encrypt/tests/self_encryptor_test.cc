@@ -17,9 +17,17 @@
     use of the MaidSafe Software.                                                                 */
 
 #include <thread>
+#include <algorithm>
+#include <atomic>
 #include <array>
+#include <chrono>
 #include <cstdlib>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #ifdef WIN32
 #pragma warning(push, 1)
@@ -34,6 +42,7 @@
 #pragma warning(pop)
 #endif
 #include "boost/scoped_array.hpp"
+#include "boost/shared_array.hpp"
 #include "boost/filesystem.hpp"
 
 #include "maidsafe/common/log.h"
@@ -41,7 +50,15 @@
 #include "maidsafe/common/utils.h"
 
 #include "maidsafe/encrypt/self_encryptor.h"
+#include "maidsafe/encrypt/blake2b.h"
+#include "maidsafe/encrypt/byte_array.h"
+#include "maidsafe/encrypt/chunk_cache.h"
+#include "maidsafe/encrypt/chunk_codec.h"
+#include "maidsafe/encrypt/compression.h"
 #include "maidsafe/encrypt/config.h"
+#include "maidsafe/encrypt/crypto_backend.h"
+#include "maidsafe/encrypt/executor.h"
+#include "maidsafe/encrypt/xor_pad.h"
 #include "maidsafe/encrypt/tests/encrypt_test_base.h"
 
 namespace fs = boost::filesystem;
@@ -59,7 +76,7 @@ const int g_num_procs(Concurrency());
 
 uint64_t TotalSize(const DataMap& data_map) {
   uint64_t size(data_map.chunks.empty() ? data_map.content.size() : 0);
-  for (auto& elem : data_map.chunks)
+  for (const auto& elem : data_map.chunks)
     size += (elem).size;
   return size;
 }
@@ -163,7 +180,7 @@ TEST_P(BasicOffsetTest, BEH_EncryptDecrypt) {
     ASSERT_EQ(original_[i], decrypted_[i]) << "i == " << i;
 
   self_encryptor_->Flush();
-  self_encryptor_.reset(new SelfEncryptor(data_map_, local_store_, get_from_store_, num_procs_));
+  self_encryptor_.reset(new SelfEncryptor(data_map_, local_store_, get_from_store_, options_));
   EXPECT_EQ(kOffset_ + kDataSize_, TotalSize(data_map_));
   if (test_file_size_ == kTiny) {
     ASSERT_EQ(kOffset_ + kDataSize_, data_map_.content.size());
@@ -284,7 +301,7 @@ TEST_P(SingleBytesTest, BEH_WriteInOrder) {
   for (uint32_t i = 0; i < kDataSize_; ++i)
     ASSERT_EQ(original_[i], decrypted_[i]) << "i == " << i;
 
-  self_encryptor_.reset(new SelfEncryptor(data_map_, local_store_, get_from_store_, num_procs_));
+  self_encryptor_.reset(new SelfEncryptor(data_map_, local_store_, get_from_store_, options_));
   memset(decrypted_.get(), 1, kDataSize_);
   EXPECT_TRUE(self_encryptor_->Read(decrypted_.get(), kDataSize_, 0));
   for (uint32_t i = 0; i < kDataSize_; ++i)
@@ -316,7 +333,7 @@ TEST_P(SingleBytesTest, BEH_WriteAlternatingBytes) {
   for (uint32_t i = 0; i < kDataSize_; ++i)
     ASSERT_EQ(original_[i], decrypted_[i]) << "i == " << i;
 
-  self_encryptor_.reset(new SelfEncryptor(data_map_, local_store_, get_from_store_, num_procs_));
+  self_encryptor_.reset(new SelfEncryptor(data_map_, local_store_, get_from_store_, options_));
   memset(decrypted_.get(), 1, kDataSize_);
   EXPECT_TRUE(self_encryptor_->Read(decrypted_.get(), kDataSize_, 0));
   for (uint32_t i = 0; i < kDataSize_; ++i)
@@ -352,7 +369,7 @@ TEST_P(SmallSingleBytesTest, BEH_WriteRandomOrder) {
   for (uint32_t i = 0; i < kDataSize_; ++i)
     ASSERT_EQ(original_[i], decrypted_[i]) << "i == " << i;
 
-  self_encryptor_.reset(new SelfEncryptor(data_map_, local_store_, get_from_store_, num_procs_));
+  self_encryptor_.reset(new SelfEncryptor(data_map_, local_store_, get_from_store_, options_));
   memset(decrypted_.get(), 1, kDataSize_);
 
   EXPECT_TRUE(self_encryptor_->Read(decrypted_.get(), kDataSize_, 0));
@@ -459,12 +476,12 @@ TEST_F(BasicTest, BEH_NewRead) {
   boost::scoped_array<char> original2(new char[kDataSize2]);
   std::copy(content2.data(), content2.data() + kDataSize2, original2.get());
   {
-    SelfEncryptor self_encryptor(data_map2, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map2, local_store_, get_from_store_, options_);
     EXPECT_TRUE(self_encryptor.Write(original2.get(), kDataSize2, 0));
   }
 
   // try to read the entire file, will not cache.
-  SelfEncryptor self_encryptor(data_map2, local_store_, get_from_store_, num_procs_);
+  SelfEncryptor self_encryptor(data_map2, local_store_, get_from_store_, options_);
   boost::scoped_array<char> decrypted2(new char[kDataSize2]);
   memset(decrypted2.get(), 1, kDataSize2);
   EXPECT_TRUE(self_encryptor.Read(decrypted2.get(), kDataSize2, 0));
@@ -532,7 +549,7 @@ TEST_F(BasicTest, BEH_WriteRandomSizeRandomPosition) {
   }
   self_encryptor_->Flush();
 
-  SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+  SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
   EXPECT_EQ(kDataSize_, TotalSize(self_encryptor.data_map()));
   EXPECT_TRUE(self_encryptor.data_map().content.empty());
   memset(decrypted_.get(), 1, kDataSize_);
@@ -622,7 +639,7 @@ TEST_F(BasicTest, BEH_WriteLongAndShort65536SegmentsReadThenRewrite) {
   self_encryptor_->Flush();
 
   {
-    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
     // Check data_map values again after destruction...
     //    EXPECT_EQ(44, self_encryptor.data_map().chunks.size());
     EXPECT_EQ(size * 40 + max_length * 10, TotalSize(self_encryptor.data_map()));
@@ -659,7 +676,7 @@ TEST_F(BasicTest, BEH_WriteLongAndShort65536SegmentsReadThenRewrite) {
       }
     }
     {
-      SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+      SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
       count = 0;
       for (size_t i = 0; i != parts; ++i) {
         EXPECT_TRUE(self_encryptor.Write(overwrite[i].c_str(),
@@ -667,7 +684,7 @@ TEST_F(BasicTest, BEH_WriteLongAndShort65536SegmentsReadThenRewrite) {
         count += overwrite[i].size();
       }
     }
-    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
     count = 0;
     for (size_t i = 0; i != parts; ++i) {
       EXPECT_TRUE(self_encryptor.Read(const_cast<char*>(recovered[i].data()),
@@ -722,7 +739,7 @@ TEST_F(BasicTest, BEH_4096ByteOutOfSequenceWritesReadsAndRewrites) {
   EXPECT_TRUE(self_encryptor_->data_map().content.empty());
   self_encryptor_->Flush();
 
-  SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+  SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
   // Check data_map values again after destruction...
   EXPECT_EQ(10, self_encryptor.data_map().chunks.size());
   EXPECT_EQ(kParts * kSize, TotalSize(self_encryptor.data_map()));
@@ -784,7 +801,7 @@ TEST_F(BasicTest, BEH_DataMapSizes) {
 
   std::string content(RandomString(1));
   {
-    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
     EXPECT_TRUE(self_encryptor.Write(content.data(), static_cast<uint32_t>(content.size()), 0));
   }
   EXPECT_EQ(content.size(), data_map_.size());
@@ -792,7 +809,7 @@ TEST_F(BasicTest, BEH_DataMapSizes) {
 
   content.append(RandomString((3 * kMinChunkSize) - 3));
   {
-    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
     EXPECT_TRUE(self_encryptor.Write(content.data(), static_cast<uint32_t>(content.size()), 0));
   }
   EXPECT_EQ(content.size(), data_map_.size());
@@ -800,7 +817,7 @@ TEST_F(BasicTest, BEH_DataMapSizes) {
 
   content.append(RandomString(3));
   {
-    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
     EXPECT_TRUE(self_encryptor.Write(content.data(), static_cast<uint32_t>(content.size()), 0));
   }
   EXPECT_EQ(content.size(), data_map_.size());
@@ -808,7 +825,7 @@ TEST_F(BasicTest, BEH_DataMapSizes) {
 
   content.append(RandomString(3 * kDefaultChunkSize));
   {
-    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
     EXPECT_TRUE(self_encryptor.Write(content.data(), static_cast<uint32_t>(content.size()), 0));
   }
   EXPECT_EQ(content.size(), data_map_.size());
@@ -932,13 +949,13 @@ TEST_F(BasicTest, BEH_3SmallChunkRewrite) {
   self_encryptor_->Flush();
 
   {
-    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
     ASSERT_EQ(TotalSize(data_map_), size);
     EXPECT_TRUE(self_encryptor.Read(const_cast<char*>(recovered.data()), size, 0));
     ASSERT_EQ(content, recovered);
   }
   {
-    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
     content.erase(content.begin() + 300, content.begin() + 350);
     EXPECT_TRUE(self_encryptor.Write(content.data(), static_cast<uint32_t>(content.size()), 0));
     recovered.assign(size - 50, 'W');
@@ -947,7 +964,7 @@ TEST_F(BasicTest, BEH_3SmallChunkRewrite) {
     self_encryptor.Flush();
   }
   {
-    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
     recovered.assign(size - 50, 'X');
     EXPECT_TRUE(self_encryptor.Read(const_cast<char*>(recovered.data()), size - 50, 0));
     ASSERT_EQ(content, recovered);
@@ -991,7 +1008,7 @@ TEST_F(BasicTest, BEH_nKFileAppend) {
   EXPECT_TRUE(self_encryptor_->Flush());
   self_encryptor_.reset();
   {
-    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
     EXPECT_TRUE(self_encryptor.Truncate(original.size() + 1));
     EXPECT_TRUE(self_encryptor.Flush());
     original += "a";
@@ -1013,7 +1030,7 @@ TEST_F(BasicTest, BEH_DeleteStoredChunkFromDisk) {
                                     static_cast<uint32_t>(recovered.size()), 0));
 
   {
-    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
     EXPECT_TRUE(self_encryptor.Read(const_cast<char*>(recovered.data()),
                                     static_cast<uint32_t>(recovered.size()), 0));
   }
@@ -1021,7 +1038,7 @@ TEST_F(BasicTest, BEH_DeleteStoredChunkFromDisk) {
   local_store_.Delete(data_map_.chunks[0].hash);
 
   {
-    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
     EXPECT_FALSE(self_encryptor.Read(const_cast<char*>(recovered.data()),
                                      static_cast<uint32_t>(recovered.size()), 0));
   }
@@ -1118,7 +1135,7 @@ TEST_F(BasicTest, BEH_TruncateIncreaseScenario1) {
   const uint32_t kTestDataSize(kDefaultChunkSize * 12);
   const uint32_t kIncrease((RandomUint32() % 4000) + 95);
   {
-    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
     boost::scoped_array<char> plain_data(new char[kTestDataSize]);
     memset(plain_data.get(), 0, kTestDataSize);
 
@@ -1147,14 +1164,14 @@ TEST_F(BasicTest, BEH_TruncateIncreaseScenario1) {
       }
     }
   }
-  SelfEncryptor temp_self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+  SelfEncryptor temp_self_encryptor(data_map_, local_store_, get_from_store_, options_);
   EXPECT_EQ(kTestDataSize + kIncrease, temp_self_encryptor.size());
 }
 
 TEST_F(BasicTest, BEH_TruncateIncreaseScenario2) {
   const size_t kTestDataSize(kDefaultChunkSize * 40);
   {
-    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
     EXPECT_TRUE(self_encryptor.Truncate(100));
     EXPECT_EQ(100, self_encryptor.size());
 
@@ -1191,7 +1208,7 @@ TEST_F(BasicTest, BEH_TruncateIncreaseScenario2) {
             << self_encryptor.size();
   }
 
-  SelfEncryptor temp_self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+  SelfEncryptor temp_self_encryptor(data_map_, local_store_, get_from_store_, options_);
   EXPECT_EQ(kTestDataSize, temp_self_encryptor.size());
 }
 
@@ -1331,7 +1348,7 @@ TEST_F(BasicTest, FUNC_RandomAccess) {
         //                   << "  \twith data length: " << kLength;
         std::string plain_text(RandomString(kLength));
         {
-          SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+          SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
           EXPECT_TRUE(self_encryptor.Write(plain_text.data(), kLength, kPosition));
           std::string answer(kLength, 1);
           EXPECT_TRUE(self_encryptor.Read(const_cast<char*>(answer.data()), kLength, kPosition));
@@ -1340,7 +1357,7 @@ TEST_F(BasicTest, FUNC_RandomAccess) {
         boost::scoped_array<char> answer(new char[kLength]);
         memset(answer.get(), 1, kLength);
         {
-          SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, num_procs_);
+          SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
           EXPECT_TRUE(self_encryptor.Read(answer.get(), kLength, kPosition));
         }
 
@@ -1379,15 +1396,15 @@ TEST_F(BasicTest, BEH_EncryptDecryptDataMap) {
 TEST_F(BasicTest, BEH_DifferentDataMapSameChunk) {
   DataMap data_map_1, data_map_2;
   {
-    SelfEncryptor self_encryptor_1(data_map_1, local_store_, get_from_store_, num_procs_);
-    SelfEncryptor self_encryptor_2(data_map_2, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor_1(data_map_1, local_store_, get_from_store_, options_);
+    SelfEncryptor self_encryptor_2(data_map_2, local_store_, get_from_store_, options_);
     self_encryptor_1.Write(original_.get(), 16 * 1024, 0);
     self_encryptor_2.Write(original_.get(), 16 * 1024, 0);
   }
   {
     boost::scoped_array<char> result_data;
     result_data.reset(new char[16 * 1024]);
-    SelfEncryptor self_encryptor_2(data_map_2, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor_2(data_map_2, local_store_, get_from_store_, options_);
     self_encryptor_2.Read(result_data.get(), 16 * 1024, 0);
     for (uint32_t i = 0; i != 16 * 1024; ++i)
       ASSERT_EQ(original_[i], result_data[i]) << "i == " << i;
@@ -1396,7 +1413,7 @@ TEST_F(BasicTest, BEH_DifferentDataMapSameChunk) {
   boost::scoped_array<char> temp_data(new char[500]);
   memset(temp_data.get(), 'b', 500);
   {
-    SelfEncryptor self_encryptor_1(data_map_1, local_store_, get_from_store_, num_procs_);
+    SelfEncryptor self_encryptor_1(data_map_1, local_store_, get_from_store_, options_);
     self_encryptor_1.Write(temp_data.get(), 500, 1000);
     self_encryptor_1.Truncate(10 * 1024);
   }
@@ -1415,6 +1432,1155 @@ TEST_F(BasicTest, BEH_DifferentDataMapSameChunk) {
   // }
 }
 
+TEST_F(BasicTest, BEH_Version2UsesBlake2b) {
+  const uint32_t kDataSize(4 * kDefaultChunkSize + 1000);
+  DataMap data_map_1, data_map_2;
+  data_map_1.self_encryption_version = EncryptionAlgorithm::kSelfEncryptionVersion1;
+  data_map_2.self_encryption_version = EncryptionAlgorithm::kSelfEncryptionVersion2;
+  {
+    SelfEncryptor self_encryptor_1(data_map_1, local_store_, get_from_store_, options_);
+    SelfEncryptor self_encryptor_2(data_map_2, local_store_, get_from_store_, options_);
+    EXPECT_TRUE(self_encryptor_1.Write(original_.get(), kDataSize, 0));
+    EXPECT_TRUE(self_encryptor_2.Write(original_.get(), kDataSize, 0));
+  }
+  ASSERT_EQ(data_map_1.chunks.size(), data_map_2.chunks.size());
+
+  std::string digest(Blake2b512::kDigestSize, 0);
+  uint64_t offset(0);
+  for (size_t i(0); i != data_map_2.chunks.size(); ++i) {
+    const ChunkDetails& chunk(data_map_2.chunks[i]);
+    EXPECT_NE(data_map_1.chunks[i].hash, chunk.hash);
+    Blake2b512Hash(reinterpret_cast<const byte*>(original_.get() + offset), chunk.size,
+                   reinterpret_cast<byte*>(&digest[0]));
+    EXPECT_EQ(digest, std::string(reinterpret_cast<const char*>(chunk.pre_hash), digest.size()));
+    std::string content(local_store_.Get(chunk.hash).string());
+    Blake2b512Hash(reinterpret_cast<const byte*>(content.data()), content.size(),
+                   reinterpret_cast<byte*>(&digest[0]));
+    EXPECT_EQ(chunk.hash, digest);
+    offset += chunk.size;
+  }
+
+  std::string serialised_data_map;
+  SerialiseDataMap(data_map_2, serialised_data_map);
+  DataMap parsed_data_map;
+  ParseDataMap(serialised_data_map, parsed_data_map);
+  EXPECT_EQ(EncryptionAlgorithm::kSelfEncryptionVersion2, parsed_data_map.self_encryption_version);
+  SelfEncryptor self_encryptor(parsed_data_map, local_store_, get_from_store_, options_);
+  EXPECT_TRUE(self_encryptor.Read(decrypted_.get(), kDataSize, 0));
+  for (uint32_t i(0); i != kDataSize; ++i)
+    ASSERT_EQ(original_[i], decrypted_[i]) << "i == " << i;
+}
+
+TEST_F(BasicTest, BEH_SharedExecutor) {
+  // Several files written and read concurrently through one small pool give the same DataMaps as
+  // a file encrypted entirely on its caller's thread.
+  const uint32_t kDataSize(6 * kDefaultChunkSize + 1000);
+  const int kFileCount(4);
+  InlineExecutor inline_executor;
+  SelfEncryptorOptions inline_options(options_);
+  inline_options.executor = &inline_executor;
+  DataMap expected;
+  {
+    SelfEncryptor self_encryptor(expected, local_store_, get_from_store_, inline_options);
+    EXPECT_TRUE(self_encryptor.Write(original_.get(), kDataSize, 0));
+  }
+
+  WorkStealingExecutor executor(2);
+  SelfEncryptorOptions options(options_);
+  options.executor = &executor;
+  std::vector<DataMap> data_maps(kFileCount);
+  std::vector<std::unique_ptr<char[]>> decrypted(kFileCount);
+  std::vector<std::thread> threads;
+  for (int i(0); i != kFileCount; ++i) {
+    decrypted[i].reset(new char[kDataSize]);
+    threads.emplace_back([&, i] {
+      {
+        SelfEncryptor self_encryptor(data_maps[i], local_store_, get_from_store_, options);
+        self_encryptor.Write(original_.get(), kDataSize, 0);
+      }
+      SelfEncryptor self_encryptor(data_maps[i], local_store_, get_from_store_, options);
+      self_encryptor.Read(decrypted[i].get(), kDataSize, 0);
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  for (int i(0); i != kFileCount; ++i) {
+    ASSERT_EQ(expected.chunks.size(), data_maps[i].chunks.size());
+    for (size_t j(0); j != expected.chunks.size(); ++j)
+      EXPECT_EQ(expected.chunks[j].hash, data_maps[i].chunks[j].hash);
+    EXPECT_EQ(0, memcmp(original_.get(), decrypted[i].get(), kDataSize)) << "file " << i;
+  }
+}
+
+TEST_F(BasicTest, BEH_PipelinedWrite) {
+  // Sequential writes handed to background encryption give the same DataMap as synchronous ones,
+  // including when reads and rewrites of chunk 0 interrupt the stream.
+  const uint32_t kPieceSize(64 * 1024);
+  InlineExecutor inline_executor;
+  SelfEncryptorOptions inline_options(options_);
+  inline_options.executor = &inline_executor;
+  DataMap expected;
+  {
+    SelfEncryptor self_encryptor(expected, local_store_, get_from_store_, inline_options);
+    EXPECT_TRUE(self_encryptor.Write(original_.get(), kDataSize_, 0));
+  }
+
+  WorkStealingExecutor executor(2);
+  SelfEncryptorOptions options(options_);
+  options.executor = &executor;
+  options.pipeline_buffers = 3;
+  DataMap data_map;
+  {
+    SelfEncryptor self_encryptor(data_map, local_store_, get_from_store_, options);
+    for (uint32_t position(0); position < kDataSize_; position += kPieceSize) {
+      uint32_t length(std::min(kPieceSize, kDataSize_ - position));
+      ASSERT_TRUE(self_encryptor.Write(original_.get() + position, length, position));
+      if (position == kDataSize_ / 2) {
+        ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), kPieceSize, kPieceSize));
+        EXPECT_EQ(0, memcmp(original_.get() + kPieceSize, decrypted_.get(), kPieceSize));
+        ASSERT_TRUE(self_encryptor.Write(original_.get(), kPieceSize, 0));
+      }
+    }
+  }
+  ASSERT_EQ(expected.chunks.size(), data_map.chunks.size());
+  for (size_t i(0); i != expected.chunks.size(); ++i)
+    EXPECT_EQ(expected.chunks[i].hash, data_map.chunks[i].hash) << "chunk " << i;
+
+  SelfEncryptor self_encryptor(data_map, local_store_, get_from_store_, options_);
+  ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), kDataSize_, 0));
+  EXPECT_EQ(0, memcmp(original_.get(), decrypted_.get(), kDataSize_));
+}
+
+TEST_F(BasicTest, BEH_SequentialReadahead) {
+  // Streaming reads served partly from prefetched chunks return the same data, as do reads after
+  // a seek discards them.
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
+    EXPECT_TRUE(self_encryptor.Write(original_.get(), kDataSize_, 0));
+  }
+
+  const uint32_t kPieceSize(64 * 1024);
+  WorkStealingExecutor executor(2);
+  SelfEncryptorOptions options(options_);
+  options.executor = &executor;
+  SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options);
+  for (uint32_t position(0); position < kDataSize_; position += kPieceSize) {
+    uint32_t length(std::min(kPieceSize, kDataSize_ - position));
+    ASSERT_TRUE(self_encryptor.Read(decrypted_.get() + position, length, position));
+  }
+  EXPECT_EQ(0, memcmp(original_.get(), decrypted_.get(), kDataSize_));
+
+  const uint32_t kSeekPosition(kDataSize_ / 3 + 17);
+  memset(decrypted_.get(), 1, kDataSize_);
+  for (uint32_t position(kSeekPosition); position < kSeekPosition + 3 * kDefaultChunkSize;
+       position += kPieceSize) {
+    ASSERT_TRUE(self_encryptor.Read(decrypted_.get() + position, kPieceSize, position));
+  }
+  EXPECT_EQ(0, memcmp(original_.get() + kSeekPosition, decrypted_.get() + kSeekPosition,
+                      3 * kDefaultChunkSize));
+  ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), kPieceSize, 0));
+  EXPECT_EQ(0, memcmp(original_.get(), decrypted_.get(), kPieceSize));
+}
+
+TEST_F(BasicTest, BEH_WindowedFlush) {
+  // Out-of-order writes flushed a few chunks at a time give the same DataMap as in-order writes,
+  // and so do rewrites in the middle of the file after it's reopened.
+  DataMap expected;
+  {
+    SelfEncryptor self_encryptor(expected, local_store_, get_from_store_, options_);
+    EXPECT_TRUE(self_encryptor.Write(original_.get(), kDataSize_, 0));
+  }
+
+  const uint32_t kPieceSize(64 * 1024);
+  std::vector<uint32_t> positions;
+  for (uint32_t position(0); position < kDataSize_; position += kPieceSize)
+    positions.push_back(position);
+  srand(RandomUint32());
+  std::random_shuffle(positions.begin(), positions.end());
+
+  WorkStealingExecutor executor(2);
+  SelfEncryptorOptions options(options_);
+  options.executor = &executor;
+  std::vector<DataMap> data_maps(3);
+  const uint32_t kFlushWindows[] = {1, 3, 0};
+  for (size_t i(0); i != data_maps.size(); ++i) {
+    options.flush_window = kFlushWindows[i];
+    SelfEncryptor self_encryptor(data_maps[i], local_store_, get_from_store_, options);
+    for (uint32_t position : positions) {
+      ASSERT_TRUE(self_encryptor.Write(original_.get() + position,
+                                       std::min(kPieceSize, kDataSize_ - position), position));
+    }
+    ASSERT_TRUE(self_encryptor.Flush());
+    ASSERT_EQ(expected.chunks.size(), data_maps[i].chunks.size());
+    for (size_t j(0); j != expected.chunks.size(); ++j)
+      EXPECT_EQ(expected.chunks[j].hash, data_maps[i].chunks[j].hash) << "window " << i;
+  }
+
+  const uint32_t kRewritePositions[] = {kDataSize_ / 2 + 100, kDataSize_ / 3, kDataSize_ - 10};
+  for (uint32_t position : kRewritePositions) {
+    std::string rewrite(RandomString(std::min(kPieceSize, kDataSize_ - position)));
+    std::copy(rewrite.begin(), rewrite.end(), original_.get() + position);
+  }
+  options.flush_window = 2;
+  {
+    SelfEncryptor self_encryptor(data_maps[0], local_store_, get_from_store_, options);
+    for (uint32_t position : kRewritePositions) {
+      ASSERT_TRUE(self_encryptor.Write(original_.get() + position,
+                                       std::min(kPieceSize, kDataSize_ - position), position));
+    }
+  }
+  SelfEncryptor self_encryptor(data_maps[0], local_store_, get_from_store_, options_);
+  ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), kDataSize_, 0));
+  EXPECT_EQ(0, memcmp(original_.get(), decrypted_.get(), kDataSize_));
+}
+
+TEST_F(BasicTest, BEH_FlushWithMissingChunk) {
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
+    ASSERT_TRUE(self_encryptor.Write(original_.get(), kDataSize_, 0));
+    ASSERT_TRUE(self_encryptor.Flush());
+  }
+  ASSERT_LT(12U, data_map_.chunks.size());
+  std::string missing_name(data_map_.chunks[12].hash);
+  NonEmptyString missing_content(local_store_.Get(missing_name));
+  local_store_.Delete(missing_name);
+
+  // Writing to chunk 11 changes the pre-hash which chunk 12 is encrypted with.  Flush needs chunk
+  // 12's old content to re-encrypt it, so fails rather than store zeros, after flushing the window
+  // holding chunk 11 but before the write to chunk 13.
+  SelfEncryptorOptions options(options_);
+  options.queue_chunks = 1;
+  options.flush_window = 2;
+  const uint32_t kWritePositions[] = {9 * kDefaultChunkSize + 200, 11 * kDefaultChunkSize + 300,
+                                      13 * kDefaultChunkSize + 100};
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options);
+    for (uint32_t position : kWritePositions) {
+      ASSERT_TRUE(self_encryptor.Write(original_.get(), 50, position));
+      memcpy(original_.get() + position, original_.get(), 50);
+    }
+    EXPECT_FALSE(self_encryptor.Flush());
+
+    // Once the chunk is back, the same Flush can be retried.
+    local_store_.Store(missing_name, missing_content);
+    EXPECT_TRUE(self_encryptor.Flush());
+  }
+  SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
+  ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), kDataSize_, 0));
+  EXPECT_EQ(0, memcmp(original_.get(), decrypted_.get(), kDataSize_));
+}
+
+TEST_F(BasicTest, BEH_ConcurrentReads) {
+  // Streaming readers, one per section of the file, share a SelfEncryptor with a reader jumping
+  // around the whole file.
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
+    EXPECT_TRUE(self_encryptor.Write(original_.get(), kDataSize_, 0));
+  }
+
+  const uint32_t kPieceSize(48 * 1024);
+  const uint32_t kStreamCount(4);
+  const uint32_t kSectionSize(kDataSize_ / kStreamCount);
+  WorkStealingExecutor executor(2);
+  SelfEncryptorOptions options(options_);
+  options.executor = &executor;
+  SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options);
+  std::atomic<int> failures(0);
+  std::vector<std::thread> threads;
+  for (uint32_t i(0); i != kStreamCount; ++i) {
+    threads.emplace_back([&, i] {
+      for (uint32_t offset(0); offset < kSectionSize; offset += kPieceSize) {
+        uint32_t position(i * kSectionSize + offset);
+        uint32_t length(std::min(kPieceSize, kSectionSize - offset));
+        if (!self_encryptor.Read(decrypted_.get() + position, length, position))
+          ++failures;
+      }
+    });
+  }
+  threads.emplace_back([&] {
+    std::unique_ptr<char[]> piece(new char[kPieceSize]);
+    for (uint32_t i(0); i != 50; ++i) {
+      uint32_t position(RandomUint32() % (kDataSize_ - kPieceSize));
+      if (!self_encryptor.Read(piece.get(), kPieceSize, position) ||
+          memcmp(original_.get() + position, piece.get(), kPieceSize) != 0) {
+        ++failures;
+      }
+    }
+  });
+  for (auto& thread : threads)
+    thread.join();
+
+  EXPECT_EQ(0, failures);
+  EXPECT_EQ(0, memcmp(original_.get(), decrypted_.get(), kDataSize_));
+}
+
+TEST_F(BasicTest, BEH_AsyncApi) {
+  DataMap expected;
+  {
+    SelfEncryptor self_encryptor(expected, local_store_, get_from_store_, options_);
+    EXPECT_TRUE(self_encryptor.Write(original_.get(), kDataSize_, 0));
+  }
+
+  const uint32_t kPieceSize(256 * 1024);
+  WorkStealingExecutor executor(1);
+  SelfEncryptorOptions options(options_);
+  options.executor = &executor;
+  options.pipeline_buffers = 2;
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options);
+    std::vector<std::future<int>> writes;
+    for (uint32_t position(0); position < kDataSize_; position += kPieceSize) {
+      writes.push_back(self_encryptor.WriteAsync(
+          original_.get() + position, std::min(kPieceSize, kDataSize_ - position), position));
+    }
+    std::future<int> flushed(self_encryptor.FlushAsync());
+    for (auto& write : writes)
+      EXPECT_EQ(kSuccess, write.get());
+    EXPECT_EQ(kSuccess, flushed.get());
+  }
+  ASSERT_EQ(expected.chunks.size(), data_map_.chunks.size());
+  for (size_t i(0); i != expected.chunks.size(); ++i)
+    EXPECT_EQ(expected.chunks[i].hash, data_map_.chunks[i].hash);
+
+  // Calls complete in the order they were made, whichever way the result is delivered.
+  options.pipeline_buffers = 0;
+  SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options);
+  std::mutex mutex;
+  std::vector<int> order;
+  const uint32_t kHalf(kDataSize_ / 2);
+  self_encryptor.ReadAsync(decrypted_.get(), kHalf, 0, [&](int result) {
+    EXPECT_EQ(kSuccess, result);
+    std::lock_guard<std::mutex> lock(mutex);
+    order.push_back(0);
+  });
+  std::future<int> second_half(
+      self_encryptor.ReadAsync(decrypted_.get() + kHalf, kDataSize_ - kHalf, kHalf));
+  EXPECT_EQ(kSuccess, second_half.get());
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT_EQ(1U, order.size());
+  }
+  EXPECT_EQ(0, memcmp(original_.get(), decrypted_.get(), kDataSize_));
+
+  // The last queued call's handler may destroy the SelfEncryptor.
+  std::unique_ptr<SelfEncryptor> owned(
+      new SelfEncryptor(data_map_, local_store_, get_from_store_, options));
+  std::promise<int> destroyed;
+  owned->ReadAsync(decrypted_.get(), kHalf, 0, [&](int result) {
+    owned.reset();
+    destroyed.set_value(result);
+  });
+  EXPECT_EQ(kSuccess, destroyed.get_future().get());
+  EXPECT_FALSE(owned);
+}
+
+TEST_F(BasicTest, BEH_BatchedChunkFetch) {
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
+    EXPECT_TRUE(self_encryptor.Write(original_.get(), kDataSize_, 0));
+  }
+  // Move the chunks out of the buffer, into a store with a batched interface.
+  std::map<std::string, NonEmptyString> remote_store;
+  for (const auto& chunk : data_map_.chunks) {
+    remote_store[chunk.hash] = local_store_.Get(chunk.hash);
+    local_store_.Delete(chunk.hash);
+  }
+  std::atomic<int> single_fetches(0), batches(0);
+  std::string withheld;
+  std::function<NonEmptyString(const std::string&)> get_one([&](const std::string& name) {
+    ++single_fetches;
+    return remote_store.at(name);
+  });
+  BatchGetFromStore get_batch([&](const std::vector<std::string>& names) {
+    ++batches;
+    std::vector<NonEmptyString> contents;
+    for (const auto& name : names)
+      contents.push_back(name == withheld ? NonEmptyString() : remote_store.at(name));
+    std::promise<std::vector<NonEmptyString>> promise;
+    promise.set_value(std::move(contents));
+    return promise.get_future();
+  });
+  SelfEncryptorOptions options(options_);
+  options.batch_get_from_store = get_batch;
+
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_one, options);
+    ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), kDataSize_, 0));
+    EXPECT_EQ(0, memcmp(original_.get(), decrypted_.get(), kDataSize_));
+    EXPECT_EQ(1, batches);
+    EXPECT_EQ(0, single_fetches);
+  }
+
+  // A chunk missing from the batch is fetched on its own.
+  withheld = data_map_.chunks[5].hash;
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_one, options);
+    ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), kDataSize_, 0));
+    EXPECT_EQ(0, memcmp(original_.get(), decrypted_.get(), kDataSize_));
+    EXPECT_EQ(2, batches);
+    EXPECT_EQ(1, single_fetches);
+  }
+
+  // Rewriting part of the file reads the chunks it needs in batches too.
+  withheld.clear();
+  const uint32_t kRewritePosition(kDataSize_ / 2);
+  std::string rewrite(RandomString(100));
+  std::copy(rewrite.begin(), rewrite.end(), original_.get() + kRewritePosition);
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_one, options);
+    ASSERT_TRUE(self_encryptor.Write(rewrite.data(), 100, kRewritePosition));
+  }
+  EXPECT_LT(2, batches);
+  EXPECT_EQ(1, single_fetches);
+  SelfEncryptor self_encryptor(data_map_, local_store_, get_one, options);
+  ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), kDataSize_, 0));
+  EXPECT_EQ(0, memcmp(original_.get(), decrypted_.get(), kDataSize_));
+}
+
+TEST_F(BasicTest, BEH_MemoryLimit) {
+  const uint64_t kMemoryLimit(40 * kDefaultChunkSize);
+  SelfEncryptorOptions options(options_);
+  options.parallelism = 8;
+  options.memory_limit = kMemoryLimit;
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options);
+    for (uint32_t position(0); position < kDataSize_; position += 100 * 1024) {
+      uint32_t length(std::min(100U * 1024, kDataSize_ - position));
+      ASSERT_TRUE(self_encryptor.Write(original_.get() + position, length, position));
+      EXPECT_GE(kMemoryLimit, self_encryptor.memory_usage());
+    }
+    EXPECT_LT(0U, self_encryptor.memory_usage());
+  }
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options);
+    for (uint32_t position(0); position < kDataSize_; position += 32 * 1024) {
+      uint32_t length(std::min(32U * 1024, kDataSize_ - position));
+      ASSERT_TRUE(self_encryptor.Read(decrypted_.get() + position, length, position));
+      EXPECT_GE(kMemoryLimit, self_encryptor.memory_usage());
+    }
+    EXPECT_EQ(0, memcmp(original_.get(), decrypted_.get(), kDataSize_));
+  }
+
+  // Out-of-order writes are refused once holding them could exceed the limit.
+  DataMap data_map;
+  {
+    SelfEncryptor self_encryptor(data_map, local_store_, get_from_store_, options);
+    EXPECT_TRUE(self_encryptor.Write(original_.get(), 100, 0));
+    EXPECT_TRUE(self_encryptor.Write(original_.get(), 2 * kDefaultChunkSize,
+                                     10 * kDefaultChunkSize));
+    EXPECT_FALSE(self_encryptor.Write(original_.get(), 2 * kDefaultChunkSize,
+                                      14 * kDefaultChunkSize));
+    EXPECT_GE(kMemoryLimit, self_encryptor.memory_usage());
+  }
+
+  // Sizes set explicitly aren't reduced to fit.
+  options.queue_chunks = 64;
+  EXPECT_THROW(SelfEncryptor self_encryptor(data_map, local_store_, get_from_store_, options),
+               maidsafe_error);
+}
+
+TEST_F(BasicTest, BEH_MemoryLimitReopenedFile) {
+  // With every size explicit, find the smallest limit a SelfEncryptor accepts.
+  SelfEncryptorOptions options(options_);
+  options.parallelism = 1;
+  options.queue_chunks = 1;
+  options.read_cache_chunks = 1;
+  options.flush_window = 1;
+  options.memory_limit = 64 * kDefaultChunkSize;
+  for (;;) {
+    DataMap data_map;
+    options.memory_limit -= kDefaultChunkSize;
+    try {
+      SelfEncryptor self_encryptor(data_map, local_store_, get_from_store_, options);
+    }
+    catch (const maidsafe_error&) {
+      options.memory_limit += kDefaultChunkSize;
+      break;
+    }
+  }
+
+  // Writing a reopened file from chunk 4 onwards leaves chunks 2 and 3 without pre-encryption
+  // hashes, so the first two queued chunks are parked in the sequencer until Flush.
+  const uint32_t kSmallFileSize(100);
+  const uint32_t kWritePosition(4 * kDefaultChunkSize);
+  const uint32_t kWriteSize(4 * kDefaultChunkSize + 1000);
+  const uint32_t kFileSize(kWritePosition + kWriteSize);
+  std::unique_ptr<char[]> expected(new char[kFileSize]());
+  memcpy(expected.get(), original_.get(), kSmallFileSize);
+  memcpy(expected.get() + kWritePosition, original_.get() + kSmallFileSize, kWriteSize);
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options);
+    ASSERT_TRUE(self_encryptor.Write(original_.get(), kSmallFileSize, 0));
+  }
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options);
+    for (uint32_t offset(0); offset < kWriteSize; offset += 64 * 1024) {
+      uint32_t length(std::min(64U * 1024, kWriteSize - offset));
+      ASSERT_TRUE(self_encryptor.Write(original_.get() + kSmallFileSize + offset, length,
+                                       kWritePosition + offset));
+      EXPECT_GE(options.memory_limit, self_encryptor.memory_usage());
+    }
+    ASSERT_TRUE(self_encryptor.Flush());
+  }
+  SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
+  ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), kFileSize, 0));
+  EXPECT_EQ(0, memcmp(expected.get(), decrypted_.get(), kFileSize));
+}
+
+TEST_F(BasicTest, BEH_SpillToDisk) {
+  // Back to front, every write is held until the one at 0 arrives, so all but spill_threshold of
+  // the file must be spilled to stay within the memory limit.
+  const uint64_t kMemoryLimit(40 * kDefaultChunkSize);
+  const uint32_t kPieceSize(100 * 1024);
+  SelfEncryptorOptions options(options_);
+  options.parallelism = 8;
+  options.memory_limit = kMemoryLimit;
+  options.spill_threshold = 4 * kDefaultChunkSize;
+  std::unique_ptr<char[]> expected(new char[kDataSize_]);
+  memcpy(expected.get(), original_.get(), kDataSize_);
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options);
+    for (uint32_t piece((kDataSize_ - 1) / kPieceSize); piece != 0; --piece) {
+      uint32_t position(piece * kPieceSize);
+      uint32_t length(std::min(kPieceSize, kDataSize_ - position));
+      ASSERT_TRUE(self_encryptor.Write(original_.get() + position, length, position));
+      EXPECT_GE(kMemoryLimit, self_encryptor.memory_usage());
+    }
+
+    // Overwrites part of several spilled pieces, and reads back across both tiers.
+    const uint32_t kOverwritePosition(5 * kDefaultChunkSize + 1234);
+    const uint32_t kOverwriteSize(3 * kDefaultChunkSize);
+    ASSERT_TRUE(self_encryptor.Write(original_.get() + 7, kOverwriteSize, kOverwritePosition));
+    memcpy(expected.get() + kOverwritePosition, original_.get() + 7, kOverwriteSize);
+    EXPECT_GE(kMemoryLimit, self_encryptor.memory_usage());
+    const uint32_t kReadPosition(2 * kDefaultChunkSize);
+    ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), kDataSize_ - kReadPosition, kReadPosition));
+    EXPECT_EQ(0, memcmp(expected.get() + kReadPosition, decrypted_.get(),
+                        kDataSize_ - kReadPosition));
+
+    ASSERT_TRUE(self_encryptor.Write(original_.get(), kPieceSize, 0));
+    EXPECT_GE(kMemoryLimit, self_encryptor.memory_usage());
+  }
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options);
+    ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), kDataSize_, 0));
+    EXPECT_EQ(0, memcmp(expected.get(), decrypted_.get(), kDataSize_));
+  }
+}
+
+TEST_F(BasicTest, BEH_ChunkAlignedReads) {
+  const uint32_t kFileSize(5 * kDefaultChunkSize + 1234);
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
+    ASSERT_TRUE(self_encryptor.Write(original_.get(), kFileSize, 0));
+    ASSERT_TRUE(self_encryptor.Flush());
+  }
+
+  // Whole chunks, the final partial chunk with a tail beyond the end of the file, and reads
+  // starting or ending part way through chunks.
+  const std::vector<SizeAndOffset> kReads = {
+      SizeAndOffset(kDefaultChunkSize, 2 * kDefaultChunkSize),
+      SizeAndOffset(2 * kDefaultChunkSize, 0),
+      SizeAndOffset(kDefaultChunkSize + 1234, 4 * kDefaultChunkSize),
+      SizeAndOffset(2 * kDefaultChunkSize, 4 * kDefaultChunkSize),
+      SizeAndOffset(300, kDefaultChunkSize - 100),
+      SizeAndOffset(20, kDefaultChunkSize + 10),
+      SizeAndOffset(kDefaultChunkSize, kFileSize - 17),
+      SizeAndOffset(3 * kDefaultChunkSize + 5, kDefaultChunkSize / 2)};
+  SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
+  for (const auto& read : kReads) {
+    memset(decrypted_.get(), 0xff, read.first);
+    ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), read.first, read.second));
+    uint32_t file_bytes(std::min(read.first, kFileSize - read.second));
+    EXPECT_EQ(0, memcmp(original_.get() + read.second, decrypted_.get(), file_bytes))
+        << read.first << " bytes at " << read.second;
+    for (uint32_t i(file_bytes); i != read.first; ++i)
+      ASSERT_EQ(0, decrypted_[i]) << "byte " << i << " beyond the end of the file";
+  }
+}
+
+TEST_F(BasicTest, BEH_ReadCache) {
+  const uint32_t kFileSize(6 * kDefaultChunkSize + 1234);
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
+    ASSERT_TRUE(self_encryptor.Write(original_.get(), kFileSize, 0));
+    ASSERT_TRUE(self_encryptor.Flush());
+  }
+
+  SelfEncryptorOptions options(options_);
+  options.read_cache_chunks = 2;
+  SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options);
+  auto check_read([&](uint32_t length, uint64_t position) {
+    ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), length, position));
+    EXPECT_EQ(0, memcmp(original_.get() + position, decrypted_.get(), length))
+        << length << " bytes at " << position;
+  });
+
+  // Reads within one chunk decrypt it once, and one straddling two chunks touches both.
+  check_read(100, 3 * kDefaultChunkSize + 10);
+  check_read(200, 3 * kDefaultChunkSize + 5000);
+  check_read(100, 4 * kDefaultChunkSize - 50);
+  ReadCacheStatistics statistics(self_encryptor.read_cache_statistics());
+  EXPECT_EQ(2U, statistics.hits);
+  EXPECT_EQ(2U, statistics.misses);
+  EXPECT_EQ(0U, statistics.evictions);
+  EXPECT_EQ(2U * kDefaultChunkSize, statistics.bytes_held);
+
+  // Chunk 5 evicts chunk 3, which was used less recently than chunk 4.
+  check_read(30, 5 * kDefaultChunkSize + 7);
+  check_read(30, 4 * kDefaultChunkSize + 7);
+  check_read(30, 3 * kDefaultChunkSize + 7);
+  statistics = self_encryptor.read_cache_statistics();
+  EXPECT_EQ(3U, statistics.hits);
+  EXPECT_EQ(4U, statistics.misses);
+  EXPECT_EQ(2U, statistics.evictions);
+  EXPECT_EQ(2U * kDefaultChunkSize, statistics.bytes_held);
+
+  // Whole chunks bypass the cache.
+  check_read(kDefaultChunkSize, kDefaultChunkSize);
+  EXPECT_EQ(7U, self_encryptor.read_cache_statistics().hits +
+                self_encryptor.read_cache_statistics().misses);
+
+  // Writes are copied into the cached chunks they overlap.
+  const uint64_t kWritePosition(4 * kDefaultChunkSize + 100);
+  ASSERT_TRUE(self_encryptor.Write(original_.get(), 64, kWritePosition));
+  memcpy(original_.get() + kWritePosition, original_.get(), 64);
+  check_read(200, kWritePosition - 50);
+  EXPECT_EQ(4U, self_encryptor.read_cache_statistics().hits);
+
+  // Truncate empties the cache, and what follows the new end of the file reads as zeros.
+  ASSERT_TRUE(self_encryptor.Truncate(kWritePosition));
+  EXPECT_EQ(0U, self_encryptor.read_cache_statistics().bytes_held);
+  ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), 200, kWritePosition - 50));
+  EXPECT_EQ(0, memcmp(original_.get() + kWritePosition - 50, decrypted_.get(), 50));
+  for (uint32_t i(50); i != 200; ++i)
+    ASSERT_EQ(0, decrypted_[i]) << "byte " << i << " beyond the end of the file";
+  EXPECT_EQ(5U, self_encryptor.read_cache_statistics().misses);
+}
+
+TEST_F(BasicTest, BEH_SharedChunkCache) {
+  const uint32_t kFileSize(5 * kDefaultChunkSize + 1234);
+  {
+    SelfEncryptor self_encryptor(data_map_, local_store_, get_from_store_, options_);
+    ASSERT_TRUE(self_encryptor.Write(original_.get(), kFileSize, 0));
+    ASSERT_TRUE(self_encryptor.Flush());
+  }
+  const uint32_t kChunkCount(static_cast<uint32_t>(data_map_.chunks.size()));
+
+  // A second file with the same content decrypts every chunk from the cache.
+  ChunkCache chunk_cache(64 * kDefaultChunkSize);
+  SelfEncryptorOptions options(options_);
+  options.chunk_cache = &chunk_cache;
+  DataMap data_map_2(data_map_);
+  for (DataMap* data_map : {&data_map_, &data_map_2}) {
+    SelfEncryptor self_encryptor(*data_map, local_store_, get_from_store_, options);
+    memset(decrypted_.get(), 1, kFileSize);
+    ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), kFileSize, 0));
+    ASSERT_EQ(0, memcmp(original_.get(), decrypted_.get(), kFileSize));
+    // Parts of chunks are copied out of the whole chunks held.
+    ASSERT_TRUE(self_encryptor.Read(decrypted_.get(), 100, 3 * kDefaultChunkSize - 50));
+    ASSERT_EQ(0, memcmp(original_.get() + 3 * kDefaultChunkSize - 50, decrypted_.get(), 100));
+  }
+  ChunkCacheStatistics statistics(chunk_cache.statistics());
+  EXPECT_EQ(kChunkCount, statistics.misses);
+  EXPECT_EQ(kChunkCount + 4, statistics.hits + statistics.coalesced);
+  EXPECT_EQ(kFileSize, statistics.bytes_held);
+}
+
+TEST(DataMapTest, BEH_ChunkDetailsList) {
+  ChunkDetails details;
+  details.hash = RandomString(kChunkHashSize);
+  for (uint32_t i(0); i != kChunkHashSize; ++i)
+    details.pre_hash[i] = static_cast<byte>(i);
+  details.pre_hash_state = ChunkDetails::kOk;
+  details.storage_state = ChunkDetails::kStored;
+  details.size = kDefaultChunkSize;
+  details.compression = CompressionType::kZstd;
+
+  DataMap data_map;
+  data_map.chunks.resize(3);
+  EXPECT_TRUE(data_map.chunks[1].hash.empty());
+  EXPECT_EQ(ChunkDetails::kEmpty, data_map.chunks[1].pre_hash_state);
+  EXPECT_EQ(ChunkDetails::kUnstored, data_map.chunks[1].storage_state);
+  EXPECT_EQ(CompressionType::kGzip, data_map.chunks[1].compression);
+  EXPECT_EQ(0U, data_map.chunks[1].size);
+
+  // Fields sharing a state byte are set independently.
+  data_map.chunks[1] = details;
+  data_map.chunks.push_back(details);
+  data_map.chunks[3].storage_state = ChunkDetails::kPending;
+  EXPECT_EQ(CompressionType::kZstd, data_map.chunks[3].compression);
+  EXPECT_EQ(details.hash, data_map.chunks[3].hash);
+  data_map.chunks[3].compression = CompressionType::kStore;
+  EXPECT_EQ(ChunkDetails::kPending, data_map.chunks[3].storage_state);
+  EXPECT_EQ(ChunkDetails::kOk, data_map.chunks[3].pre_hash_state);
+
+  data_map.chunks[2] = data_map.chunks[1];
+  data_map.chunks.front() = data_map.chunks.back();
+  data_map.chunks.back().hash.resize(0);
+  EXPECT_TRUE(data_map.chunks[3].hash.empty());
+  EXPECT_NE(data_map.chunks[0].hash, data_map.chunks[3].hash);
+  EXPECT_THROW(data_map.chunks[3].hash = std::string(10, 'a'), std::exception);
+
+  const DataMap& const_data_map(data_map);
+  ChunkDetails copy(const_data_map.chunks[2]);
+  EXPECT_EQ(details.hash, copy.hash);
+  EXPECT_EQ(0, memcmp(details.pre_hash, copy.pre_hash, kChunkHashSize));
+  EXPECT_EQ(details.storage_state, copy.storage_state);
+  EXPECT_EQ(details.size, copy.size);
+  EXPECT_EQ(details.compression, copy.compression);
+  EXPECT_EQ(CompressionType::kStore, const_data_map.chunks[0].compression);
+  EXPECT_EQ(3, std::count_if(const_data_map.chunks.begin(), const_data_map.chunks.end(),
+                             [](ConstChunkDetailsRef chunk) { return !chunk.hash.empty(); }));
+
+  std::string serialised_data_map;
+  SerialiseDataMap(data_map, serialised_data_map);
+  DataMap parsed_data_map;
+  ParseDataMap(serialised_data_map, parsed_data_map);
+  EXPECT_TRUE(data_map == parsed_data_map);
+  ASSERT_EQ(data_map.chunks.size(), parsed_data_map.chunks.size());
+  for (size_t i(0); i != data_map.chunks.size(); ++i) {
+    EXPECT_EQ(0, memcmp(data_map.chunks[i].pre_hash, parsed_data_map.chunks[i].pre_hash,
+                        kChunkHashSize)) << "chunk " << i;
+    EXPECT_EQ(data_map.chunks[i].pre_hash_state, parsed_data_map.chunks[i].pre_hash_state);
+    EXPECT_EQ(data_map.chunks[i].storage_state, parsed_data_map.chunks[i].storage_state);
+    EXPECT_EQ(data_map.chunks[i].size, parsed_data_map.chunks[i].size);
+    EXPECT_EQ(data_map.chunks[i].compression, parsed_data_map.chunks[i].compression);
+  }
+}
+
+TEST(DataMapTest, BEH_ParseOutOfRangeStates) {
+  // A DataMap with one chunk, serialised by hand so that its states can be set to anything.
+  auto serialise([](uint32_t pre_hash_state, uint32_t storage_state, uint32_t compression) {
+    std::string chunk;
+    chunk += '\x0a';
+    chunk += static_cast<char>(kChunkHashSize);
+    chunk += std::string(kChunkHashSize, 'h');
+    chunk += '\x12';
+    chunk += static_cast<char>(kChunkHashSize);
+    chunk += std::string(kChunkHashSize, 'p');
+    chunk += std::string("\x18\x01", 2);
+    chunk += '\x20';
+    chunk += static_cast<char>(pre_hash_state);
+    chunk += '\x28';
+    chunk += static_cast<char>(storage_state);
+    chunk += '\x30';
+    chunk += static_cast<char>(compression);
+    std::string data_map("\x08\x01\x12", 3);
+    data_map += static_cast<char>(0x80 | (chunk.size() & 0x7f));
+    data_map += static_cast<char>(chunk.size() >> 7);
+    return data_map + chunk;
+  });
+
+  DataMap data_map;
+  ASSERT_NO_THROW(ParseDataMap(serialise(ChunkDetails::kOk, ChunkDetails::kUnstored,
+                                         static_cast<uint32_t>(CompressionType::kZstd)),
+                               data_map));
+  ASSERT_EQ(1U, data_map.chunks.size());
+  EXPECT_EQ(ChunkDetails::kOk, data_map.chunks[0].pre_hash_state);
+  EXPECT_EQ(ChunkDetails::kUnstored, data_map.chunks[0].storage_state);
+  EXPECT_EQ(CompressionType::kZstd, data_map.chunks[0].compression);
+  EXPECT_EQ(std::string(kChunkHashSize, 'h'), data_map.chunks[0].hash);
+
+  const std::vector<std::array<uint32_t, 3>> kOutOfRange = {
+      {{ChunkDetails::kOk + 1, ChunkDetails::kStored, 0}},
+      {{ChunkDetails::kOk, ChunkDetails::kUnstored + 1, 0}},
+      {{ChunkDetails::kOk, 4, 0}},
+      {{ChunkDetails::kOk, ChunkDetails::kStored, 4}},
+      {{ChunkDetails::kOk, ChunkDetails::kStored, 5}},
+      {{ChunkDetails::kOk, ChunkDetails::kStored, 100}}};
+  for (const auto& states : kOutOfRange) {
+    DataMap parsed;
+    EXPECT_THROW(ParseDataMap(serialise(states[0], states[1], states[2]), parsed),
+                 std::exception) << states[0] << " " << states[1] << " " << states[2];
+    EXPECT_TRUE(parsed.chunks.empty());
+  }
+
+  // Packed fields written with out-of-range values don't disturb their neighbours.
+  data_map.chunks[0].compression = static_cast<CompressionType>(5);
+  EXPECT_EQ(CompressionType::kStore, data_map.chunks[0].compression);
+  EXPECT_EQ(ChunkDetails::kUnstored, data_map.chunks[0].storage_state);
+  EXPECT_FALSE(data_map.chunks[0].hash.empty());
+  data_map.chunks[0].storage_state = static_cast<ChunkDetails::StorageState>(6);
+  EXPECT_EQ(ChunkDetails::kUnstored, data_map.chunks[0].storage_state);
+  EXPECT_EQ(CompressionType::kStore, data_map.chunks[0].compression);
+}
+
+TEST(ExecutorTest, BEH_NestedLoopsAndExceptions) {
+  WorkStealingExecutor executor(3);
+  EXPECT_EQ(4, executor.Concurrency());
+  std::atomic<int64_t> total(0);
+  executor.ParallelFor(0, 20, [&](int64_t) {
+    executor.ParallelFor(0, 10, [&](int64_t i) { total += i; });
+  });
+  EXPECT_EQ(20 * 45, total);
+
+  // Every index still runs when one throws, and the exception reaches the caller.
+  std::atomic<int> calls(0);
+  EXPECT_THROW(executor.ParallelFor(0, 100, [&](int64_t i) {
+                 ++calls;
+                 if (i == 50)
+                   BOOST_THROW_EXCEPTION(MakeError(CommonErrors::invalid_parameter));
+               }),
+               maidsafe_error);
+  EXPECT_EQ(100, calls);
+
+  InlineExecutor inline_executor;
+  int inline_calls(0);
+  inline_executor.ParallelFor(5, 5, [&](int64_t) { ++inline_calls; });
+  inline_executor.ParallelFor(5, 10, [&](int64_t) { ++inline_calls; });
+  EXPECT_EQ(5, inline_calls);
+}
+
+TEST(ExecutorTest, BEH_RunPendingTask) {
+  InlineExecutor inline_executor;
+  EXPECT_FALSE(inline_executor.RunPendingTask());
+
+  // A task waiting on work it posted to a single worker must help, or it would wait forever.
+  WorkStealingExecutor executor(1);
+  std::promise<bool> helped;
+  executor.Post([&] {
+    std::atomic<bool> done(false);
+    executor.Post([&] { done = true; });
+    while (!done) {
+      if (!executor.RunPendingTask())
+        std::this_thread::yield();
+    }
+    helped.set_value(true);
+  });
+  EXPECT_TRUE(helped.get_future().get());
+  EXPECT_FALSE(executor.RunPendingTask());
+}
+
+class CompressionTest : public EncryptTestBase, public testing::TestWithParam<CompressionType> {
+ public:
+  CompressionTest() : EncryptTestBase(RandomUint32() % (Concurrency() + 1)) {}
+};
+
+TEST_P(CompressionTest, BEH_Version1WriteFlushRead) {
+  if (!CompressionSupported(GetParam()))
+    return;
+  // Mix of compressible and incompressible data, not a whole number of chunks.
+  const uint32_t kDataSize(6 * kDefaultChunkSize + 100);
+  std::string content(std::string(3 * kDefaultChunkSize, 'a') +
+                      RandomString(kDataSize - 3 * kDefaultChunkSize));
+
+  DataMap data_map;
+  data_map.self_encryption_version = EncryptionAlgorithm::kSelfEncryptionVersion1;
+  SelfEncryptorOptions options(options_);
+  options.compression = CompressionConfig(GetParam(), 3, false);
+  {
+    SelfEncryptor self_encryptor(data_map, local_store_, get_from_store_, options);
+    EXPECT_TRUE(self_encryptor.Write(content.data(), kDataSize, 0));
+    EXPECT_TRUE(self_encryptor.Flush());
+  }
+  // The last 100 bytes are too few for a chunk of their own, so they end the sixth chunk.
+  ASSERT_EQ(6U, data_map.chunks.size());
+  for (const auto& chunk : data_map.chunks)
+    EXPECT_EQ(GetParam(), chunk.compression);
+
+  std::string serialised_data_map;
+  SerialiseDataMap(data_map, serialised_data_map);
+  DataMap parsed_data_map;
+  ParseDataMap(serialised_data_map, parsed_data_map);
+  EXPECT_EQ(EncryptionAlgorithm::kSelfEncryptionVersion1, parsed_data_map.self_encryption_version);
+  ASSERT_EQ(data_map.chunks.size(), parsed_data_map.chunks.size());
+  for (const auto& chunk : parsed_data_map.chunks)
+    EXPECT_EQ(GetParam(), chunk.compression);
+
+  std::string decrypted(kDataSize, 0);
+  SelfEncryptor self_encryptor(parsed_data_map, local_store_, get_from_store_, options_);
+  EXPECT_TRUE(self_encryptor.Read(&decrypted[0], kDataSize, 0));
+  EXPECT_TRUE(content == decrypted);
+}
+
+TEST_P(CompressionTest, BEH_SkipIncompressibleChunks) {
+  if (!CompressionSupported(GetParam()))
+    return;
+  // Chunks 0 to 2 are random, chunks 3 to 5 are highly compressible.
+  const uint32_t kDataSize(6 * kDefaultChunkSize);
+  std::string content(RandomString(3 * kDefaultChunkSize) +
+                      std::string(3 * kDefaultChunkSize, 'a'));
+
+  DataMap data_map;
+  data_map.self_encryption_version = EncryptionAlgorithm::kSelfEncryptionVersion1;
+  SelfEncryptorOptions options(options_);
+  options.compression = CompressionConfig(GetParam(), 1);
+  CompressionStatistics statistics;
+  {
+    SelfEncryptor self_encryptor(data_map, local_store_, get_from_store_, options);
+    EXPECT_TRUE(self_encryptor.Write(content.data(), kDataSize, 0));
+    EXPECT_TRUE(self_encryptor.Flush());
+    statistics = self_encryptor.compression_statistics();
+  }
+  ASSERT_EQ(6U, data_map.chunks.size());
+  for (uint32_t i(0); i != 3; ++i)
+    EXPECT_EQ(CompressionType::kStore, data_map.chunks[i].compression);
+  for (uint32_t i(3); i != 6; ++i)
+    EXPECT_EQ(GetParam(), data_map.chunks[i].compression);
+  if (GetParam() == CompressionType::kStore) {
+    EXPECT_EQ(0U, statistics.chunks_probed);
+    EXPECT_EQ(0U, statistics.chunks_skipped);
+  } else {
+    EXPECT_LE(6U, statistics.chunks_probed);
+    EXPECT_LE(3U, statistics.chunks_skipped);
+    EXPECT_EQ(statistics.chunks_skipped * kDefaultChunkSize, statistics.bytes_skipped);
+  }
+
+  std::string decrypted(kDataSize, 0);
+  SelfEncryptor self_encryptor(data_map, local_store_, get_from_store_, options_);
+  EXPECT_TRUE(self_encryptor.Read(&decrypted[0], kDataSize, 0));
+  EXPECT_TRUE(content == decrypted);
+}
+
+INSTANTIATE_TEST_CASE_P(Codecs, CompressionTest,
+                        testing::Values(CompressionType::kGzip, CompressionType::kStore,
+                                        CompressionType::kLz4, CompressionType::kZstd));
+
+TEST(ByteArrayTest, BEH_PoolReusesAlignedBlocks) {
+  ReleaseByteArrayPool();
+  const ByteArrayPoolStatistics kBefore(GetByteArrayPoolStatistics());
+  EXPECT_EQ(0U, kBefore.blocks_held);
+  EXPECT_EQ(0U, kBefore.bytes_held);
+
+  ByteArray small(GetNewByteArray(100));
+  EXPECT_EQ(100U, Size(small));
+  EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(small.get()) % 64);
+
+  byte* first_block(nullptr);
+  {
+    ByteArray zeroed(GetNewByteArray(kDefaultChunkSize + 1));
+    ASSERT_EQ(kDefaultChunkSize + 1, Size(zeroed));
+    EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(zeroed.get()) % 4096);
+    EXPECT_TRUE(std::all_of(zeroed.get(), zeroed.get() + Size(zeroed),
+                            [](byte value) { return value == 0; }));
+    memset(zeroed.get(), 0xff, Size(zeroed));
+    first_block = zeroed.get();
+  }
+  EXPECT_EQ(1U, GetByteArrayPoolStatistics().blocks_held);
+
+  // A request in the same size class gets the freed block back, cleared only when asked for.
+  {
+    ByteArray uninitialised(GetNewByteArray(kDefaultChunkSize + 2, ByteArrayFill::kUninitialised));
+    EXPECT_EQ(first_block, uninitialised.get());
+    EXPECT_EQ(kDefaultChunkSize + 2, Size(uninitialised));
+  }
+  ByteArray zeroed(GetNewByteArray(kDefaultChunkSize + 3));
+  EXPECT_EQ(first_block, zeroed.get());
+  EXPECT_TRUE(std::all_of(zeroed.get(), zeroed.get() + Size(zeroed),
+                          [](byte value) { return value == 0; }));
+
+  // Huge-page blocks are kept apart from ordinary ones.
+  ByteArray huge(
+      GetNewByteArray(kDefaultChunkSize * 4, ByteArrayFill::kZeroed, ByteArrayBacking::kHugePages));
+  EXPECT_EQ(kDefaultChunkSize * 4, Size(huge));
+  EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(huge.get()) % 4096);
+
+  const ByteArrayPoolStatistics kAfter(GetByteArrayPoolStatistics());
+  EXPECT_EQ(5U, kAfter.allocations - kBefore.allocations);
+  EXPECT_EQ(2U, kAfter.pool_hits - kBefore.pool_hits);
+  EXPECT_EQ(0U, kAfter.blocks_held);
+
+  small.reset();
+  zeroed.reset();
+  huge.reset();
+  EXPECT_EQ(3U, GetByteArrayPoolStatistics().blocks_held);
+  EXPECT_LT(static_cast<uint64_t>(kDefaultChunkSize * 5), GetByteArrayPoolStatistics().bytes_held);
+  ReleaseByteArrayPool();
+  EXPECT_EQ(0U, GetByteArrayPoolStatistics().bytes_held);
+}
+
+TEST(ByteArrayTest, BEH_MoveOnlyBufferAndSpan) {
+  ByteArray original(GetNewByteArray(1000));
+  byte* const kBlock(original.get());
+  ByteSpan view(original);
+  EXPECT_EQ(kBlock, view.get());
+  EXPECT_EQ(1000U, Size(view));
+
+  ByteArray moved(std::move(original));
+  EXPECT_FALSE(original);
+  EXPECT_EQ(0U, Size(original));
+  EXPECT_EQ(kBlock, moved.get());
+  EXPECT_EQ(1000U, Size(moved));
+
+  // Writes through a view land in the owning buffer, and are clipped to its size.
+  std::string data(RandomString(20));
+  EXPECT_EQ(10U, MemCopy(view, 990, data.data(), 20));
+  EXPECT_EQ(data.substr(0, 10), std::string(reinterpret_cast<char*>(moved.get()) + 990, 10));
+
+  ByteArray other(GetNewByteArray(10));
+  other = std::move(moved);
+  EXPECT_EQ(kBlock, other.get());
+  other.reset();
+  EXPECT_FALSE(other);
+}
+
+TEST(XorPadTest, BEH_MatchesBytewiseXor) {
+  for (size_t pad_size : {64U, 144U, 1U, 4097U}) {
+    std::string pad(RandomString(pad_size));
+    std::string input(RandomString(3 * 4096 + RandomUint32() % 4096));
+    std::string expected(input);
+    for (size_t i(0); i != expected.size(); ++i)
+      expected[i] ^= pad[i % pad_size];
+
+    // Feed the input in uneven pieces, alternating between in-place and out-of-place use.
+    XorPad xor_pad(reinterpret_cast<const byte*>(pad.data()), pad_size);
+    std::string output(input.size(), 0);
+    size_t done(0);
+    for (int piece(0); done != input.size(); ++piece) {
+      size_t length(std::min(input.size() - done, static_cast<size_t>(RandomUint32() % 5000)));
+      if (piece % 2 == 0) {
+        xor_pad.Apply(reinterpret_cast<const byte*>(&input[done]),
+                      reinterpret_cast<byte*>(&output[done]), length);
+      } else {
+        memcpy(&output[done], &input[done], length);
+        xor_pad.Apply(reinterpret_cast<byte*>(&output[done]), length);
+      }
+      done += length;
+    }
+    ASSERT_EQ(expected, output) << "pad size " << pad_size;
+  }
+}
+
+TEST(ChunkCodecTest, BEH_FusedPostHashAndBlockSink) {
+  std::string key(RandomString(crypto::AES256_KeySize)), iv(RandomString(crypto::AES256_IVSize));
+  std::string pad(RandomString(kPadSize));
+  // Stored, so the encoded size is 3.5 blocks.
+  std::string data(RandomString(3 * kEncodeBlockSize + kEncodeBlockSize / 2));
+  std::string encoded(MaxEncodedChunkSize(CompressionType::kStore, data.size()), 0), from_sink;
+  std::vector<size_t> block_sizes;
+  std::unique_ptr<HashFunction> post_hash(GetCryptoBackend().NewSha512());
+  uint32_t encoded_size(0);
+  ASSERT_EQ(kSuccess,
+            EncodeChunk(reinterpret_cast<const byte*>(data.data()), data.size(),
+                        CompressionType::kStore, 0, reinterpret_cast<const byte*>(key.data()),
+                        reinterpret_cast<const byte*>(iv.data()),
+                        reinterpret_cast<const byte*>(pad.data()),
+                        reinterpret_cast<byte*>(&encoded[0]), &encoded_size, post_hash.get(),
+                        [&](const byte* block, size_t size) {
+                          from_sink.append(reinterpret_cast<const char*>(block), size);
+                          block_sizes.push_back(size);
+                        }));
+  encoded.resize(encoded_size);
+  EXPECT_EQ(encoded, from_sink);
+  ASSERT_EQ(4U, block_sizes.size());
+  EXPECT_EQ(kEncodeBlockSize, block_sizes[0]);
+  EXPECT_EQ(kEncodeBlockSize / 2, block_sizes[3]);
+
+  std::string fused_digest(crypto::SHA512::DIGESTSIZE, 0), digest(crypto::SHA512::DIGESTSIZE, 0);
+  post_hash->Final(reinterpret_cast<byte*>(&fused_digest[0]));
+  GetCryptoBackend().Sha512(reinterpret_cast<const byte*>(encoded.data()), encoded.size(),
+                            reinterpret_cast<byte*>(&digest[0]));
+  EXPECT_EQ(digest, fused_digest);
+
+  std::string decoded(data.size(), 0);
+  EXPECT_EQ(kSuccess,
+            DecodeChunk(reinterpret_cast<const byte*>(encoded.data()), encoded.size(),
+                        CompressionType::kStore, reinterpret_cast<const byte*>(key.data()),
+                        reinterpret_cast<const byte*>(iv.data()),
+                        reinterpret_cast<const byte*>(pad.data()),
+                        reinterpret_cast<byte*>(&decoded[0]), decoded.size()));
+  EXPECT_EQ(data, decoded);
+}
+
+TEST(ChunkCodecTest, BEH_DecodeChunkRange) {
+  std::string key(RandomString(crypto::AES256_KeySize)), iv(RandomString(crypto::AES256_IVSize));
+  std::string pad(RandomString(kPadSize));
+  // Half random and half repetitive, so that compressed chunks are neither stored nor trivial.
+  std::string data(RandomString(kDefaultChunkSize / 2));
+  data.append(std::string(kDefaultChunkSize / 2 + 77, 'a'));
+  const uint32_t kLength(static_cast<uint32_t>(data.size()));
+  const std::vector<std::pair<uint32_t, uint32_t>> kRanges = {
+      std::make_pair(0U, kLength), std::make_pair(0U, 100U), std::make_pair(17U, 1000U),
+      std::make_pair(16U, 0U), std::make_pair(static_cast<uint32_t>(kEncodeBlockSize) + 5, 16U),
+      std::make_pair(kLength / 2 - 9, 18U), std::make_pair(kLength - 3, 3U),
+      std::make_pair(kLength / 2, kLength - kLength / 2)};
+  for (CompressionType compression : {CompressionType::kStore, CompressionType::kGzip,
+                                      CompressionType::kLz4, CompressionType::kZstd}) {
+    if (!CompressionSupported(compression))
+      continue;
+    std::string encoded(MaxEncodedChunkSize(compression, kLength), 0);
+    uint32_t encoded_size(0);
+    ASSERT_EQ(kSuccess,
+              EncodeChunk(reinterpret_cast<const byte*>(data.data()), kLength, compression, 1,
+                          reinterpret_cast<const byte*>(key.data()),
+                          reinterpret_cast<const byte*>(iv.data()),
+                          reinterpret_cast<const byte*>(pad.data()),
+                          reinterpret_cast<byte*>(&encoded[0]), &encoded_size));
+    for (const auto& range : kRanges) {
+      std::string decoded(range.second, 0);
+      ASSERT_EQ(kSuccess,
+                DecodeChunkRange(reinterpret_cast<const byte*>(encoded.data()), encoded_size,
+                                 compression, reinterpret_cast<const byte*>(key.data()),
+                                 reinterpret_cast<const byte*>(iv.data()),
+                                 reinterpret_cast<const byte*>(pad.data()), kLength, range.first,
+                                 reinterpret_cast<byte*>(&decoded[0]), range.second));
+      EXPECT_EQ(data.substr(range.first, range.second), decoded)
+          << static_cast<uint32_t>(compression) << ": " << range.second << " bytes at "
+          << range.first;
+    }
+  }
+}
+
+TEST(ChunkCacheTest, BEH_CoalesceAndEvict) {
+  const uint32_t kChunkSize(1000);
+  ChunkCache chunk_cache(3 * kChunkSize);
+
+  // Concurrent requests for one chunk wait for a single decryption, which here doesn't finish
+  // until all of the others are waiting for it.
+  const uint64_t kThreads(8);
+  std::atomic<int> decryptions(0);
+  auto decrypt([&](byte* output) {
+    ++decryptions;
+    for (int i(0); i != 1000 && chunk_cache.statistics().coalesced != kThreads - 1; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    memset(output, 'a', kChunkSize);
+    return kSuccess;
+  });
+  std::vector<std::future<bool>> readers;
+  for (uint64_t i(0); i != kThreads; ++i) {
+    readers.push_back(std::async(std::launch::async, [&] {
+      std::shared_ptr<const ByteArray> chunk;
+      return chunk_cache.Get("a", kChunkSize, decrypt, &chunk) == kSuccess &&
+             chunk->get()[kChunkSize - 1] == 'a';
+    }));
+  }
+  for (auto& reader : readers)
+    EXPECT_TRUE(reader.get());
+  EXPECT_EQ(1, decryptions.load());
+  ChunkCacheStatistics statistics(chunk_cache.statistics());
+  EXPECT_EQ(1U, statistics.misses);
+  EXPECT_EQ(kThreads - 1, statistics.coalesced);
+
+  // Failures are passed on and not kept.
+  std::shared_ptr<const ByteArray> chunk;
+  EXPECT_EQ(kDecryptionException, chunk_cache.Get("b", kChunkSize, [](byte* /*output*/) {
+    return kDecryptionException;
+  }, &chunk));
+  EXPECT_FALSE(chunk);
+  EXPECT_FALSE(chunk_cache.Contains("b"));
+
+  // Adding a fourth chunk drops the least recently used, "b".
+  auto fill([&](byte* output) {
+    memset(output, 'x', kChunkSize);
+    return kSuccess;
+  });
+  for (const std::string& key : {"b", "c", "a", "d"})
+    ASSERT_EQ(kSuccess, chunk_cache.Get(key, kChunkSize, fill, &chunk));
+  EXPECT_TRUE(chunk_cache.Contains("a"));
+  EXPECT_FALSE(chunk_cache.Contains("b"));
+  EXPECT_TRUE(chunk_cache.Contains("c"));
+  EXPECT_TRUE(chunk_cache.Contains("d"));
+  statistics = chunk_cache.statistics();
+  EXPECT_EQ(1U, statistics.hits);
+  EXPECT_EQ(1U, statistics.evictions);
+  EXPECT_EQ(3U * kChunkSize, statistics.bytes_held);
+  chunk_cache.Clear();
+  EXPECT_EQ(0U, chunk_cache.statistics().bytes_held);
+  EXPECT_EQ('x', chunk->get()[0]);
+}
+
 }  // namespace test
 
 }  // namespace encrypt
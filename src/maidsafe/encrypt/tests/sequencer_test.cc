@@ -0,0 +1,155 @@
+/*  Copyright 2011 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "maidsafe/common/test.h"
+
+#include "maidsafe/encrypt/config.h"
+#include "maidsafe/encrypt/sequencer.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace test {
+
+namespace {
+
+std::string Contents(const SequencePiece& piece) {
+  return std::string(reinterpret_cast<const char*>(piece.get()), Size(piece));
+}
+
+std::string Read(const Sequencer& sequencer, uint32_t length, uint64_t position) {
+  std::string data(length, '.');
+  sequencer.Read(&data[0], length, position);
+  return data;
+}
+
+}  // unnamed namespace
+
+TEST(SequencerTest, BEH_OverlappingAdd) {
+  Sequencer sequencer;
+  ASSERT_EQ(kSuccess, sequencer.Add(std::string(10, 'a').data(), 10, 100));
+  // An Add within a block splits it in three.
+  ASSERT_EQ(kSuccess, sequencer.Add(std::string(4, 'b').data(), 4, 104));
+  EXPECT_EQ(SequenceBlockExtent(100, 4), sequencer.PeekBeyond(0));
+  EXPECT_EQ(SequenceBlockExtent(104, 4), sequencer.PeekBeyond(101));
+  EXPECT_EQ(SequenceBlockExtent(108, 2), sequencer.PeekBeyond(105));
+  EXPECT_EQ(SequenceBlockExtent(104, 4), sequencer.Peek(2, 106));
+  EXPECT_EQ("..aaaabbbbaa..", Read(sequencer, 14, 98));
+  EXPECT_EQ(14U, sequencer.memory_size());
+
+  // Adds overlapping the ends of blocks trim them.
+  ASSERT_EQ(kSuccess, sequencer.Add(std::string(4, 'c').data(), 4, 98));
+  ASSERT_EQ(kSuccess, sequencer.Add(std::string(3, 'd').data(), 3, 109));
+  EXPECT_EQ("ccccaabbbbaddd", Read(sequencer, 14, 98));
+  EXPECT_EQ(15U, sequencer.memory_size());
+
+  // One covering several blocks replaces them.
+  ASSERT_EQ(kSuccess, sequencer.Add(std::string(10, 'e').data(), 10, 100));
+  EXPECT_EQ("cceeeeeeeeeedd", Read(sequencer, 14, 98));
+  EXPECT_EQ(SequenceBlockExtent(98, 2), sequencer.PeekBeyond(0));
+  EXPECT_EQ(SequenceBlockExtent(100, 10), sequencer.PeekBeyond(99));
+  EXPECT_EQ(SequenceBlockExtent(110, 2), sequencer.PeekBeyond(101));
+  EXPECT_EQ(17U, sequencer.memory_size());
+
+  // Neighbouring blocks aren't joined.
+  ASSERT_EQ(kSuccess, sequencer.Add(std::string(2, 'f').data(), 2, 112));
+  EXPECT_EQ(SequenceBlockExtent(112, 2), sequencer.PeekBeyond(111));
+  EXPECT_EQ(std::numeric_limits<uint64_t>::max(), sequencer.PeekBeyond(113).first);
+  EXPECT_EQ("ccee", Read(sequencer, 4, 98));
+}
+
+TEST(SequencerTest, BEH_GetAcrossPieceBoundaries) {
+  Sequencer sequencer;
+  ASSERT_EQ(kSuccess, sequencer.Add(std::string(10, 'a').data(), 10, 0));
+  ASSERT_EQ(kSuccess, sequencer.Add(std::string(10, 'b').data(), 10, 20));
+  ASSERT_EQ(kSuccess, sequencer.Add(std::string(4, 'c').data(), 4, 5));
+
+  // Get only takes a block starting exactly at the position.
+  EXPECT_FALSE(sequencer.Get(6));
+  SequencePiece piece(sequencer.Get(5));
+  ASSERT_TRUE(piece);
+  EXPECT_EQ("cccc", Contents(piece));
+  EXPECT_EQ("aaaaa....a", Read(sequencer, 10, 0));
+
+  // GetBefore splits the block spanning its position, and leaves the tail in place.
+  std::vector<SequenceBlock> blocks(sequencer.GetBefore(25));
+  ASSERT_EQ(3U, blocks.size());
+  EXPECT_EQ(0U, blocks[0].first);
+  EXPECT_EQ("aaaaa", Contents(blocks[0].second));
+  EXPECT_EQ(9U, blocks[1].first);
+  EXPECT_EQ("a", Contents(blocks[1].second));
+  EXPECT_EQ(20U, blocks[2].first);
+  EXPECT_EQ("bbbbb", Contents(blocks[2].second));
+  EXPECT_EQ(SequenceBlockExtent(25, 5), sequencer.PeekBeyond(0));
+  EXPECT_TRUE(sequencer.GetBefore(25).empty());
+  EXPECT_EQ(10U, sequencer.memory_size());
+
+  // Splitting at a block's end leaves it whole.
+  blocks = sequencer.GetBefore(30);
+  ASSERT_EQ(1U, blocks.size());
+  EXPECT_EQ(25U, blocks[0].first);
+  EXPECT_EQ("bbbbb", Contents(blocks[0].second));
+  EXPECT_EQ(0U, sequencer.memory_size());
+  EXPECT_EQ(std::numeric_limits<uint64_t>::max(), sequencer.GetFirst().first);
+
+  // Pieces taken out stay valid after the rest of their buffer is removed.
+  ASSERT_EQ(kSuccess, sequencer.Add("0123456789", 10, 40));
+  blocks = sequencer.GetBefore(43);
+  sequencer.Truncate(0);
+  ASSERT_EQ(1U, blocks.size());
+  EXPECT_EQ("012", Contents(blocks[0].second));
+  EXPECT_EQ(0U, sequencer.memory_size());
+}
+
+TEST(SequencerTest, BEH_Compact) {
+  const uint32_t kSize(1000);
+  std::string data(kSize, '\0');
+  for (uint32_t i(0); i != kSize; ++i)
+    data[i] = static_cast<char>('a' + i % 26);
+  Sequencer sequencer;
+
+  // Overwriting less than half of a buffer keeps it whole, shared by the pieces either side.
+  ASSERT_EQ(kSuccess, sequencer.Add(data.data(), kSize, 0));
+  ASSERT_EQ(kSuccess, sequencer.Add(std::string(100, 'x').data(), 100, 100));
+  EXPECT_EQ(kSize + 100U, sequencer.memory_size());
+
+  // Once the pieces left cover less than half of it, they get copies of their own and the
+  // buffer is freed.
+  ASSERT_EQ(kSuccess, sequencer.Add(std::string(500, 'y').data(), 500, 300));
+  EXPECT_EQ(kSize, sequencer.memory_size());
+  std::string expected(data);
+  expected.replace(100, 100, std::string(100, 'x'));
+  expected.replace(300, 500, std::string(500, 'y'));
+  EXPECT_EQ(expected, Read(sequencer, kSize, 0));
+
+  // Freeing every piece of a buffer frees it, however it was compacted.
+  sequencer.Truncate(0);
+  EXPECT_EQ(0U, sequencer.memory_size());
+  EXPECT_EQ(0U, sequencer.size());
+}
+
+}  // namespace test
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
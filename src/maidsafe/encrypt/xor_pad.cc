@@ -0,0 +1,109 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/encrypt/xor_pad.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "maidsafe/encrypt/cpu_features.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace {
+
+// Length of the expanded pad beyond its first repetition, i.e. the most bytes XORed per kernel
+// call.  Small enough to stay in L1 alongside the data.
+const size_t kMinRunSize(4096);
+
+typedef void (*XorKernel)(byte*, const byte*, const byte*, size_t);
+
+XorKernel SelectXorKernel() {
+#ifdef MAIDSAFE_ENCRYPT_X86_SIMD
+  const CpuFeatures& features(GetCpuFeatures());
+  if (features.avx512f)
+    return &detail::XorBytesAvx512;
+  if (features.avx2)
+    return &detail::XorBytesAvx2;
+  if (features.sse2)
+    return &detail::XorBytesSse2;
+#endif
+  return &detail::XorBytesPortable;
+}
+
+}  // unnamed namespace
+
+namespace detail {
+
+void XorBytesPortable(byte* output, const byte* input, const byte* mask, size_t length) {
+  size_t i(0);
+  for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+    uint64_t data_word, mask_word;
+    memcpy(&data_word, input + i, sizeof(data_word));
+    memcpy(&mask_word, mask + i, sizeof(mask_word));
+    data_word ^= mask_word;
+    memcpy(output + i, &data_word, sizeof(data_word));
+  }
+  for (; i != length; ++i)
+    output[i] = input[i] ^ mask[i];
+}
+
+}  // namespace detail
+
+void XorBytes(byte* output, const byte* input, const byte* mask, size_t length) {
+  static const XorKernel kXorKernel(SelectXorKernel());
+  kXorKernel(output, input, mask, length);
+}
+
+XorPad::XorPad() : expanded_pad_(), pad_size_(0), run_size_(0), offset_(0) {}
+
+XorPad::XorPad(const byte* pad, size_t pad_size)
+    : expanded_pad_(), pad_size_(0), run_size_(0), offset_(0) {
+  Reset(pad, pad_size);
+}
+
+void XorPad::Reset(const byte* pad, size_t pad_size) {
+  assert(pad_size != 0);
+  pad_size_ = pad_size;
+  // A whole number of pads, so that a full run leaves offset_ unchanged.
+  run_size_ = ((kMinRunSize + pad_size - 1) / pad_size) * pad_size;
+  expanded_pad_.resize(run_size_ + pad_size);
+  for (size_t copied(0); copied < expanded_pad_.size(); copied += pad_size) {
+    memcpy(&expanded_pad_[copied], pad, std::min(pad_size, expanded_pad_.size() - copied));
+  }
+  offset_ = 0;
+}
+
+void XorPad::Apply(const byte* input, byte* output, size_t length) {
+  assert(pad_size_ != 0);
+  while (length != 0) {
+    size_t run(std::min(length, run_size_));
+    XorBytes(output, input, &expanded_pad_[offset_], run);
+    offset_ = (offset_ + run) % pad_size_;
+    input += run;
+    output += run;
+    length -= run;
+  }
+}
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
@@ -0,0 +1,73 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_ENCRYPT_XOR_PAD_H_
+#define MAIDSAFE_ENCRYPT_XOR_PAD_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "cryptopp/config.h"
+
+namespace maidsafe {
+
+namespace encrypt {
+
+// XORs "length" bytes of input with mask into output.  output may equal input.  Uses the widest
+// vector unit available (AVX-512, AVX2, SSE2), falling back to 64-bit words.
+void XorBytes(byte* output, const byte* input, const byte* mask, size_t length);
+
+// Applies a repeating pad to a stream of data.  The pad is expanded once into a contiguous run
+// several KB long, so each call reduces to a few XorBytes calls over contiguous memory rather
+// than a per-byte modulo.  The position within the pad carries over between calls to Apply.
+class XorPad {
+ public:
+  XorPad();
+  XorPad(const byte* pad, size_t pad_size);
+  // Replaces the pad and rewinds to its start.  Reuses the existing allocation where possible.
+  void Reset(const byte* pad, size_t pad_size);
+  // XORs input with the pad into output.  output may equal input for in-place use.
+  void Apply(const byte* input, byte* output, size_t length);
+  void Apply(byte* data, size_t length) { Apply(data, data, length); }
+  // Moves to where the pad would be after "position" bytes had been applied since Reset.
+  void Seek(uint64_t position) { offset_ = static_cast<size_t>(position % pad_size_); }
+
+ private:
+  XorPad(const XorPad&);
+  XorPad& operator=(const XorPad&);
+
+  std::vector<byte> expanded_pad_;
+  size_t pad_size_, run_size_, offset_;
+};
+
+namespace detail {
+
+void XorBytesPortable(byte* output, const byte* input, const byte* mask, size_t length);
+#ifdef MAIDSAFE_ENCRYPT_X86_SIMD
+void XorBytesSse2(byte* output, const byte* input, const byte* mask, size_t length);
+void XorBytesAvx2(byte* output, const byte* input, const byte* mask, size_t length);
+void XorBytesAvx512(byte* output, const byte* input, const byte* mask, size_t length);
+#endif
+
+}  // namespace detail
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_ENCRYPT_XOR_PAD_H_
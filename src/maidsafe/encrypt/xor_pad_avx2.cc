@@ -0,0 +1,58 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+// Compiled with AVX2 code generation enabled (see CMakeLists.txt).  Only called after a runtime
+// check confirms the CPU supports it.
+
+#include "maidsafe/encrypt/xor_pad.h"
+
+#ifdef MAIDSAFE_ENCRYPT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace detail {
+
+#ifdef MAIDSAFE_ENCRYPT_X86_SIMD
+void XorBytesAvx2(byte* output, const byte* input, const byte* mask, size_t length) {
+  size_t i(0);
+  for (; i + 128 <= length; i += 128) {
+    const __m256i* in(reinterpret_cast<const __m256i*>(input + i));
+    const __m256i* pad(reinterpret_cast<const __m256i*>(mask + i));
+    __m256i* out(reinterpret_cast<__m256i*>(output + i));
+    __m256i data0(_mm256_xor_si256(_mm256_loadu_si256(in), _mm256_loadu_si256(pad)));
+    __m256i data1(_mm256_xor_si256(_mm256_loadu_si256(in + 1), _mm256_loadu_si256(pad + 1)));
+    __m256i data2(_mm256_xor_si256(_mm256_loadu_si256(in + 2), _mm256_loadu_si256(pad + 2)));
+    __m256i data3(_mm256_xor_si256(_mm256_loadu_si256(in + 3), _mm256_loadu_si256(pad + 3)));
+    _mm256_storeu_si256(out, data0);
+    _mm256_storeu_si256(out + 1, data1);
+    _mm256_storeu_si256(out + 2, data2);
+    _mm256_storeu_si256(out + 3, data3);
+  }
+  XorBytesPortable(output + i, input + i, mask + i, length - i);
+}
+#endif
+
+}  // namespace detail
+
+}  // namespace encrypt
+
+}  // namespace maidsafe
@@ -0,0 +1,58 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+// Compiled with AVX-512F code generation enabled (see CMakeLists.txt).  Only called after a runtime
+// check confirms the CPU supports it.
+
+#include "maidsafe/encrypt/xor_pad.h"
+
+#ifdef MAIDSAFE_ENCRYPT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace maidsafe {
+
+namespace encrypt {
+
+namespace detail {
+
+#ifdef MAIDSAFE_ENCRYPT_X86_SIMD
+void XorBytesAvx512(byte* output, const byte* input, const byte* mask, size_t length) {
+  size_t i(0);
+  for (; i + 256 <= length; i += 256) {
+    const __m512i* in(reinterpret_cast<const __m512i*>(input + i));
+    const __m512i* pad(reinterpret_cast<const __m512i*>(mask + i));
+    __m512i* out(reinterpret_cast<__m512i*>(output + i));
+    __m512i data0(_mm512_xor_si512(_mm512_loadu_si512(in), _mm512_loadu_si512(pad)));
+    __m512i data1(_mm512_xor_si512(_mm512_loadu_si512(in + 1), _mm512_loadu_si512(pad + 1)));
+    __m512i data2(_mm512_xor_si512(_mm512_loadu_si512(in + 2), _mm512_loadu_si512(pad + 2)));
+    __m512i data3(_mm512_xor_si512(_mm512_loadu_si512(in + 3), _mm512_loadu_si512(pad + 3)));
+    _mm512_storeu_si512(out, data0);
+    _mm512_storeu_si512(out + 1, data1);
+    _mm512_storeu_si512(out + 2, data2);
+    _mm512_storeu_si512(out + 3, data3);
+  }
+  XorBytesPortable(output + i, input + i, mask + i, length - i);
+}
+#endif
+
+}  // namespace detail
+
+}  // namespace encrypt
+
+}  // namespace maidsafe